@@ -0,0 +1,20 @@
+#include "assignment.h"
+
+bool parseAssign ( const std::string & name, kMeansAssign & assign ) {
+   if ( name == "auto" ) assign = kMeansAssign::automatic;
+   else if ( name == "pairwise" ) assign = kMeansAssign::pairwise;
+   else if ( name == "blocked" ) assign = kMeansAssign::blocked;
+   else return false;
+   return true;
+}
+
+const char * assignName ( kMeansAssign assign ) {
+   switch ( assign ) {
+      case kMeansAssign::pairwise: return "pairwise";
+      case kMeansAssign::blocked: return "blocked";
+      default: return "auto";
+   }
+}
+
+// Definition of the tile size, which std::min binds to a reference
+constexpr unsigned int blockAssigner::tileSize;
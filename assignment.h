@@ -0,0 +1,172 @@
+#ifndef _ASSIGNMENT_H
+#define _ASSIGNMENT_H
+
+#include "point.h"
+#include "dataset.h"
+#include "distance.h"
+
+#include <vector>
+#include <string>
+#include <limits>
+#include <algorithm>
+
+// Assignment methods of the solvers, i.e. how the nearest centroid of each
+// point is found
+// pairwise : the distance of each point from each centroid is computed on its
+//    own, with the distance kernels
+// blocked : tiles of points are compared with all the centroids at once through
+//    the expansion |x-c|^2 = |x|^2 - 2 x.c + |c|^2, whose dot products are
+//    computed as a cache-blocked matrix product; only for the squared euclidean
+//    distance, solvers with other distances fall back to pairwise
+// automatic : blocked for the squared euclidean distance from dimension
+//    blockedMinDim on, pairwise otherwise
+enum class kMeansAssign { automatic, pairwise, blocked };
+
+// Conversion from and to the names used on the command line
+// (auto, pairwise, blocked); parsing returns false on unknown names
+bool parseAssign ( const std::string &, kMeansAssign & );
+const char * assignName ( kMeansAssign );
+
+// Dimension from which the automatic assignment is blocked
+constexpr unsigned int blockedMinDim = 32;
+
+// Buffers of a thread using the blocked assignment
+struct blockWorkspace {
+   // Coordinates of the points of the tile, as rows, converted to double if
+   // the dataset is in single precision (see tileAsDouble)
+   std::vector<double, alignedAllocator<double>> tile;
+
+   // Dot products of the points of the tile with the centroids, and the part
+   // of the expansion that depends on the centroids, |c|^2 - 2 x.c, for a point
+   std::vector<double, alignedAllocator<double>> dots;
+   std::vector<double> partial;
+
+   // Labels of the points of the tile, and their squared distances
+   std::vector<int> labels;
+   std::vector<double> dists;
+};
+
+// Coordinates of a tile of size values as doubles, for the dot products: double
+// precision ones are used in place, single precision ones are converted into buf
+inline const double * tileAsDouble ( const double * x, std::size_t, double * ) { return x; }
+inline const double * tileAsDouble ( const float * x, std::size_t size, double * buf ) { std::copy ( x, x + size, buf ); return buf; }
+
+// Blocked nearest-centroid search
+// The centroids are packed once per iteration, with their squared norms; then
+// each tile of points is compared with all of them. The expansion loses accuracy
+// through cancellation when the distances are much smaller than the norms:
+// points for which the error bound of the expansion does not single out the
+// nearest centroid are settled by computing the exact distances from the
+// centroids it leaves in doubt, so that the labels are the same as with the
+// pairwise search (ties going to the lowest label)
+class blockAssigner {
+private:
+   unsigned int n = 0, k = 0, npanels = 0;
+
+   // Centroids packed in panels of dotsPanel (see blockedDotsKernel), padded
+   // with zeros, their squared norms, and the error bounds of the norms
+   std::vector<double, alignedAllocator<double>> panels;
+   std::vector<double> norms, normErrors;
+
+   // Centroids, for the exact distances
+   const std::vector<point> * centroids = nullptr;
+
+   // Relative error bound of the expansion, with respect to |x|^2 + |c|^2
+   double gamma = 0;
+
+public:
+   // Points per tile
+   static constexpr unsigned int tileSize = 64;
+
+   // Packs the centroids, which must outlive the following assignments
+   void setCentroids ( const std::vector<point> & );
+
+   // Finds the nearest centroid of the tile of m points x, given as rows,
+   // writing ws.labels and ws.dists (squared distances); exact computes the
+   // distance between two points, as the solver does
+   // Returns the number of points settled with exact distances
+   template < typename Exact >
+   unsigned int assign ( const double * x, unsigned int m, blockWorkspace & ws, Exact exact ) const;
+};
+
+inline void blockAssigner::setCentroids ( const std::vector<point> & c ) {
+   centroids = &c;
+   k = c.size();
+   n = k ? c[0].getN() : 0;
+   npanels = ( k + dotsPanel - 1 ) / dotsPanel;
+   gamma = 8.0 * ( n + 4 ) * std::numeric_limits<double>::epsilon();
+
+   panels.assign ( std::size_t(npanels) * n * dotsPanel, 0 );
+   norms.assign ( k, 0 );
+   normErrors.resize ( k );
+
+   for ( unsigned int kk = 0; kk < k; ++kk ) {
+      double * panel = panels.data() + std::size_t(kk / dotsPanel) * n * dotsPanel;
+      for ( unsigned int j = 0; j < n; ++j ) {
+         panel[std::size_t(j) * dotsPanel + kk % dotsPanel] = c[kk][j];
+         norms[kk] += c[kk][j] * c[kk][j];
+      }
+      normErrors[kk] = gamma * norms[kk];
+   }
+}
+
+template < typename Exact >
+unsigned int blockAssigner::assign ( const double * x, unsigned int m, blockWorkspace & ws, Exact exact ) const {
+   unsigned int ldo = npanels * dotsPanel;
+   ws.dots.resize ( std::size_t(m) * ldo );
+   ws.labels.resize ( m );
+   ws.dists.resize ( m );
+
+   blockedDotsKernel ( x, m, panels.data(), npanels, n, ws.dots.data(), ldo );
+
+   ws.partial.resize ( k );
+   double * partial = ws.partial.data();
+   unsigned int settled = 0;
+
+   for ( unsigned int i = 0; i < m; ++i ) {
+      const double * xi = x + std::size_t(i) * n;
+      const double * dots = ws.dots.data() + std::size_t(i) * ldo;
+
+      // The nearest centroid according to the expansion only depends on
+      // |c|^2 - 2 x.c; the exact distance from it then gives |x|^2, which is
+      // needed for the error bounds
+      for ( unsigned int kk = 0; kk < k; ++kk )
+         partial[kk] = norms[kk] - 2 * dots[kk];
+
+      int nearest = 0;
+      for ( unsigned int kk = 1; kk < k; ++kk )
+         if ( partial[kk] < partial[nearest] ) nearest = kk;
+
+      double nearestDist = exact ( xi, (*centroids)[nearest].data() );
+      double xnorm = std::max ( 0.0, nearestDist - partial[nearest] );
+
+      // Upper bound of the distance from the nearest centroid, and centroids
+      // whose lower bound does not exceed it (the nearest one among them); if
+      // there are others, the search among them is done with exact distances
+      double limit = partial[nearest] + normErrors[nearest] + 2 * gamma * xnorm;
+      unsigned int candidates = 0;
+      for ( unsigned int kk = 0; kk < k; ++kk )
+         candidates += partial[kk] - normErrors[kk] <= limit;
+
+      if ( candidates > 1 ) {
+         ++settled;
+         nearest = -1;
+         for ( unsigned int kk = 0; kk < k; ++kk ) {
+            if ( partial[kk] - normErrors[kk] > limit ) continue;
+
+            double d = exact ( xi, (*centroids)[kk].data() );
+            if ( nearest < 0 || d < nearestDist ) {
+               nearestDist = d;
+               nearest = kk;
+            }
+         }
+      }
+
+      ws.labels[i] = nearest;
+      ws.dists[i] = nearestDist;
+   }
+
+   return settled;
+}
+
+#endif
@@ -0,0 +1,567 @@
+#include "kmeans_factory.h"
+#include "dataset_io.h"
+#include "synthetic.h"
+#include "reduction.h"
+#include "timer.h"
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <fstream>
+#include <cstdio>
+#include <cmath>
+#include <random>
+#include <vector>
+#include <string>
+#include <memory>
+#include <algorithm>
+
+#include "GetPot"
+
+using std::cout;
+using std::clog;
+using std::endl;
+
+// Benchmark harness
+// Usage: [mpiexec -np <P>] ./kmeans_bench [--suite <suites>] [--warmup <w>] [--reps <r>]
+//           [--points <N>] [--centroids <k>] [--dims <d1,d2,...>] [--threads <t>]
+//           [--parse-points <N>] [--solver-points <N>] [--methods <m1,m2,...>]
+//           [--iters <i>] [--csv <file>] [--json <file>] [--tag <label>]
+//           [--baseline <file>] [--tolerance <fraction>]
+// Suites, given as a comma separated list (default: kernels):
+//  - kernels : distance kernels of each instruction set, nearest-centroid
+//    assignment (pairwise and blocked), reduction of the sums of the clusters
+//    across the processes, and text parsing; all but the reduction run on
+//    process 0 only
+//  - strong : solvers running a fixed number of iterations on --solver-points
+//    points split among the processes
+//  - weak : as strong, with --solver-points points per process
+// Each benchmark is run warmup times, then timed reps times; the median, the
+// minimum, the mean and the standard deviation of the times are reported, with
+// the throughput at the median. With more processes, each run starts after a
+// barrier and takes the time of the slowest one
+// Results are printed as a table, and appended to the CSV file and to the JSON
+// file (one object per line), so that runs with different numbers of processes
+// or of different versions (told apart by --tag) accumulate in the same files;
+// the medians can be compared with those of a previous CSV file (--baseline),
+// flagging the benchmarks slower than it by more than the tolerance
+
+// Statistics of the times of the runs of a benchmark, in milliseconds
+struct benchStats {
+   unsigned int reps = 0;
+   double median = 0, min = 0, mean = 0, stddev = 0;
+};
+
+benchStats summarize ( std::vector<double> times ) {
+   benchStats s;
+   s.reps = times.size();
+   if ( times.empty() ) return s;
+
+   std::sort ( times.begin(), times.end() );
+   std::size_t m = times.size() / 2;
+   s.median = times.size() % 2 ? times[m] : ( times[m-1] + times[m] ) / 2;
+   s.min = times.front();
+
+   for ( double t : times ) s.mean += t;
+   s.mean /= times.size();
+   for ( double t : times ) s.stddev += ( t - s.mean ) * ( t - s.mean );
+   s.stddev = std::sqrt ( s.stddev / times.size() );
+
+   return s;
+}
+
+// Runs f warmup times, then reps times, timing each of the latter
+template < typename F >
+benchStats measure ( F f, unsigned int warmup, unsigned int reps, MPI_Comm comm = MPI_COMM_SELF ) {
+   for ( unsigned int w = 0; w < warmup; ++w ) f();
+
+   std::vector<double> times;
+   timer tm;
+
+   for ( unsigned int r = 0; r < reps; ++r ) {
+      MPI_Barrier ( comm );
+      tm.start();
+      f();
+      tm.stop();
+
+      double t = tm.getTime();
+      MPI_Allreduce ( MPI_IN_PLACE, &t, 1, MPI_DOUBLE, MPI_MAX, comm );
+      times.push_back ( t );
+   }
+
+   return summarize ( times );
+}
+
+// Result of a benchmark
+// work is the amount of work done by a run, in the unit of the throughput
+// (e.g. distances for dist/s)
+struct benchRecord {
+   std::string suite, name, isa;
+   unsigned int dim = 0, points = 0, centroids = 0, procs = 1, threads = 1;
+   benchStats stats;
+   double work = 0;
+   std::string unit;
+
+   double throughput ( void ) const { return stats.median > 0 ? work / ( stats.median / 1000.0 ) : 0; }
+
+   // Identifies the benchmark across runs and versions
+   std::string key ( void ) const {
+      std::ostringstream out;
+      out << suite << "," << name << "," << isa << "," << dim << "," << points << "," << centroids << "," << procs << "," << threads;
+      return out.str();
+   }
+};
+
+// Collection of the results, printed as they are added
+class benchReport {
+private:
+   std::vector<benchRecord> records;
+   std::string tag;
+   bool print;
+
+   static std::string jsonString ( const std::string & s ) {
+      std::string out = "\"";
+      for ( char c : s ) {
+         if ( c == '"' || c == '\\' ) out += '\\';
+         out += c;
+      }
+      return out + "\"";
+   }
+
+public:
+   benchReport ( const std::string & t, bool p ) : tag(t), print(p) {
+      if ( !print ) return;
+      cout << std::left << std::setw(11) << "suite" << std::setw(16) << "name" << std::setw(8) << "isa" << std::right
+           << std::setw(5) << "dim" << std::setw(10) << "points" << std::setw(6) << "k" << std::setw(6) << "procs"
+           << std::setw(5) << "thr" << std::setw(12) << "median ms" << std::setw(12) << "min ms" << std::setw(10) << "stddev"
+           << std::setw(14) << "throughput" << "  unit" << endl;
+   }
+
+   void add ( const benchRecord & r ) {
+      records.push_back ( r );
+      if ( !print ) return;
+      cout << std::left << std::setw(11) << r.suite << std::setw(16) << r.name << std::setw(8) << r.isa << std::right
+           << std::setw(5) << r.dim << std::setw(10) << r.points << std::setw(6) << r.centroids << std::setw(6) << r.procs
+           << std::setw(5) << r.threads << std::fixed << std::setprecision(3) << std::setw(12) << r.stats.median
+           << std::setw(12) << r.stats.min << std::setw(10) << r.stats.stddev << std::scientific << std::setprecision(3)
+           << std::setw(14) << r.throughput() << "  " << r.unit << std::defaultfloat << std::setprecision(6) << endl;
+   }
+
+   // Appends the records to a CSV file, writing the header if the file is new
+   // Returns false if the file cannot be written
+   bool writeCsv ( const std::string & path ) const {
+      std::ofstream out ( path, std::ios::app );
+      if ( !out ) return false;
+      if ( out.tellp() == 0 )
+         out << "tag,suite,name,isa,dim,points,centroids,procs,threads,reps,median_ms,min_ms,mean_ms,stddev_ms,throughput,unit\n";
+
+      out << std::setprecision(9);
+      for ( const auto & r : records )
+         out << tag << "," << r.key() << "," << r.stats.reps << "," << r.stats.median << "," << r.stats.min << ","
+             << r.stats.mean << "," << r.stats.stddev << "," << r.throughput() << "," << r.unit << "\n";
+      return bool(out);
+   }
+
+   // Appends the records to a JSON Lines file, one object per line
+   bool writeJson ( const std::string & path ) const {
+      std::ofstream out ( path, std::ios::app );
+      if ( !out ) return false;
+
+      out << std::setprecision(9);
+      for ( const auto & r : records )
+         out << "{\"tag\":" << jsonString(tag) << ",\"suite\":" << jsonString(r.suite) << ",\"name\":" << jsonString(r.name)
+             << ",\"isa\":" << jsonString(r.isa) << ",\"dim\":" << r.dim << ",\"points\":" << r.points
+             << ",\"centroids\":" << r.centroids << ",\"procs\":" << r.procs << ",\"threads\":" << r.threads
+             << ",\"reps\":" << r.stats.reps << ",\"median_ms\":" << r.stats.median << ",\"min_ms\":" << r.stats.min
+             << ",\"mean_ms\":" << r.stats.mean << ",\"stddev_ms\":" << r.stats.stddev
+             << ",\"throughput\":" << r.throughput() << ",\"unit\":" << jsonString(r.unit) << "}\n";
+      return bool(out);
+   }
+
+   // Compares the medians with the last ones of the same benchmarks in a CSV
+   // file written by writeCsv, printing their ratios
+   // Returns the number of benchmarks slower than the baseline by more than
+   // the tolerance, or -1 if the file cannot be read
+   int compare ( const std::string & path, double tolerance ) const {
+      std::ifstream in ( path );
+      if ( !in ) return -1;
+
+      // Baseline medians by key (fields 1 to 8), the last occurrence winning
+      std::vector<std::pair<std::string, double>> baseline;
+      std::string line;
+      std::getline ( in, line );
+      while ( std::getline ( in, line ) ) {
+         std::vector<std::string> fields;
+         std::istringstream ls ( line );
+         for ( std::string f; std::getline ( ls, f, ',' ); ) fields.push_back ( f );
+         if ( fields.size() < 16 ) continue;
+
+         std::string key = fields[1];
+         for ( unsigned int i = 2; i <= 8; ++i ) key += "," + fields[i];
+         baseline.emplace_back ( key, std::atof ( fields[10].c_str() ) );
+      }
+
+      int regressions = 0;
+      cout << endl << "Comparison with " << path << " (median / baseline median)" << endl;
+      for ( const auto & r : records ) {
+         auto found = std::find_if ( baseline.rbegin(), baseline.rend(), [&] ( const std::pair<std::string, double> & b ) { return b.first == r.key(); } );
+         if ( found == baseline.rend() || found->second <= 0 ) continue;
+
+         double ratio = r.stats.median / found->second;
+         bool slower = ratio > 1 + tolerance;
+         regressions += slower;
+         cout << std::left << std::setw(60) << r.key() << std::right << std::fixed << std::setprecision(3)
+              << std::setw(8) << ratio << std::defaultfloat << std::setprecision(6) << ( slower ? "  REGRESSION" : "" ) << endl;
+      }
+
+      return regressions;
+   }
+};
+
+// Splits a comma separated list
+std::vector<std::string> splitList ( const std::string & list ) {
+   std::vector<std::string> items;
+   std::istringstream in ( list );
+   for ( std::string item; std::getline ( in, item, ',' ); )
+      if ( !item.empty() ) items.push_back ( item );
+   return items;
+}
+
+// Options of the benchmarks
+struct benchOptions {
+   unsigned int warmup = 1, reps = 5;
+   unsigned int points = 100000, centroids = 20, threads = 1;
+   unsigned int parsePoints = 200000, solverPoints = 500000, iters = 10;
+   std::vector<unsigned int> dims;
+   std::vector<std::string> methods;
+};
+
+// Kernels
+
+// Distances of each point of the set from each of the centroids, as in the
+// assignment step of the solvers
+template < typename dist_type >
+void distLoop ( const std::vector<double> & pts, const std::vector<double> & ctr, unsigned int n, double & checksum ) {
+   dist_type d;
+   unsigned int npts = pts.size() / n, k = ctr.size() / n;
+
+   for ( unsigned int i = 0; i < npts; ++i )
+      for ( unsigned int kk = 0; kk < k; ++kk )
+         checksum += d.dist ( pts.data() + std::size_t(i)*n, ctr.data() + std::size_t(kk)*n, n );
+}
+
+void benchDistances ( benchReport & report, const benchOptions & opt, double & checksum ) {
+   std::default_random_engine eng ( 1 );
+   std::uniform_real_distribution<double> unif ( -10, 10 );
+   std::string defaultIsa = getDistKernels();
+
+   for ( std::string isa : { "scalar", "avx2", "avx512" } ) {
+      if ( !setDistKernels ( isa ) ) {
+         clog << "Instruction set " << isa << " not supported by this CPU" << endl;
+         continue;
+      }
+
+      for ( auto n : opt.dims ) {
+         std::vector<double> pts ( std::size_t(opt.points) * n ), ctr ( std::size_t(opt.centroids) * n );
+         for ( auto & x : pts ) x = unif(eng);
+         for ( auto & x : ctr ) x = unif(eng);
+
+         benchRecord r;
+         r.suite = "distance";
+         r.isa = isa;
+         r.dim = n;
+         r.points = opt.points;
+         r.centroids = opt.centroids;
+         r.work = double(opt.points) * opt.centroids;
+         r.unit = "dist/s";
+
+         r.name = "euclidean";
+         r.stats = measure ( [&] { distLoop<dist_euclidean> ( pts, ctr, n, checksum ); }, opt.warmup, opt.reps );
+         report.add ( r );
+
+         r.name = "manhattan";
+         r.stats = measure ( [&] { distLoop<dist_manhattan> ( pts, ctr, n, checksum ); }, opt.warmup, opt.reps );
+         report.add ( r );
+
+         r.name = "minkowski3";
+         r.stats = measure ( [&] { distLoop<dist_minkowski<3>> ( pts, ctr, n, checksum ); }, opt.warmup, opt.reps );
+         report.add ( r );
+      }
+   }
+
+   setDistKernels ( defaultIsa );
+}
+
+// Nearest centroid of each point, searched pairwise and with the blocked
+// assignment (see assignment.h)
+void benchAssignment ( benchReport & report, const benchOptions & opt, double & checksum ) {
+   std::default_random_engine eng ( 3 );
+   std::uniform_real_distribution<double> unif ( -10, 10 );
+
+   for ( auto n : opt.dims ) {
+      std::vector<double> pts ( std::size_t(opt.points) * n );
+      for ( auto & x : pts ) x = unif(eng);
+
+      std::vector<point> centroids ( opt.centroids, point(n) );
+      for ( auto & c : centroids )
+         for ( unsigned int j = 0; j < n; ++j ) c[j] = unif(eng);
+
+      dist_euclidean d;
+      auto exact = [&] ( const double * a, const double * b ) { return d.dist ( a, b, n ); };
+
+      auto pairwise = [&] {
+         for ( unsigned int i = 0; i < opt.points; ++i ) {
+            const double * x = pts.data() + std::size_t(i) * n;
+            double nearestDist = exact ( x, centroids[0].data() );
+            int nearest = 0;
+            for ( unsigned int kk = 1; kk < opt.centroids; ++kk ) {
+               double dd = exact ( x, centroids[kk].data() );
+               if ( dd < nearestDist ) {
+                  nearestDist = dd;
+                  nearest = kk;
+               }
+            }
+            checksum += nearest;
+         }
+      };
+
+      blockAssigner assigner;
+      blockWorkspace ws;
+      auto blocked = [&] {
+         assigner.setCentroids ( centroids );
+         for ( unsigned int b = 0; b < opt.points; b += blockAssigner::tileSize ) {
+            unsigned int m = std::min ( blockAssigner::tileSize, opt.points - b );
+            assigner.assign ( pts.data() + std::size_t(b) * n, m, ws, exact );
+            for ( unsigned int i = 0; i < m; ++i ) checksum += ws.labels[i];
+         }
+      };
+
+      benchRecord r;
+      r.suite = "assignment";
+      r.isa = getDistKernels();
+      r.dim = n;
+      r.points = opt.points;
+      r.centroids = opt.centroids;
+      r.work = opt.points;
+      r.unit = "points/s";
+
+      r.name = "pairwise";
+      r.stats = measure ( pairwise, opt.warmup, opt.reps );
+      report.add ( r );
+
+      r.name = "blocked";
+      r.stats = measure ( blocked, opt.warmup, opt.reps );
+      report.add ( r );
+   }
+}
+
+// Reduction of the sums and counts of the clusters across all the processes,
+// as done by the parallel solvers at each iteration (see allreduceBuffer)
+void benchReduction ( benchReport & report, const benchOptions & opt ) {
+   int size; MPI_Comm_size ( MPI_COMM_WORLD, &size );
+   const unsigned int calls = 100;
+
+   for ( auto n : opt.dims ) {
+      for ( bool persistent : { false, true } ) {
+         allreduceBuffer buffer ( MPI_COMM_WORLD );
+         if ( !buffer.setPersistent ( persistent ) ) continue;
+         buffer.reset ( std::size_t(opt.centroids) * ( n + 1 ) + 1 );
+
+         benchRecord r;
+         r.suite = "reduction";
+         r.name = persistent ? "persistent" : "allreduce";
+         r.dim = n;
+         r.centroids = opt.centroids;
+         r.procs = size;
+         r.work = calls;
+         r.unit = "reductions/s";
+         r.stats = measure ( [&] { for ( unsigned int c = 0; c < calls; ++c ) buffer.reduce(); }, opt.warmup, opt.reps, MPI_COMM_WORLD );
+         report.add ( r );
+      }
+   }
+}
+
+// Parse throughput of the text dataset readers
+// The text mimics the benchmarks produced by benchgenerator.m
+void benchParsing ( benchReport & report, const benchOptions & opt ) {
+   const unsigned int n = 20;
+   std::default_random_engine eng ( 2 );
+   std::normal_distribution<double> normal ( 0, 5 );
+
+   std::string text = std::to_string ( n ) + "\n";
+   char buf[64];
+   for ( unsigned int i = 0; i < opt.parsePoints; ++i ) {
+      for ( unsigned int j = 0; j < n; ++j ) {
+         std::snprintf ( buf, sizeof(buf), j + 1 < n ? "%f " : "%f\n", normal(eng) );
+         text += buf;
+      }
+   }
+
+   benchRecord r;
+   r.suite = "parsing";
+   r.dim = n;
+   r.points = opt.parsePoints;
+   r.work = text.size() / 1048576.0;
+   r.unit = "MB/s";
+
+   kMeansDataset reference;
+   r.name = "operator>>";
+   r.stats = measure ( [&] { reference = kMeansDataset(); std::istringstream in ( text ); in >> reference; }, opt.warmup, opt.reps );
+   report.add ( r );
+
+   // The same values with three per line, so that points span lines and the
+   // ranges of the threads; not timed, only checked
+   std::string spanning = text.substr ( 0, text.find ( '\n' ) + 1 );
+   unsigned long values = 0;
+   for ( std::size_t c = spanning.size(); c < text.size(); ++c ) {
+      if ( text[c] == ' ' || text[c] == '\n' ) spanning += ++values % 3 ? ' ' : '\n';
+      else spanning += text[c];
+   }
+
+   std::vector<unsigned int> threadCounts = { 1 };
+   if ( opt.threads > 1 ) threadCounts.push_back ( opt.threads );
+
+   for ( auto t : threadCounts ) {
+      threadPool pool ( t );
+      kMeansDataset parsed;
+      bool ok = true;
+
+      r.name = "parseText";
+      r.threads = t;
+      r.stats = measure ( [&] { parsed = kMeansDataset(); ok = parseTextDataset ( text.data(), text.data() + text.size(), parsed, pool ); }, opt.warmup, opt.reps );
+      report.add ( r );
+
+      bool same = ok && parsed.size() == reference.size();
+      for ( std::size_t i = 0; same && i < std::size_t(parsed.size()) * n; ++i )
+         same = parsed.data()[i] == reference.data()[i];
+      if ( !same ) clog << "Warning: parseTextDataset with " << t << " threads does not match operator>>" << endl;
+
+      parsed = kMeansDataset();
+      ok = parseTextDataset ( spanning.data(), spanning.data() + spanning.size(), parsed, pool );
+      same = ok && parsed.size() == reference.size();
+      for ( std::size_t i = 0; same && i < std::size_t(parsed.size()) * n; ++i )
+         same = parsed.data()[i] == reference.data()[i];
+      if ( !same ) clog << "Warning: parseTextDataset with " << t << " threads does not match operator>> on points spanning lines" << endl;
+   }
+}
+
+// Solvers
+
+// Solvers running a fixed number of iterations on total points, split evenly
+// among the processes, of a synthetic Gaussian mixture with as many clusters as
+// the centroids (see synthetic.h)
+void benchSolvers ( benchReport & report, const benchOptions & opt, const std::string & suite, unsigned int total ) {
+   int size; MPI_Comm_size ( MPI_COMM_WORLD, &size );
+   int rank; MPI_Comm_rank ( MPI_COMM_WORLD, &rank );
+
+   for ( auto n : opt.dims ) {
+      syntheticSpec spec;
+      spec.points = total;
+      spec.dim = n;
+      spec.clusters = opt.centroids;
+
+      kMeansDataset data;
+      std::vector<int> trueLabels;
+      threadPool pool ( opt.threads );
+      generateSyntheticPartition ( spec, data, trueLabels, MPI_COMM_WORLD, pool );
+
+      for ( const auto & method : opt.methods ) {
+         std::unique_ptr<kMeansSolver> solver ( makeSolver ( method, data, 1000, 0 ) );
+         if ( !solver ) {
+            if ( rank == 0 ) clog << "Method " << method << " unknown or not offered in dimension " << n << endl;
+            continue;
+         }
+
+         solver->setK ( opt.centroids );
+         solver->setThreads ( opt.threads );
+         solver->setStop ( opt.iters, -1, -1 );
+
+         benchRecord r;
+         r.suite = suite;
+         r.name = method;
+         r.isa = getDistKernels();
+         r.dim = n;
+         r.points = total;
+         r.centroids = opt.centroids;
+         r.procs = size;
+         r.threads = solver->getThreads();
+         r.stats = measure ( [&] { solver->solve(); }, opt.warmup, opt.reps, MPI_COMM_WORLD );
+         r.work = solver->getIter();
+         r.unit = "iter/s";
+         report.add ( r );
+      }
+   }
+}
+
+int main ( int argc, char * argv[] ) {
+   MPI_Init ( &argc, &argv );
+   int size; MPI_Comm_size ( MPI_COMM_WORLD, &size );
+   int rank; MPI_Comm_rank ( MPI_COMM_WORLD, &rank );
+
+   GetPot cmdLine ( argc, argv );
+
+   benchOptions opt;
+   opt.warmup = cmdLine.follow ( 1, "--warmup" );
+   opt.reps = std::max ( 1, cmdLine.follow ( 5, "--reps" ) );
+   opt.points = cmdLine.follow ( 100000, "--points" );
+   opt.centroids = cmdLine.follow ( 20, "--centroids" );
+   opt.threads = cmdLine.follow ( 1, "--threads" );
+   opt.parsePoints = cmdLine.follow ( 200000, "--parse-points" );
+   opt.solverPoints = cmdLine.follow ( 500000, "--solver-points" );
+   opt.iters = cmdLine.follow ( 10, "--iters" );
+   for ( const auto & d : splitList ( cmdLine.follow ( "2,10,20", "--dims" ) ) ) opt.dims.push_back ( std::stoi ( d ) );
+   opt.methods = splitList ( cmdLine.follow ( "kmeans,elkan,yinyang,minibatch", "--methods" ) );
+
+   std::vector<std::string> suites = splitList ( cmdLine.follow ( "kernels", "--suite" ) );
+   std::string csvPath = cmdLine.follow ( "", "--csv" );
+   std::string jsonPath = cmdLine.follow ( "", "--json" );
+   std::string baselinePath = cmdLine.follow ( "", "--baseline" );
+   std::string tag = cmdLine.follow ( "", "--tag" );
+   double tolerance = cmdLine.follow ( 0.1, "--tolerance" );
+
+   benchReport report ( tag, rank == 0 );
+   double checksum = 0;
+
+   for ( const auto & suite : suites ) {
+      if ( suite == "kernels" ) {
+         if ( rank == 0 ) {
+            benchDistances ( report, opt, checksum );
+            benchAssignment ( report, opt, checksum );
+         }
+         benchReduction ( report, opt );
+         if ( rank == 0 ) benchParsing ( report, opt );
+      }
+
+      else if ( suite == "strong" ) benchSolvers ( report, opt, suite, opt.solverPoints );
+      else if ( suite == "weak" ) benchSolvers ( report, opt, suite, opt.solverPoints * size );
+
+      else if ( rank == 0 ) clog << "Unknown suite " << suite << endl;
+   }
+
+   int status = 0;
+
+   if ( rank == 0 ) {
+      if ( !csvPath.empty() && !report.writeCsv ( csvPath ) ) {
+         clog << "Error: couldn't write " << csvPath << endl;
+         status = 1;
+      }
+
+      if ( !jsonPath.empty() && !report.writeJson ( jsonPath ) ) {
+         clog << "Error: couldn't write " << jsonPath << endl;
+         status = 1;
+      }
+
+      if ( !baselinePath.empty() ) {
+         int regressions = report.compare ( baselinePath, tolerance );
+         if ( regressions < 0 ) clog << "Error: couldn't read " << baselinePath << endl;
+         else if ( regressions > 0 ) clog << regressions << " benchmarks slower than the baseline" << endl;
+         if ( regressions != 0 ) status = 1;
+      }
+
+      // Printed so that the computations cannot be optimized away
+      cout << endl << "checksum: " << checksum << endl;
+   }
+
+   MPI_Finalize();
+   return status;
+}
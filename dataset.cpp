@@ -0,0 +1,188 @@
+#include "dataset.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+mappedFile::mappedFile ( const std::string & path ) {
+   int fd = open ( path.c_str(), O_RDONLY );
+   if ( fd < 0 ) return;
+
+   struct stat st;
+   if ( fstat ( fd, &st ) == 0 && st.st_size > 0 ) {
+      void * ptr = mmap ( nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0 );
+      if ( ptr != MAP_FAILED ) {
+         addr = ptr;
+         length = st.st_size;
+      }
+   }
+
+   // The mapping stays valid after the descriptor is closed
+   close ( fd );
+}
+
+mappedFile::~mappedFile ( void ) {
+   if ( addr ) munmap ( addr, length );
+}
+
+template < typename real >
+void basicDataset<real>::materialize ( void ) {
+   if ( !view ) return;
+   coords.assign ( view, view + std::size_t(count) * n );
+   view = nullptr;
+   mapping.reset();
+}
+
+template < typename real >
+void basicDataset<real>::setLayout ( datasetLayout l ) {
+   if ( l == layout ) return;
+
+   std::vector<real, alignedAllocator<real>> transposed ( std::size_t(count) * n );
+   const real * src = base();
+
+   for ( unsigned int i = 0; i < count; ++i )
+      for ( unsigned int j = 0; j < n; ++j ) {
+         if ( l == datasetLayout::colMajor ) transposed[std::size_t(j)*count + i] = src[std::size_t(i)*n + j];
+         else transposed[std::size_t(i)*n + j] = src[std::size_t(j)*count + i];
+      }
+
+   coords.swap ( transposed );
+   view = nullptr;
+   mapping.reset();
+   layout = l;
+}
+
+template < typename real >
+void basicDataset<real>::reserve ( unsigned int size ) {
+   materialize();
+   coords.reserve ( std::size_t(size) * n );
+   labels.reserve ( size );
+   trueLabels.reserve ( size );
+}
+
+template < typename real >
+void basicDataset<real>::resize ( unsigned int size ) {
+   assert ( layout == datasetLayout::rowMajor || size == count );
+   materialize();
+   coords.resize ( std::size_t(size) * n, 0 );
+   labels.resize ( size, -1 );
+   trueLabels.resize ( size, -1 );
+   count = size;
+}
+
+template < typename real >
+void basicDataset<real>::clear ( void ) {
+   // Swapping with empty containers actually releases the memory
+   std::vector<real, alignedAllocator<real>>().swap ( coords );
+   view = nullptr;
+   mapping.reset();
+   std::vector<int>().swap ( labels );
+   std::vector<int>().swap ( trueLabels );
+   count = 0;
+}
+
+template < typename real >
+void basicDataset<real>::push_back ( const real * pt ) {
+   assert ( layout == datasetLayout::rowMajor );
+   materialize();
+   coords.insert ( coords.end(), pt, pt + n );
+   labels.push_back ( -1 );
+   trueLabels.push_back ( -1 );
+   count++;
+}
+
+template < typename real >
+basicDataset<real> basicDataset<real>::slice ( unsigned int a, unsigned int b ) const {
+   assert ( a <= b && b <= count );
+
+   // Slices of a view are views on the same mapping
+   basicDataset result = view ? basicDataset ( n, b - a, mapping, view + std::size_t(a)*n ) : basicDataset ( n, b - a );
+   result.layout = layout;
+
+   if ( !view ) {
+      if ( layout == datasetLayout::rowMajor )
+         std::copy ( coords.begin() + std::size_t(a)*n, coords.begin() + std::size_t(b)*n, result.coords.begin() );
+      else for ( unsigned int j = 0; j < n; ++j )
+         std::copy ( coords.begin() + std::size_t(j)*count + a, coords.begin() + std::size_t(j)*count + b,
+                     result.coords.begin() + std::size_t(j)*(b - a) );
+   }
+
+   std::copy ( labels.begin() + a, labels.begin() + b, result.labels.begin() );
+   std::copy ( trueLabels.begin() + a, trueLabels.begin() + b, result.trueLabels.begin() );
+
+   return result;
+}
+
+template < typename real >
+void basicDataset<real>::setTrueLabels ( const std::vector<int> & tl, int offset ) {
+   assert ( tl.size() == count );
+   for ( unsigned int i = 0; i < count; ++i )
+      trueLabels[i] = tl[i] + offset;
+}
+
+template < typename real >
+std::size_t basicDataset<real>::memoryFootprint ( void ) const {
+   return sizeof(*this) + coords.capacity() * sizeof(real)
+        + labels.capacity() * sizeof(int) + trueLabels.capacity() * sizeof(int);
+}
+
+template < typename real >
+void basicDataset<real>::printPoint ( std::ostream & out, unsigned int i ) const {
+   out << getLabel(i);
+   for ( unsigned int j = 0; j < n; ++j )
+      out << " " << (*this)(i,j);
+}
+
+// Both precisions of the coordinates are compiled here
+template class basicDataset<double>;
+template class basicDataset<float>;
+
+std::istream& operator>> ( std::istream &in, kMeansDataset &km ) {
+   unsigned int i = 0;
+   unsigned int n = 0;
+   double tmp = 0;
+
+   in >> n;
+   km = kMeansDataset ( n );
+   std::vector<double> p ( n );
+
+   while ( in >> tmp ) {
+      p[i] = tmp;
+      if ( i == n - 1 ) {
+         km.push_back(p.data());
+         i = 0;
+      }
+      else i++;
+   }
+
+   return in;
+}
+
+void datasetPartition ( unsigned int datasetSize, int rank, int size, unsigned int & begin, unsigned int & share ) {
+   unsigned int r = datasetSize % size;
+   unsigned int rk = rank;
+
+   share = datasetSize / size + ( rk < r );
+   begin = ( rk < r ? share * rk : (share + 1)*r + share*(rk - r) );
+}
+
+std::vector<unsigned int> weightedPartition ( unsigned int datasetSize, const std::vector<double> & weights ) {
+   std::vector<unsigned int> bounds ( weights.size() + 1, datasetSize );
+
+   double total = 0;
+   for ( double w : weights ) total += std::max ( 0.0, w );
+
+   // Each boundary is the rounded cumulated weight, so that the portions differ
+   // from the exact ones by less than a point
+   double cumulated = 0;
+   for ( std::size_t r = 0; r < weights.size(); ++r ) {
+      bounds[r] = total > 0 ? std::llround ( datasetSize * ( cumulated / total ) ) : datasetSize * double(r) / weights.size();
+      cumulated += std::max ( 0.0, weights[r] );
+   }
+
+   return bounds;
+}
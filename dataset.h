@@ -0,0 +1,275 @@
+#ifndef _DATASET_H
+#define _DATASET_H
+
+#include <vector>
+#include <array>
+#include <memory>
+#include <string>
+#include <istream>
+#include <ostream>
+#include <cstdlib>
+#include <cstddef>
+#include <cassert>
+#include <new>
+
+// Allocator returning memory aligned on a boundary of align bytes
+// Used so that the coordinates block starts on a cache line, which is also a
+// valid boundary for aligned SIMD loads
+template < typename T, std::size_t align = 64 >
+class alignedAllocator {
+public:
+   using value_type = T;
+
+   template < typename U > struct rebind { using other = alignedAllocator<U, align>; };
+
+   alignedAllocator ( void ) = default;
+   template < typename U > alignedAllocator ( const alignedAllocator<U, align> & ) { }
+
+   T * allocate ( std::size_t count ) {
+      void * ptr = nullptr;
+      if ( posix_memalign ( &ptr, align, count * sizeof(T) ) != 0 ) throw std::bad_alloc();
+      return static_cast<T*> ( ptr );
+   }
+
+   void deallocate ( T * ptr, std::size_t ) { free ( ptr ); }
+
+   template < typename U > bool operator== ( const alignedAllocator<U, align> & ) const { return true; }
+   template < typename U > bool operator!= ( const alignedAllocator<U, align> & ) const { return false; }
+};
+
+// Private memory mapping of a whole file
+// Pages are copy-on-write: the mapped data can be modified in memory without
+// affecting the file
+class mappedFile {
+private:
+   void * addr = nullptr;
+   std::size_t length = 0;
+
+public:
+   // Maps the file; valid() is false if the file could not be mapped
+   mappedFile ( const std::string & );
+   ~mappedFile ( void );
+
+   mappedFile ( const mappedFile & ) = delete;
+   mappedFile & operator= ( const mappedFile & ) = delete;
+
+   bool valid ( void ) const { return addr != nullptr; }
+   char * data ( void ) const { return static_cast<char*> ( addr ); }
+   std::size_t size ( void ) const { return length; }
+};
+
+// Layout of the coordinates block
+// rowMajor : coordinates of each point are contiguous (point i starts at i*n)
+// colMajor : each coordinate is contiguous across points (coordinate j starts at j*size)
+enum class datasetLayout { rowMajor, colMajor };
+
+// Dataset of points in R^n, stored as a structure of arrays
+// All the coordinates are kept in a single aligned block, while labels and true
+// labels are stored in two separate arrays
+// Coordinates are of type real: double (kMeansDataset) or float, which halves
+// the memory and bandwidth taken by the dataset
+// The coordinates block is either owned by the dataset or a view on a memory
+// mapped file (see dataset_io.h); views are shared, without copies, by the
+// slices of the dataset, and are turned into owned storage only by the
+// operations that need to reallocate the block (layout change, resize, push_back)
+template < typename real >
+class basicDataset {
+private:
+   template < typename > friend class basicDataset;
+
+   // Dimension of the points
+   unsigned int n = 0;
+
+   // Number of points
+   unsigned int count = 0;
+
+   // Layout of the coordinates block
+   datasetLayout layout = datasetLayout::rowMajor;
+
+   // Coordinates of the points, if owned by the dataset
+   std::vector<real, alignedAllocator<real>> coords;
+
+   // Coordinates of the points, if the dataset is a view on a mapped file
+   // (nullptr otherwise), and the mapping they belong to
+   real * view = nullptr;
+   std::shared_ptr<const mappedFile> mapping;
+
+   // First coordinate of the block, whichever the storage
+   real * base ( void ) { return view ? view : coords.data(); }
+   const real * base ( void ) const { return view ? view : coords.data(); }
+
+   // Copies a viewed block in owned storage
+   void materialize ( void );
+
+   // Labels of the points (cluster to which each point belongs)
+   std::vector<int> labels;
+
+   // True labels of the points
+   std::vector<int> trueLabels;
+
+   // If the dataset is the portion of a larger one read by a process (see
+   // dataset_io.h), index of its first point in the complete dataset and size
+   // of the complete dataset; globalSize is 0 for complete datasets
+   unsigned int globalBegin = 0;
+   unsigned int globalSize = 0;
+
+public:
+   basicDataset ( void ) = default;
+   basicDataset ( unsigned int nn, unsigned int size = 0 ) :
+      n(nn), count(size), coords(std::size_t(nn) * size, 0), labels(size, -1), trueLabels(size, -1) { }
+
+   // Constructor for a view on size row-major points starting at cc, which
+   // belongs to the mapping map
+   basicDataset ( unsigned int nn, unsigned int size, std::shared_ptr<const mappedFile> map, real * cc ) :
+      n(nn), count(size), view(cc), mapping(map), labels(size, -1), trueLabels(size, -1) { }
+
+   // Conversion from a dataset with coordinates of another type, keeping the
+   // layout, the labels and the partition info
+   template < typename other >
+   explicit basicDataset ( const basicDataset<other> & );
+
+   // Dimension and size
+   unsigned int getN ( void ) const { return n; }
+   unsigned int size ( void ) const { return count; }
+   bool empty ( void ) const { return count == 0; }
+
+   // Layout get and set
+   // Changing the layout transposes the coordinates block
+   datasetLayout getLayout ( void ) const { return layout; }
+   void setLayout ( datasetLayout );
+
+   // Size management
+   void reserve ( unsigned int );
+   void resize ( unsigned int );
+   void clear ( void );
+
+   // Appends a point, given its n coordinates (row-major layout only)
+   void push_back ( const real * );
+
+   // Coordinate access : operator() ( point index, coordinate index )
+   real & operator() ( unsigned int i, unsigned int j ) {
+      assert ( i < count && j < n );
+      return layout == datasetLayout::rowMajor ? base()[std::size_t(i)*n + j] : base()[std::size_t(j)*count + i];
+   }
+
+   const real & operator() ( unsigned int i, unsigned int j ) const {
+      assert ( i < count && j < n );
+      return layout == datasetLayout::rowMajor ? base()[std::size_t(i)*n + j] : base()[std::size_t(j)*count + i];
+   }
+
+   // Pointer to the coordinates of a point (row-major layout only)
+   real * row ( unsigned int i ) {
+      assert ( layout == datasetLayout::rowMajor && i < count );
+      return base() + std::size_t(i) * n;
+   }
+
+   const real * row ( unsigned int i ) const {
+      assert ( layout == datasetLayout::rowMajor && i < count );
+      return base() + std::size_t(i) * n;
+   }
+
+   // Contiguous coordinates of a point, whatever the layout: for row-major
+   // datasets this is the same as row, otherwise the coordinates are gathered
+   // into buf (which must hold n values) and buf is returned
+   const real * getPoint ( unsigned int i, real * buf ) const {
+      if ( layout == datasetLayout::rowMajor ) return row(i);
+      for ( unsigned int j = 0; j < n; ++j ) buf[j] = base()[std::size_t(j)*count + i];
+      return buf;
+   }
+
+   // Raw coordinates block (for communication)
+   real * data ( void ) { return base(); }
+   const real * data ( void ) const { return base(); }
+
+   // True if the coordinates are a view on a mapped file
+   bool isMapped ( void ) const { return view != nullptr; }
+
+   // Label get and set
+   int getLabel ( unsigned int i ) const { return labels[i]; }
+   void setLabel ( unsigned int i, int l ) { labels[i] = l; }
+   int * labelData ( void ) { return labels.data(); }
+   const int * labelData ( void ) const { return labels.data(); }
+
+   // True label get and set
+   int getTrueLabel ( unsigned int i ) const { return trueLabels[i]; }
+   void setTrueLabel ( unsigned int i, int l ) { trueLabels[i] = l; }
+   int * trueLabelData ( void ) { return trueLabels.data(); }
+   const int * trueLabelData ( void ) const { return trueLabels.data(); }
+
+   // Sets all the true labels from a vector, adding an offset to them
+   // Offset is -1 by default, since true labels files number clusters from 1
+   void setTrueLabels ( const std::vector<int> &, int = -1 );
+
+   // Partition info get and set
+   bool isPartition ( void ) const { return globalSize != 0; }
+   unsigned int getGlobalBegin ( void ) const { return globalBegin; }
+   unsigned int getGlobalSize ( void ) const { return isPartition() ? globalSize : count; }
+   void setPartition ( unsigned int begin, unsigned int total ) { globalBegin = begin; globalSize = total; }
+
+   // Copy of the points in the range [a,b), with the same layout
+   basicDataset slice ( unsigned int, unsigned int ) const;
+
+   // Memory used by the dataset, in bytes
+   // A viewed coordinates block is not counted (see mappedFootprint)
+   std::size_t memoryFootprint ( void ) const;
+
+   // Size of the viewed coordinates block, in bytes (0 if owned)
+   std::size_t mappedFootprint ( void ) const { return view ? std::size_t(count) * n * sizeof(real) : 0; }
+
+   // Output of a point on a stream
+   // Format: single line,
+   // <label> <coord. 0> <coord. 1> ... <coord. N>
+   void printPoint ( std::ostream &, unsigned int ) const;
+};
+
+// Datasets in double precision, used by input and output, and in single
+// precision (see kMeansBase)
+using kMeansDataset = basicDataset<double>;
+using kMeansDatasetF = basicDataset<float>;
+
+template < typename real >
+template < typename other >
+basicDataset<real>::basicDataset ( const basicDataset<other> & src ) :
+   n(src.n), count(src.count), layout(src.layout), coords(src.base(), src.base() + std::size_t(src.count) * src.n),
+   labels(src.labels), trueLabels(src.trueLabels), globalBegin(src.globalBegin), globalSize(src.globalSize) { }
+
+// Even partition of a dataset among processes
+// Given the size of the dataset, the rank of a process and the number of
+// processes, computes the index of the first point assigned to the process and
+// the number of points assigned to it
+void datasetPartition ( unsigned int, int, int, unsigned int &, unsigned int & );
+
+// Partition of a dataset among processes in proportion to a weight per process
+// (e.g. its throughput), in contiguous portions in rank order
+// Given the size of the dataset and the weights, returns the index of the first
+// point assigned to each process, followed by the size of the dataset
+std::vector<unsigned int> weightedPartition ( unsigned int, const std::vector<double> & );
+
+// Buffer for the coordinates of a single point, of type real
+// The storage is a fixed-size array if the dimension D is known at compile time,
+// and a heap-allocated vector if it is only known at runtime (D = 0)
+template < unsigned int D, typename real = double >
+class coordBuffer {
+private:
+   std::array<real, D> coords {};
+public:
+   coordBuffer ( unsigned int nn ) { assert ( nn == D ); }
+   real * data ( void ) { return coords.data(); }
+   real & operator[] ( unsigned int i ) { return coords[i]; }
+};
+
+template < typename real >
+class coordBuffer<0, real> {
+private:
+   std::vector<real> coords;
+public:
+   coordBuffer ( unsigned int nn ) : coords(nn, 0) { }
+   real * data ( void ) { return coords.data(); }
+   real & operator[] ( unsigned int i ) { return coords[i]; }
+};
+
+// Read a dataset from a stream
+// Format: dimension of the points, followed by the coordinates of each point
+std::istream& operator>> ( std::istream &, kMeansDataset & );
+
+#endif
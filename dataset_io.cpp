@@ -0,0 +1,859 @@
+#include "dataset_io.h"
+
+#include <fstream>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#include <cstdio>
+
+// Rounds an offset up to the next multiple of 64
+static uint64_t alignOffset ( uint64_t offset ) { return ( offset + 63 ) / 64 * 64; }
+
+bool isBinaryDataset ( const std::string & path ) {
+   std::ifstream in ( path, std::ios::binary );
+   char magic[4] = { 0, 0, 0, 0 };
+   in.read ( magic, 4 );
+   return in && std::memcmp ( magic, datasetHeader().magic, 4 ) == 0;
+}
+
+bool loadBinaryDataset ( const std::string & path, kMeansDataset & km, std::vector<int> & trueLabels ) {
+   auto file = std::make_shared<const mappedFile> ( path );
+   if ( !file->valid() || file->size() < sizeof(datasetHeader) ) return false;
+
+   datasetHeader header;
+   std::memcpy ( &header, file->data(), sizeof(datasetHeader) );
+
+   std::size_t scalarSize = header.dtype == dtypeFloat32 ? sizeof(float) : sizeof(double);
+   std::size_t coordsSize = header.count * header.dim * scalarSize;
+
+   if ( std::memcmp ( header.magic, datasetHeader().magic, 4 ) != 0
+     || header.version != datasetFormatVersion || header.dim == 0
+     || ( header.dtype != dtypeFloat64 && header.dtype != dtypeFloat32 )
+     || header.coordsOffset + coordsSize > file->size() ) return false;
+
+   if ( ( header.flags & hasTrueLabels ) && header.labelsOffset + header.count * sizeof(int32_t) > file->size() )
+      return false;
+
+   if ( header.dtype == dtypeFloat64 )
+      km = kMeansDataset ( header.dim, header.count, file, reinterpret_cast<double*> ( file->data() + header.coordsOffset ) );
+
+   else {
+      km = kMeansDataset ( header.dim, header.count );
+      const float * src = reinterpret_cast<const float*> ( file->data() + header.coordsOffset );
+      std::copy ( src, src + header.count * header.dim, km.data() );
+   }
+
+   if ( header.flags & hasTrueLabels ) {
+      const int32_t * labels = reinterpret_cast<const int32_t*> ( file->data() + header.labelsOffset );
+      trueLabels.insert ( trueLabels.end(), labels, labels + header.count );
+   }
+
+   return true;
+}
+
+bool writeBinaryDataset ( const std::string & path, const kMeansDataset & km, const std::vector<int> & trueLabels ) {
+   std::ofstream out ( path, std::ios::binary );
+   if ( !out ) return false;
+
+   datasetHeader header;
+   header.dim = km.getN();
+   header.count = km.size();
+   header.coordsOffset = alignOffset ( sizeof(datasetHeader) );
+
+   uint64_t coordsSize = header.count * header.dim * sizeof(double);
+
+   if ( !trueLabels.empty() ) {
+      if ( trueLabels.size() != km.size() ) return false;
+      header.flags |= hasTrueLabels;
+      header.labelsOffset = alignOffset ( header.coordsOffset + coordsSize );
+   }
+
+   const char padding[64] = { 0 };
+
+   out.write ( reinterpret_cast<const char*> ( &header ), sizeof(datasetHeader) );
+   out.write ( padding, header.coordsOffset - sizeof(datasetHeader) );
+
+   // Coordinates are written in row-major order whatever the layout in memory
+   if ( km.getLayout() == datasetLayout::rowMajor )
+      out.write ( reinterpret_cast<const char*> ( km.data() ), coordsSize );
+   else {
+      std::vector<double> buf ( km.getN() );
+      for ( unsigned int i = 0; i < km.size(); ++i )
+         out.write ( reinterpret_cast<const char*> ( km.getPoint ( i, buf.data() ) ), km.getN() * sizeof(double) );
+   }
+
+   if ( header.flags & hasTrueLabels ) {
+      out.write ( padding, header.labelsOffset - header.coordsOffset - coordsSize );
+      std::vector<int32_t> labels ( trueLabels.begin(), trueLabels.end() );
+      out.write ( reinterpret_cast<const char*> ( labels.data() ), labels.size() * sizeof(int32_t) );
+   }
+
+   return bool(out);
+}
+
+static bool isSpace ( char c ) { return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' || c == '\f'; }
+static bool isDigit ( char c ) { return c >= '0' && c <= '9'; }
+
+// Locale-independent parsing of a number, in the style of std::from_chars
+// Returns the position after the number, or begin if there is no number there
+// Numbers are made of mantissa * 10^exponent; if the mantissa has at most 19
+// significant digits (it fits an integer) and is exactly representable as a
+// double, and 10^|exponent| is too, a single multiplication or division gives
+// the correctly rounded result. Other numbers are converted with strtod
+static const char * parseDouble ( const char * begin, const char * end, double & value ) {
+   const char * p = begin;
+   bool negative = false;
+
+   if ( p != end && ( *p == '-' || *p == '+' ) ) negative = *p++ == '-';
+
+   uint64_t mantissa = 0;
+   int digits = 0, exponent = 0;
+   bool any = false, exact = true;
+
+   for ( ; p != end && isDigit(*p); ++p ) {
+      any = true;
+      if ( mantissa == 0 && *p == '0' ) continue;
+      if ( digits < 19 ) { mantissa = mantissa * 10 + ( *p - '0' ); digits++; }
+      else { exponent++; exact = exact && *p == '0'; }
+   }
+
+   if ( p != end && *p == '.' ) {
+      for ( ++p; p != end && isDigit(*p); ++p ) {
+         any = true;
+         if ( mantissa == 0 && *p == '0' ) { exponent--; continue; }
+         if ( digits < 19 ) { mantissa = mantissa * 10 + ( *p - '0' ); digits++; exponent--; }
+         else exact = exact && *p == '0';
+      }
+   }
+
+   if ( !any ) {
+      // Infinities and NaNs, which only strtod knows about
+      if ( p != end && ( *p == 'i' || *p == 'I' || *p == 'n' || *p == 'N' ) ) exact = false;
+      else return begin;
+   }
+
+   if ( any && p != end && ( *p == 'e' || *p == 'E' ) ) {
+      const char * q = p + 1;
+      bool negativeExp = false;
+      if ( q != end && ( *q == '-' || *q == '+' ) ) negativeExp = *q++ == '-';
+
+      if ( q != end && isDigit(*q) ) {
+         int e = 0;
+         for ( ; q != end && isDigit(*q); ++q ) if ( e < 100000 ) e = e * 10 + ( *q - '0' );
+         exponent += negativeExp ? -e : e;
+         p = q;
+      }
+   }
+
+   static const double powers[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+   if ( exact && mantissa <= ( uint64_t(1) << 53 ) && exponent >= -22 && exponent <= 22 ) {
+      value = exponent < 0 ? double(mantissa) / powers[-exponent] : double(mantissa) * powers[exponent];
+      if ( negative ) value = -value;
+      return p;
+   }
+
+   // Slow path: the token is copied, since the input is not null-terminated
+   const char * tokenEnd = p;
+   while ( tokenEnd != end && !isSpace(*tokenEnd) ) ++tokenEnd;
+
+   std::string token ( begin, tokenEnd );
+   char * next = nullptr;
+   value = std::strtod ( token.c_str(), &next );
+   return next == token.c_str() ? begin : begin + ( next - token.c_str() );
+}
+
+// Parses whitespace-separated numbers from [begin, end) into a vector
+// Returns false if something that is not a number is found
+static bool parseDoubles ( const char * begin, const char * end, std::vector<double> & values ) {
+   const char * p = begin;
+
+   while ( true ) {
+      while ( p != end && isSpace(*p) ) ++p;
+      if ( p == end ) return true;
+
+      double x = 0;
+      const char * next = parseDouble ( p, end, x );
+      if ( next == p ) return false;
+
+      values.push_back ( x );
+      p = next;
+   }
+}
+
+// Parses whitespace-separated numbers from [begin, end) with the threads of the
+// pool: the input is split in ranges of similar length, realigned to a
+// whitespace, and each thread parses its own range into its own vector
+// Returns false if something that is not a number is found
+static bool parseDoublesParallel ( const char * begin, const char * end, std::vector<std::vector<double>> & values,
+                                   threadPool & pool ) {
+   unsigned int threads = pool.size();
+   if ( std::size_t(end - begin) < std::size_t(threads) * 4096 ) threads = 1;
+
+   std::vector<const char *> bounds ( threads + 1, end );
+   bounds[0] = begin;
+
+   for ( unsigned int t = 1; t < threads; ++t ) {
+      const char * p = std::max ( bounds[t-1], begin + ( end - begin ) / threads * t );
+      while ( p != end && p != begin && !isSpace(*(p - 1)) ) ++p;
+      bounds[t] = p;
+   }
+
+   values.assign ( threads, std::vector<double>() );
+   std::vector<char> ok ( threads, 1 );
+
+   auto work = [&] ( unsigned int t ) {
+      values[t].reserve ( ( bounds[t+1] - bounds[t] ) / 8 );
+      ok[t] = parseDoubles ( bounds[t], bounds[t+1], values[t] );
+   };
+
+   pool.run ( [&] ( unsigned int t ) { if ( t < threads ) work ( t ); } );
+
+   return std::find ( ok.begin(), ok.end(), 0 ) == ok.end();
+}
+
+bool parseTextPoints ( const char * begin, const char * end, kMeansDataset & km, threadPool & pool ) {
+   unsigned int n = km.getN();
+   if ( n == 0 ) return false;
+
+   std::vector<std::vector<double>> values;
+   if ( !parseDoublesParallel ( begin, end, values, pool ) ) return false;
+
+   // Points may span lines, and thus the ranges of the threads; only the total
+   // must be a whole number of points
+   std::size_t total = 0;
+   for ( const auto & v : values ) total += v.size();
+   if ( total % n != 0 ) return false;
+
+   // Values are moved in the dataset, in order
+
+   unsigned int first = km.size();
+   km.resize ( first + total / n );
+
+   double * dest = km.data() + std::size_t(first) * n;
+   for ( const auto & v : values ) dest = std::copy ( v.begin(), v.end(), dest );
+
+   return true;
+}
+
+bool parseTextDataset ( const char * begin, const char * end, kMeansDataset & km, threadPool & pool ) {
+   const char * p = begin;
+   while ( p != end && isSpace(*p) ) ++p;
+
+   // Dimension of the points
+   unsigned long n = 0;
+   for ( ; p != end && isDigit(*p); ++p ) n = n * 10 + ( *p - '0' );
+   if ( n == 0 || ( p != end && !isSpace(*p) ) ) return false;
+
+   km = kMeansDataset ( n );
+   return parseTextPoints ( p, end, km, pool );
+}
+
+bool parseTextLabels ( const char * begin, const char * end, std::vector<int> & labels ) {
+   const char * p = begin;
+
+   while ( true ) {
+      while ( p != end && isSpace(*p) ) ++p;
+      if ( p == end ) return true;
+
+      bool negative = false;
+      if ( *p == '-' || *p == '+' ) negative = *p++ == '-';
+      if ( p == end || !isDigit(*p) ) return false;
+
+      int l = 0;
+      for ( ; p != end && isDigit(*p); ++p ) l = l * 10 + ( *p - '0' );
+      labels.push_back ( negative ? -l : l );
+   }
+}
+
+bool loadTextDataset ( const std::string & path, kMeansDataset & km, threadPool & pool ) {
+   mappedFile file ( path );
+   return file.valid() && parseTextDataset ( file.data(), file.data() + file.size(), km, pool );
+}
+
+bool loadTextLabels ( const std::string & path, std::vector<int> & labels ) {
+   mappedFile file ( path );
+   return file.valid() && parseTextLabels ( file.data(), file.data() + file.size(), labels );
+}
+
+// Agreement of the processes on the success of a collective operation
+static bool allSucceeded ( bool ok, MPI_Comm comm ) {
+   int flag = ok;
+   MPI_Allreduce ( MPI_IN_PLACE, &flag, 1, MPI_INT, MPI_LAND, comm );
+   return flag;
+}
+
+// Sends a text to a process: its length first, then the text in pieces small
+// enough for the int counts of MPI
+static void sendText ( const char * buf, std::size_t len, int dest, MPI_Comm comm ) {
+   const std::size_t maxPiece = std::size_t(1) << 30;
+
+   unsigned long long length = len;
+   MPI_Send ( &length, 1, MPI_UNSIGNED_LONG_LONG, dest, 0, comm );
+   for ( std::size_t begin = 0; begin < len; begin += maxPiece )
+      MPI_Send ( buf + begin, std::min ( maxPiece, len - begin ), MPI_CHAR, dest, 0, comm );
+}
+
+// Receives a text sent by sendText, replacing the content of the string
+static void recvText ( std::string & text, int source, MPI_Comm comm ) {
+   const std::size_t maxPiece = std::size_t(1) << 30;
+
+   unsigned long long length = 0;
+   MPI_Recv ( &length, 1, MPI_UNSIGNED_LONG_LONG, source, 0, comm, MPI_STATUS_IGNORE );
+
+   text.assign ( length, '\0' );
+   for ( std::size_t begin = 0; begin < length; begin += maxPiece )
+      MPI_Recv ( &text[begin], std::min ( maxPiece, std::size_t(length) - begin ), MPI_CHAR, source, 0, comm, MPI_STATUS_IGNORE );
+}
+
+// Collective read of len bytes at a given offset of a file
+// The read is done in pieces small enough for the int counts of MPI; all the
+// processes take part in the same number of reads, even if len differs
+static bool readAtAll ( MPI_File fh, MPI_Offset offset, char * buf, std::size_t len, MPI_Comm comm ) {
+   const std::size_t maxPiece = std::size_t(1) << 30;
+
+   unsigned long long pieces = ( len + maxPiece - 1 ) / maxPiece;
+   MPI_Allreduce ( MPI_IN_PLACE, &pieces, 1, MPI_UNSIGNED_LONG_LONG, MPI_MAX, comm );
+
+   bool ok = true;
+   for ( unsigned long long p = 0; p < pieces; ++p ) {
+      std::size_t begin = std::min ( len, std::size_t(p) * maxPiece );
+      std::size_t end = std::min ( len, begin + maxPiece );
+      ok = MPI_File_read_at_all ( fh, offset + begin, buf + begin, end - begin, MPI_BYTE, MPI_STATUS_IGNORE ) == MPI_SUCCESS && ok;
+   }
+
+   return ok;
+}
+
+// Opens a file for collective reading, or with another access mode; on
+// failure, no process keeps it open
+static bool openAll ( const std::string & path, MPI_File & fh, MPI_Comm comm, int mode = MPI_MODE_RDONLY ) {
+   bool opened = MPI_File_open ( comm, path.c_str(), mode, MPI_INFO_NULL, &fh ) == MPI_SUCCESS;
+
+   if ( !allSucceeded ( opened, comm ) ) {
+      if ( opened ) MPI_File_close ( &fh );
+      return false;
+   }
+
+   return true;
+}
+
+bool loadBinaryDatasetPartition ( const std::string & path, kMeansDataset & km, std::vector<int> & trueLabels, MPI_Comm comm ) {
+   int size; MPI_Comm_size ( comm, &size );
+   int rank; MPI_Comm_rank ( comm, &rank );
+
+   MPI_File fh;
+   if ( !openAll ( path, fh, comm ) ) return false;
+
+   MPI_Offset fileSize = 0;
+   MPI_File_get_size ( fh, &fileSize );
+
+   // Every process reads the header
+   datasetHeader header;
+   bool ok = readAtAll ( fh, 0, reinterpret_cast<char*> ( &header ), sizeof(datasetHeader), comm );
+
+   std::size_t scalarSize = header.dtype == dtypeFloat32 ? sizeof(float) : sizeof(double);
+
+   ok = ok && std::memcmp ( header.magic, datasetHeader().magic, 4 ) == 0
+      && header.version == datasetFormatVersion && header.dim > 0
+      && ( header.dtype == dtypeFloat64 || header.dtype == dtypeFloat32 )
+      && header.coordsOffset + header.count * header.dim * scalarSize <= uint64_t(fileSize)
+      && ( !( header.flags & hasTrueLabels ) || header.labelsOffset + header.count * sizeof(int32_t) <= uint64_t(fileSize) );
+
+   // The header is the same for every process, and so is the outcome of the check
+   if ( !ok ) {
+      MPI_File_close ( &fh );
+      return false;
+   }
+
+   unsigned int begin = 0, share = 0;
+   datasetPartition ( header.count, rank, size, begin, share );
+
+   km = kMeansDataset ( header.dim, share );
+   MPI_Offset coordsBegin = header.coordsOffset + uint64_t(begin) * header.dim * scalarSize;
+
+   if ( header.dtype == dtypeFloat64 )
+      ok = readAtAll ( fh, coordsBegin, reinterpret_cast<char*> ( km.data() ), std::size_t(share) * header.dim * sizeof(double), comm );
+
+   else {
+      std::vector<float> buf ( std::size_t(share) * header.dim );
+      ok = readAtAll ( fh, coordsBegin, reinterpret_cast<char*> ( buf.data() ), buf.size() * sizeof(float), comm );
+      std::copy ( buf.begin(), buf.end(), km.data() );
+   }
+
+   if ( header.flags & hasTrueLabels ) {
+      std::vector<int32_t> labels ( share );
+      ok = readAtAll ( fh, header.labelsOffset + uint64_t(begin) * sizeof(int32_t),
+                       reinterpret_cast<char*> ( labels.data() ), labels.size() * sizeof(int32_t), comm ) && ok;
+      trueLabels.insert ( trueLabels.end(), labels.begin(), labels.end() );
+   }
+
+   MPI_File_close ( &fh );
+
+   km.setPartition ( begin, header.count );
+   return allSucceeded ( ok, comm );
+}
+
+// Reads a text file split among processes in byte ranges of equal size,
+// realigned to whole lines
+// The head of each range, up to its first newline, completes the last line of
+// a previous range: it is sent to the closest previous process whose range has a
+// newline (or to process 0), which appends it to its own lines. Ranges without
+// newlines are entirely sent away
+static bool readLinesPartition ( const std::string & path, std::string & lines, MPI_Comm comm ) {
+   int size; MPI_Comm_size ( comm, &size );
+   int rank; MPI_Comm_rank ( comm, &rank );
+
+   MPI_File fh;
+   if ( !openAll ( path, fh, comm ) ) return false;
+
+   MPI_Offset fileSize = 0;
+   MPI_File_get_size ( fh, &fileSize );
+
+   MPI_Offset begin = fileSize * rank / size;
+   MPI_Offset end = fileSize * ( rank + 1 ) / size;
+
+   std::string chunk ( end - begin, '\0' );
+   bool ok = readAtAll ( fh, begin, &chunk[0], chunk.size(), comm );
+   MPI_File_close ( &fh );
+
+   if ( !allSucceeded ( ok, comm ) ) return false;
+
+   std::size_t newline = chunk.find ( '\n' );
+   int hasNewline = newline != std::string::npos;
+
+   std::vector<int> newlines ( size, 0 );
+   MPI_Allgather ( &hasNewline, 1, MPI_INT, newlines.data(), 1, MPI_INT, comm );
+
+   // Process 0 starts at the beginning of the file, thus has no head to send
+   std::size_t headLength = rank == 0 ? 0 : ( hasNewline ? newline + 1 : chunk.size() );
+
+   if ( rank > 0 ) {
+      int owner = rank - 1;
+      while ( owner > 0 && !newlines[owner] ) owner--;
+
+      sendText ( chunk.data(), headLength, owner, comm );
+   }
+
+   lines.assign ( chunk, headLength, std::string::npos );
+
+   // Heads are received in order, up to the first range having a newline
+   if ( rank == 0 || hasNewline ) {
+      for ( int proc = rank + 1; proc < size; ++proc ) {
+         std::string head;
+         recvText ( head, proc, comm );
+         lines += head;
+
+         if ( newlines[proc] ) break;
+      }
+   }
+
+   return true;
+}
+
+bool loadTextDatasetPartition ( const std::string & path, kMeansDataset & km, MPI_Comm comm, threadPool & pool ) {
+   int size; MPI_Comm_size ( comm, &size );
+   int rank; MPI_Comm_rank ( comm, &rank );
+
+   std::string lines;
+   if ( !readLinesPartition ( path, lines, comm ) ) return false;
+
+   const char * cur = lines.data();
+   const char * end = lines.data() + lines.size();
+
+   // The dimension is the first value of the file, read by process 0
+   unsigned int n = 0;
+   if ( rank == 0 ) {
+      while ( cur != end && isSpace(*cur) ) ++cur;
+      for ( ; cur != end && isDigit(*cur); ++cur ) n = n * 10 + ( *cur - '0' );
+   }
+
+   MPI_Bcast ( &n, 1, MPI_UNSIGNED, 0, comm );
+   if ( n == 0 ) return false;
+
+   std::vector<std::vector<double>> chunks;
+   bool ok = parseDoublesParallel ( cur, end, chunks, pool );
+   if ( !allSucceeded ( ok, comm ) ) return false;
+
+   std::vector<double> values ( std::move ( chunks[0] ) );
+   for ( std::size_t t = 1; t < chunks.size(); ++t ) values.insert ( values.end(), chunks[t].begin(), chunks[t].end() );
+
+   // Ranges of values read by each process, in the order of the file
+   unsigned long long range[2] = { 0, values.size() };
+   MPI_Exscan ( &range[1], &range[0], 1, MPI_UNSIGNED_LONG_LONG, MPI_SUM, comm );
+   if ( rank == 0 ) range[0] = 0;
+
+   std::vector<unsigned long long> ranges ( 2 * size );
+   MPI_Allgather ( range, 2, MPI_UNSIGNED_LONG_LONG, ranges.data(), 2, MPI_UNSIGNED_LONG_LONG, comm );
+
+   unsigned long long total = ranges[2*size - 2] + ranges[2*size - 1];
+   if ( total % n != 0 ) return false;
+
+   // Points may span lines, and thus the ranges of the processes: each point
+   // belongs to the process that read its first value, which receives the
+   // values that follow its range (less than a point) from the next processes
+   auto owned = [&] ( int proc, unsigned long long & first, unsigned long long & last ) {
+      first = ( ranges[2*proc] + n - 1 ) / n;
+      last = ( ranges[2*proc] + ranges[2*proc + 1] + n - 1 ) / n;
+   };
+
+   unsigned long long first, last;
+   owned ( rank, first, last );
+
+   // Own values, after those of the point begun by a previous process
+   std::size_t skipped = first * n - range[0];
+   std::size_t kept = last > first ? std::min ( range[0] + range[1], last * n ) - first * n : 0;
+
+   km = kMeansDataset ( n, last - first );
+   if ( kept > 0 ) std::copy ( values.begin() + skipped, values.begin() + skipped + kept, km.data() );
+
+   // Values read by this process that belong to the points of previous ones,
+   // and values of its points read by the next ones
+   std::vector<int> sendCounts ( size, 0 ), sendDispls ( size, 0 ), recvCounts ( size, 0 ), recvDispls ( size, 0 );
+   for ( int proc = 0; proc < size; ++proc ) {
+      if ( proc == rank ) continue;
+
+      unsigned long long procFirst, procLast;
+      owned ( proc, procFirst, procLast );
+
+      unsigned long long a = std::max ( range[0], procFirst * n );
+      unsigned long long b = std::min ( range[0] + range[1], procLast * n );
+      if ( b > a ) {
+         sendCounts[proc] = b - a;
+         sendDispls[proc] = a - range[0];
+      }
+
+      a = std::max ( ranges[2*proc], first * n + kept );
+      b = std::min ( ranges[2*proc] + ranges[2*proc + 1], last * n );
+      if ( b > a ) {
+         recvCounts[proc] = b - a;
+         recvDispls[proc] = a - ( first * n + kept );
+      }
+   }
+
+   MPI_Alltoallv ( values.data(), sendCounts.data(), sendDispls.data(), MPI_DOUBLE,
+                   km.data() + kept, recvCounts.data(), recvDispls.data(), MPI_DOUBLE, comm );
+
+   km.setPartition ( first, total / n );
+   return true;
+}
+
+bool loadTextLabelsPartition ( const std::string & path, const kMeansDataset & km, std::vector<int> & trueLabels, MPI_Comm comm ) {
+   int size; MPI_Comm_size ( comm, &size );
+   int rank; MPI_Comm_rank ( comm, &rank );
+
+   std::string lines;
+   if ( !readLinesPartition ( path, lines, comm ) ) return false;
+
+   std::vector<int> labels;
+   bool ok = parseTextLabels ( lines.data(), lines.data() + lines.size(), labels );
+   if ( !allSucceeded ( ok, comm ) ) return false;
+
+   // Ranges of labels read by each process, and of points owned by each process
+   unsigned long long labelsRange[2] = { 0, labels.size() };
+   MPI_Exscan ( &labelsRange[1], &labelsRange[0], 1, MPI_UNSIGNED_LONG_LONG, MPI_SUM, comm );
+   if ( rank == 0 ) labelsRange[0] = 0;
+
+   unsigned long long pointsRange[2] = { km.getGlobalBegin(), km.size() };
+
+   std::vector<unsigned long long> allLabels ( 2 * size ), allPoints ( 2 * size );
+   MPI_Allgather ( labelsRange, 2, MPI_UNSIGNED_LONG_LONG, allLabels.data(), 2, MPI_UNSIGNED_LONG_LONG, comm );
+   MPI_Allgather ( pointsRange, 2, MPI_UNSIGNED_LONG_LONG, allPoints.data(), 2, MPI_UNSIGNED_LONG_LONG, comm );
+
+   // There must be exactly one label per point
+   if ( allLabels[2*size - 2] + allLabels[2*size - 1] != km.getGlobalSize() ) return false;
+
+   // Each process sends the labels it read to the processes owning their points
+   std::vector<int> sendCounts ( size ), sendDispls ( size ), recvCounts ( size ), recvDispls ( size );
+
+   for ( int proc = 0; proc < size; ++proc ) {
+      unsigned long long a = std::max ( labelsRange[0], allPoints[2*proc] );
+      unsigned long long b = std::min ( labelsRange[0] + labelsRange[1], allPoints[2*proc] + allPoints[2*proc + 1] );
+      sendCounts[proc] = b > a ? b - a : 0;
+      sendDispls[proc] = b > a ? a - labelsRange[0] : 0;
+
+      a = std::max ( pointsRange[0], allLabels[2*proc] );
+      b = std::min ( pointsRange[0] + pointsRange[1], allLabels[2*proc] + allLabels[2*proc + 1] );
+      recvCounts[proc] = b > a ? b - a : 0;
+      recvDispls[proc] = b > a ? a - pointsRange[0] : 0;
+   }
+
+   std::vector<int> local ( km.size() );
+   MPI_Alltoallv ( labels.data(), sendCounts.data(), sendDispls.data(), MPI_INT,
+                   local.data(), recvCounts.data(), recvDispls.data(), MPI_INT, comm );
+
+   trueLabels.insert ( trueLabels.end(), local.begin(), local.end() );
+   return true;
+}
+
+bool parseResultsFormat ( const std::string & name, resultsFormat & format ) {
+   if ( name == "octave" ) format = resultsFormat::octave;
+   else if ( name == "binary" ) format = resultsFormat::binary;
+   else return false;
+   return true;
+}
+
+const char * resultsFormatName ( resultsFormat format ) {
+   return format == resultsFormat::binary ? "binary" : "octave";
+}
+
+// Collective write of len bytes at a given offset of a file, in pieces as in
+// readAtAll
+static bool writeAtAll ( MPI_File fh, MPI_Offset offset, const char * buf, std::size_t len, MPI_Comm comm ) {
+   const std::size_t maxPiece = std::size_t(1) << 30;
+
+   unsigned long long pieces = ( len + maxPiece - 1 ) / maxPiece;
+   MPI_Allreduce ( MPI_IN_PLACE, &pieces, 1, MPI_UNSIGNED_LONG_LONG, MPI_MAX, comm );
+
+   bool ok = true;
+   for ( unsigned long long p = 0; p < pieces; ++p ) {
+      std::size_t begin = std::min ( len, std::size_t(p) * maxPiece );
+      std::size_t end = std::min ( len, begin + maxPiece );
+      ok = MPI_File_write_at_all ( fh, offset + begin, buf + begin, end - begin, MPI_BYTE, MPI_STATUS_IGNORE ) == MPI_SUCCESS && ok;
+   }
+
+   return ok;
+}
+
+// Collective write of the text of each process after those of the processes
+// before it, the file being truncated to their total size
+static bool writeOrderedAll ( MPI_File fh, const std::string & text, MPI_Comm comm ) {
+   int rank; MPI_Comm_rank ( comm, &rank );
+
+   unsigned long long len = text.size(), offset = 0, fileSize = 0;
+   MPI_Exscan ( &len, &offset, 1, MPI_UNSIGNED_LONG_LONG, MPI_SUM, comm );
+   MPI_Allreduce ( &len, &fileSize, 1, MPI_UNSIGNED_LONG_LONG, MPI_SUM, comm );
+   if ( rank == 0 ) offset = 0;
+
+   bool ok = MPI_File_set_size ( fh, fileSize ) == MPI_SUCCESS;
+   return writeAtAll ( fh, offset, text.data(), text.size(), comm ) && ok;
+}
+
+// Text of count rows, the i-th of which is appended to a string by row ( i,
+// text ); the rows are split among the threads of the pool, each formatting
+// its own range, and concatenated in order. rowSize is an estimate of the
+// length of a row
+template < typename F >
+static std::string formatRows ( unsigned int count, threadPool & pool, std::size_t rowSize, F row ) {
+   unsigned int threads = std::max ( 1u, std::min ( pool.size(), count / 4096 ) );
+
+   std::vector<std::string> rows ( threads );
+   auto work = [&] ( unsigned int t ) {
+      unsigned int first = 0, share = 0;
+      datasetPartition ( count, t, threads, first, share );
+
+      std::string & text = rows[t];
+      text.reserve ( share * rowSize );
+      for ( unsigned int i = first; i < first + share; ++i ) row ( i, text );
+   };
+
+   pool.run ( [&] ( unsigned int t ) { if ( t < threads ) work ( t ); } );
+
+   std::string text;
+   text.reserve ( std::size_t(count) * rowSize );
+   for ( auto & r : rows ) text += r;
+   return text;
+}
+
+// Text of the results of a portion of the dataset starting at index begin, out
+// of total points: the rows of its points, each preceded by a row separator
+// but the first one of the dataset, after the heading if the portion is the
+// first one and followed by the closing bracket if it is the last one
+// The points are split among the threads, each formatting its own rows; numbers
+// are formatted as streams do by default (6 significant digits)
+template < typename real >
+static std::string octaveResults ( const basicDataset<real> & km, unsigned int begin, unsigned int total,
+                                   unsigned int clusters, threadPool & pool ) {
+   unsigned int count = km.size();
+
+   std::string rows = formatRows ( count, pool, std::size_t(km.getN() + 1) * 12, [&] ( unsigned int i, std::string & text ) {
+      char buf[32];
+      if ( begin + i > 0 ) text += ";\n";
+      text.append ( buf, std::snprintf ( buf, sizeof(buf), "%d", km.getLabel(i) ) );
+      for ( unsigned int j = 0; j < km.getN(); ++j )
+         text.append ( buf, std::snprintf ( buf, sizeof(buf), " %g", double ( km(i,j) ) ) );
+   } );
+
+   // Processes with no points leave both to the others
+   std::string text;
+   if ( count > 0 && begin == 0 ) text = "dim = " + std::to_string ( km.getN() ) + ";\nclusters = " + std::to_string ( clusters ) + ";\ndataset = [ ";
+   text += rows;
+   if ( count > 0 && begin + count == total ) text += "];";
+
+   return text;
+}
+
+// Header and centroids of the binary results format, padded up to the labels
+static std::string binaryResultsHeading ( unsigned int n, unsigned int total, const std::vector<point> & centroids ) {
+   resultsHeader header;
+   header.dim = n;
+   header.clusters = centroids.size();
+   header.count = total;
+   header.centroidsOffset = 64;
+   header.labelsOffset = ( header.centroidsOffset + sizeof(double) * n * centroids.size() + 63 ) / 64 * 64;
+
+   std::string heading ( header.labelsOffset, '\0' );
+   std::memcpy ( &heading[0], &header, sizeof(header) );
+   for ( std::size_t kk = 0; kk < centroids.size(); ++kk )
+      std::memcpy ( &heading[header.centroidsOffset + sizeof(double) * n * kk], centroids[kk].data(), sizeof(double) * n );
+
+   return heading;
+}
+
+template < typename real >
+void printResults ( std::ostream & out, resultsFormat format, const basicDataset<real> & km, unsigned int begin, unsigned int total,
+                    const std::vector<point> & centroids, MPI_Comm comm, threadPool & pool ) {
+   int size; MPI_Comm_size ( comm, &size );
+   int rank; MPI_Comm_rank ( comm, &rank );
+
+   if ( format == resultsFormat::octave ) {
+      std::string text = octaveResults ( km, begin, total, centroids.size(), pool );
+
+      if ( rank != 0 ) {
+         sendText ( text.data(), text.size(), 0, comm );
+         return;
+      }
+
+      out.write ( text.data(), text.size() );
+      for ( int proc = 1; proc < size; ++proc ) {
+         recvText ( text, proc, comm );
+         out.write ( text.data(), text.size() );
+      }
+      return;
+   }
+
+   // Binary format: labels are gathered in the order of the processes, which
+   // is the order of their portions
+   int count = km.size();
+   std::vector<int> counts ( size ), displs ( size, 0 );
+   MPI_Gather ( &count, 1, MPI_INT, counts.data(), 1, MPI_INT, 0, comm );
+   for ( int proc = 1; proc < size; ++proc ) displs[proc] = displs[proc-1] + counts[proc-1];
+
+   std::vector<int> labels ( rank == 0 ? total : 0 );
+   MPI_Gatherv ( km.labelData(), count, MPI_INT, labels.data(), counts.data(), displs.data(), MPI_INT, 0, comm );
+
+   if ( rank == 0 ) {
+      std::string heading = binaryResultsHeading ( km.getN(), total, centroids );
+      out.write ( heading.data(), heading.size() );
+      out.write ( reinterpret_cast<const char *> ( labels.data() ), labels.size() * sizeof(int) );
+   }
+}
+
+template < typename real >
+bool writeResults ( const std::string & path, resultsFormat format, const basicDataset<real> & km, unsigned int begin, unsigned int total,
+                    const std::vector<point> & centroids, MPI_Comm comm, threadPool & pool ) {
+   int rank; MPI_Comm_rank ( comm, &rank );
+
+   MPI_File fh;
+   if ( !openAll ( path, fh, comm, MPI_MODE_WRONLY | MPI_MODE_CREATE ) ) return false;
+   bool ok = true;
+
+   // Text: each process writes its text after those of the processes before it
+   if ( format == resultsFormat::octave )
+      ok = writeOrderedAll ( fh, octaveResults ( km, begin, total, centroids.size(), pool ), comm );
+
+   // Binary: process 0 writes the header and the centroids, then each process
+   // writes its labels at the position of its portion
+   else {
+      std::string heading = binaryResultsHeading ( km.getN(), total, centroids );
+      std::size_t labelsOffset = heading.size();
+
+      ok = MPI_File_set_size ( fh, labelsOffset + sizeof(int) * std::size_t(total) ) == MPI_SUCCESS;
+      ok = writeAtAll ( fh, 0, heading.data(), rank == 0 ? heading.size() : 0, comm ) && ok;
+      ok = writeAtAll ( fh, labelsOffset + sizeof(int) * std::size_t(begin), reinterpret_cast<const char *> ( km.labelData() ),
+                        sizeof(int) * km.size(), comm ) && ok;
+   }
+
+   ok = MPI_File_close ( &fh ) == MPI_SUCCESS && ok;
+   return allSucceeded ( ok, comm );
+}
+
+bool writeBinaryDatasetPartition ( const std::string & path, const kMeansDataset & km, const std::vector<int> & trueLabels, MPI_Comm comm ) {
+   int rank; MPI_Comm_rank ( comm, &rank );
+
+   // Labels are written only if all the processes have them
+   int withLabels = trueLabels.size() == km.size();
+   MPI_Allreduce ( MPI_IN_PLACE, &withLabels, 1, MPI_INT, MPI_LAND, comm );
+
+   datasetHeader header;
+   header.dim = km.getN();
+   header.count = km.getGlobalSize();
+   header.coordsOffset = alignOffset ( sizeof(datasetHeader) );
+
+   uint64_t coordsSize = header.count * header.dim * sizeof(double);
+   uint64_t fileSize = header.coordsOffset + coordsSize;
+
+   if ( withLabels ) {
+      header.flags |= hasTrueLabels;
+      header.labelsOffset = alignOffset ( header.coordsOffset + coordsSize );
+      fileSize = header.labelsOffset + header.count * sizeof(int32_t);
+   }
+
+   // Coordinates are written in row-major order whatever the layout in memory
+   std::vector<double> coords;
+   if ( km.getLayout() == datasetLayout::colMajor ) {
+      coords.resize ( std::size_t(km.size()) * km.getN() );
+      for ( unsigned int i = 0; i < km.size(); ++i )
+         for ( unsigned int j = 0; j < km.getN(); ++j ) coords[std::size_t(i) * km.getN() + j] = km(i,j);
+   }
+   const double * rows = coords.empty() ? km.data() : coords.data();
+
+   MPI_File fh;
+   if ( !openAll ( path, fh, comm, MPI_MODE_WRONLY | MPI_MODE_CREATE ) ) return false;
+
+   std::size_t begin = km.getGlobalBegin();
+   bool ok = MPI_File_set_size ( fh, fileSize ) == MPI_SUCCESS;
+   ok = writeAtAll ( fh, 0, reinterpret_cast<const char *> ( &header ), rank == 0 ? sizeof(header) : 0, comm ) && ok;
+   ok = writeAtAll ( fh, header.coordsOffset + begin * header.dim * sizeof(double), reinterpret_cast<const char *> ( rows ),
+                     std::size_t(km.size()) * km.getN() * sizeof(double), comm ) && ok;
+
+   if ( withLabels ) {
+      std::vector<int32_t> labels ( trueLabels.begin(), trueLabels.end() );
+      ok = writeAtAll ( fh, header.labelsOffset + begin * sizeof(int32_t), reinterpret_cast<const char *> ( labels.data() ),
+                        labels.size() * sizeof(int32_t), comm ) && ok;
+   }
+
+   ok = MPI_File_close ( &fh ) == MPI_SUCCESS && ok;
+   return allSucceeded ( ok, comm );
+}
+
+bool writeTextDatasetPartition ( const std::string & path, const kMeansDataset & km, MPI_Comm comm, threadPool & pool ) {
+   std::string text = formatRows ( km.size(), pool, std::size_t(km.getN()) * 11, [&] ( unsigned int i, std::string & text ) {
+      char buf[32];
+      for ( unsigned int j = 0; j < km.getN(); ++j )
+         text.append ( buf, std::snprintf ( buf, sizeof(buf), j + 1 < km.getN() ? "%f " : "%f\n", km(i,j) ) );
+   } );
+
+   if ( km.getGlobalBegin() == 0 ) text.insert ( 0, std::to_string ( km.getN() ) + "\n" );
+
+   MPI_File fh;
+   if ( !openAll ( path, fh, comm, MPI_MODE_WRONLY | MPI_MODE_CREATE ) ) return false;
+
+   bool ok = writeOrderedAll ( fh, text, comm );
+   ok = MPI_File_close ( &fh ) == MPI_SUCCESS && ok;
+   return allSucceeded ( ok, comm );
+}
+
+bool writeTextLabelsPartition ( const std::string & path, const std::vector<int> & trueLabels, MPI_Comm comm ) {
+   std::string text;
+   text.reserve ( trueLabels.size() * 4 );
+   for ( int l : trueLabels ) ( text += std::to_string ( l ) ) += '\n';
+
+   MPI_File fh;
+   if ( !openAll ( path, fh, comm, MPI_MODE_WRONLY | MPI_MODE_CREATE ) ) return false;
+
+   bool ok = writeOrderedAll ( fh, text, comm );
+   ok = MPI_File_close ( &fh ) == MPI_SUCCESS && ok;
+   return allSucceeded ( ok, comm );
+}
+
+// Both precisions of the coordinates are written by the same functions
+template void printResults ( std::ostream &, resultsFormat, const basicDataset<double> &, unsigned int, unsigned int,
+                             const std::vector<point> &, MPI_Comm, threadPool & );
+template void printResults ( std::ostream &, resultsFormat, const basicDataset<float> &, unsigned int, unsigned int,
+                             const std::vector<point> &, MPI_Comm, threadPool & );
+template bool writeResults ( const std::string &, resultsFormat, const basicDataset<double> &, unsigned int, unsigned int,
+                             const std::vector<point> &, MPI_Comm, threadPool & );
+template bool writeResults ( const std::string &, resultsFormat, const basicDataset<float> &, unsigned int, unsigned int,
+                             const std::vector<point> &, MPI_Comm, threadPool & );
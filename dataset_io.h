@@ -0,0 +1,164 @@
+#ifndef _DATASET_IO_H
+#define _DATASET_IO_H
+
+#include "dataset.h"
+#include "point.h"
+#include "thread_pool.h"
+
+#include <mpi.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Binary dataset format
+// The file starts with the header below, followed by the coordinates of the
+// points in row-major order (at coordsOffset) and, if the flag hasTrueLabels is
+// set, by the true labels of the points as 32 bit integers (at labelsOffset).
+// Both blocks start on a 64 byte boundary, so that a mapped file can be used
+// in place. Values are stored in the native byte order
+enum datasetDtype : uint32_t { dtypeFloat64 = 0, dtypeFloat32 = 1 };
+enum datasetFlags : uint32_t { hasTrueLabels = 1 };
+
+struct datasetHeader {
+   char magic[4] = { 'K', 'M', 'D', 'S' };
+   uint32_t version = 1;
+   uint32_t dim = 0;     // Dimension of the points
+   uint32_t dtype = dtypeFloat64; // Type of the coordinates
+   uint64_t count = 0;   // Number of points
+   uint32_t flags = 0;
+   uint32_t reserved = 0;
+   uint64_t coordsOffset = 0;
+   uint64_t labelsOffset = 0;
+};
+
+// Current version of the format
+constexpr uint32_t datasetFormatVersion = 1;
+
+// Checks whether a file is a binary dataset, from its magic number
+bool isBinaryDataset ( const std::string & );
+
+// Loads a binary dataset by mapping it in memory
+// Double precision coordinates are used in place, without copies, while single
+// precision ones are converted. True labels, if stored in the file, are
+// appended to the vector
+// Returns false if the file cannot be mapped or is not a valid dataset
+bool loadBinaryDataset ( const std::string &, kMeansDataset &, std::vector<int> & );
+
+// Writes a dataset in binary format, along with its true labels if the vector
+// is not empty
+// Returns false if the file cannot be written
+bool writeBinaryDataset ( const std::string &, const kMeansDataset &, const std::vector<int> & );
+
+// Fast text parsing
+// The text format is the dimension of the points, followed by the coordinates
+// of each point, separated by whitespace. Numbers are parsed without going
+// through streams and locales; decimal numbers with up to 19 significant digits
+// and small exponents (the common case) are converted exactly with a single
+// floating point operation, the others through strtod
+
+// Parses a dataset from the characters in [begin, end)
+// The work is split among the threads of the pool
+// Returns false if the input is not a valid dataset
+bool parseTextDataset ( const char *, const char *, kMeansDataset &, threadPool & );
+
+// Parses the coordinates of points of known dimension from [begin, end), that
+// is a text dataset without the header, and appends them to the dataset
+bool parseTextPoints ( const char *, const char *, kMeansDataset &, threadPool & );
+
+// Parses whitespace-separated integers from [begin, end) and appends them to
+// the vector
+bool parseTextLabels ( const char *, const char *, std::vector<int> & );
+
+// Loads a text dataset or a true labels file, by mapping it in memory and
+// parsing it with the functions above
+bool loadTextDataset ( const std::string &, kMeansDataset &, threadPool & );
+bool loadTextLabels ( const std::string &, std::vector<int> & );
+
+// Partitioned loading
+// Each process of the communicator reads only its own portion of the dataset,
+// so that the complete dataset is never stored by any process. The resulting
+// dataset is that portion, and knows its position in the complete dataset (see
+// kMeansDataset::isPartition). All the functions are collective, and return
+// false on all processes if any of them fails
+
+// Binary files are split evenly with datasetPartition, and the portions of
+// coordinates and true labels (if stored in the file, they are appended to the
+// vector) are read with collective MPI-IO reads
+bool loadBinaryDatasetPartition ( const std::string &, kMeansDataset &, std::vector<int> &, MPI_Comm );
+
+// Text files are split in byte ranges of equal size, which are then realigned
+// so that each process gets whole lines, parsed with the threads of the pool;
+// the values of a point spanning the ranges of several processes are sent to
+// the first of them. Processes get roughly the same number of points
+bool loadTextDatasetPartition ( const std::string &, kMeansDataset &, MPI_Comm, threadPool & );
+
+// Reads the true labels of the points of a dataset portion from a text file
+// The file is split in byte ranges as above, and labels are then exchanged so
+// that each process gets those of its own points
+bool loadTextLabelsPartition ( const std::string &, const kMeansDataset &, std::vector<int> &, MPI_Comm );
+
+// Partitioned writing
+// Each process of the communicator writes its own portion of the dataset (see
+// kMeansDataset::isPartition) at its position in the file, with collective
+// MPI-IO writes, so that no process holds the complete dataset. All the
+// functions are collective, and return false on all processes if any of them
+// fails
+
+// Binary format, with the true labels of the portions if all the processes
+// have them
+bool writeBinaryDatasetPartition ( const std::string &, const kMeansDataset &, const std::vector<int> &, MPI_Comm );
+
+// Text format, one point per line with 6 decimal digits as in the benchmarks
+// files; the points of each process are formatted with the threads of the
+// pool. True labels are written to a text file of their own, one per line
+bool writeTextDatasetPartition ( const std::string &, const kMeansDataset &, MPI_Comm, threadPool & );
+bool writeTextLabelsPartition ( const std::string &, const std::vector<int> &, MPI_Comm );
+
+// Clustering results
+// Results are written either as text in Octave/MatLab syntax, which plotScript.m
+// reads (the dimension, the number of clusters, and a matrix with a row per
+// point: its label followed by its coordinates), or in a compact binary format
+// holding only the centroids and the labels
+enum class resultsFormat { octave, binary };
+
+// Conversion from and to the names used on the command line (octave, binary);
+// parsing returns false on unknown names
+bool parseResultsFormat ( const std::string &, resultsFormat & );
+const char * resultsFormatName ( resultsFormat );
+
+// Binary results format
+// The file starts with the header below, followed by the centroids, as rows of
+// dim doubles (at centroidsOffset), and by the labels of the points, counted
+// from 0, as 32 bit integers (at labelsOffset). Both blocks start on a 64 byte
+// boundary. Values are stored in the native byte order
+struct resultsHeader {
+   char magic[4] = { 'K', 'M', 'R', 'S' };
+   uint32_t version = 1;
+   uint32_t dim = 0;      // Dimension of the points
+   uint32_t clusters = 0; // Number of centroids
+   uint64_t count = 0;    // Number of points
+   uint64_t centroidsOffset = 0;
+   uint64_t labelsOffset = 0;
+};
+
+// Output of the results of the processes of comm, each holding the portion of
+// the complete dataset (of the given size) that starts at the given index, and
+// the centroids; the functions are collective
+// Each process formats its own points, with the threads of the pool
+
+// Prints the results on a stream of process 0
+// In text format, process 0 receives the text of each of the others, in pieces
+// small enough for the int counts of MPI; in binary format, the labels are
+// gathered with one collective
+template < typename real >
+void printResults ( std::ostream &, resultsFormat, const basicDataset<real> &, unsigned int, unsigned int,
+                    const std::vector<point> &, MPI_Comm, threadPool & );
+
+// Writes the results to a file, each process writing its portion at its offset
+// with collective MPI-IO writes, without going through process 0
+// Returns false on all processes if the file cannot be written
+template < typename real >
+bool writeResults ( const std::string &, resultsFormat, const basicDataset<real> &, unsigned int, unsigned int,
+                    const std::vector<point> &, MPI_Comm, threadPool & );
+
+#endif
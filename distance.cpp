@@ -0,0 +1,450 @@
+#include "distance.h"
+
+#include <cstdlib>
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define DIST_X86 1
+#endif
+
+// Portable kernels, in double and single precision
+// Two independent accumulators let the compiler overlap consecutive additions
+
+template < typename T >
+static T sqEuclideanScalar ( const T * a, const T * b, unsigned int n ) {
+   T s0 = 0, s1 = 0;
+   unsigned int i = 0;
+   for ( ; i + 1 < n; i += 2 ) {
+      T x0 = a[i] - b[i], x1 = a[i+1] - b[i+1];
+      s0 += x0 * x0; s1 += x1 * x1;
+   }
+   if ( i < n ) { T x = a[i] - b[i]; s0 += x * x; }
+   return s0 + s1;
+}
+
+template < typename T >
+static T manhattanScalar ( const T * a, const T * b, unsigned int n ) {
+   T s0 = 0, s1 = 0;
+   unsigned int i = 0;
+   for ( ; i + 1 < n; i += 2 ) {
+      s0 += std::fabs ( a[i] - b[i] );
+      s1 += std::fabs ( a[i+1] - b[i+1] );
+   }
+   if ( i < n ) s0 += std::fabs ( a[i] - b[i] );
+   return s0 + s1;
+}
+
+// Dot products of a set of points with panels of centroids
+// The panels are processed in chunks small enough to stay in cache while all
+// the points go through them; within a chunk, blocks of 4 points are multiplied
+// by one panel at a time, keeping the 4 x dotsPanel products in registers
+static void blockedDotsScalar ( const double * x, unsigned int m, const double * panels, unsigned int npanels,
+                                unsigned int n, double * out, unsigned int ldo ) {
+   constexpr unsigned int P = dotsPanel;
+   const unsigned int chunk = std::max ( 1u, 16384u / ( n * P ) );
+
+   for ( unsigned int q0 = 0; q0 < npanels; q0 += chunk ) {
+      unsigned int q1 = std::min ( npanels, q0 + chunk );
+      unsigned int i = 0;
+
+      for ( ; i + 4 <= m; i += 4 ) {
+         const double * x0 = x + std::size_t(i) * n;
+         const double * x1 = x0 + n, * x2 = x1 + n, * x3 = x2 + n;
+
+         for ( unsigned int q = q0; q < q1; ++q ) {
+            const double * c = panels + std::size_t(q) * n * P;
+            double a0[P] = {}, a1[P] = {}, a2[P] = {}, a3[P] = {};
+
+            for ( unsigned int j = 0; j < n; ++j ) {
+               const double * cj = c + std::size_t(j) * P;
+               double v0 = x0[j], v1 = x1[j], v2 = x2[j], v3 = x3[j];
+               for ( unsigned int b = 0; b < P; ++b ) {
+                  a0[b] += v0 * cj[b];
+                  a1[b] += v1 * cj[b];
+                  a2[b] += v2 * cj[b];
+                  a3[b] += v3 * cj[b];
+               }
+            }
+
+            double * o = out + std::size_t(i) * ldo + q * P;
+            for ( unsigned int b = 0; b < P; ++b ) {
+               o[b] = a0[b];
+               o[ldo + b] = a1[b];
+               o[2*ldo + b] = a2[b];
+               o[3*ldo + b] = a3[b];
+            }
+         }
+      }
+
+      for ( ; i < m; ++i ) {
+         const double * xi = x + std::size_t(i) * n;
+
+         for ( unsigned int q = q0; q < q1; ++q ) {
+            const double * c = panels + std::size_t(q) * n * P;
+            double a[P] = {};
+
+            for ( unsigned int j = 0; j < n; ++j )
+               for ( unsigned int b = 0; b < P; ++b )
+                  a[b] += xi[j] * c[std::size_t(j) * P + b];
+
+            std::copy ( a, a + P, out + std::size_t(i) * ldo + q * P );
+         }
+      }
+   }
+}
+
+#ifdef DIST_X86
+
+// AVX2 dot products: blocks of 4 points by a panel, held in 8 registers
+__attribute__((target("avx2,fma")))
+static void blockedDotsAVX2 ( const double * x, unsigned int m, const double * panels, unsigned int npanels,
+                              unsigned int n, double * out, unsigned int ldo ) {
+   static_assert ( dotsPanel == 8, "the AVX2 dot products kernel assumes panels of 8 centroids" );
+   const unsigned int chunk = std::max ( 1u, 16384u / ( n * dotsPanel ) );
+
+   for ( unsigned int q0 = 0; q0 < npanels; q0 += chunk ) {
+      unsigned int q1 = std::min ( npanels, q0 + chunk );
+      unsigned int i = 0;
+
+      for ( ; i + 4 <= m; i += 4 ) {
+         const double * x0 = x + std::size_t(i) * n;
+         const double * x1 = x0 + n, * x2 = x1 + n, * x3 = x2 + n;
+
+         for ( unsigned int q = q0; q < q1; ++q ) {
+            const double * c = panels + std::size_t(q) * n * dotsPanel;
+            __m256d a0 = _mm256_setzero_pd(), b0 = _mm256_setzero_pd();
+            __m256d a1 = _mm256_setzero_pd(), b1 = _mm256_setzero_pd();
+            __m256d a2 = _mm256_setzero_pd(), b2 = _mm256_setzero_pd();
+            __m256d a3 = _mm256_setzero_pd(), b3 = _mm256_setzero_pd();
+
+            for ( unsigned int j = 0; j < n; ++j ) {
+               __m256d cl = _mm256_loadu_pd ( c + std::size_t(j) * dotsPanel );
+               __m256d ch = _mm256_loadu_pd ( c + std::size_t(j) * dotsPanel + 4 );
+               __m256d v = _mm256_broadcast_sd ( x0 + j );
+               a0 = _mm256_fmadd_pd ( v, cl, a0 ); b0 = _mm256_fmadd_pd ( v, ch, b0 );
+               v = _mm256_broadcast_sd ( x1 + j );
+               a1 = _mm256_fmadd_pd ( v, cl, a1 ); b1 = _mm256_fmadd_pd ( v, ch, b1 );
+               v = _mm256_broadcast_sd ( x2 + j );
+               a2 = _mm256_fmadd_pd ( v, cl, a2 ); b2 = _mm256_fmadd_pd ( v, ch, b2 );
+               v = _mm256_broadcast_sd ( x3 + j );
+               a3 = _mm256_fmadd_pd ( v, cl, a3 ); b3 = _mm256_fmadd_pd ( v, ch, b3 );
+            }
+
+            double * o = out + std::size_t(i) * ldo + q * dotsPanel;
+            _mm256_storeu_pd ( o, a0 ); _mm256_storeu_pd ( o + 4, b0 ); o += ldo;
+            _mm256_storeu_pd ( o, a1 ); _mm256_storeu_pd ( o + 4, b1 ); o += ldo;
+            _mm256_storeu_pd ( o, a2 ); _mm256_storeu_pd ( o + 4, b2 ); o += ldo;
+            _mm256_storeu_pd ( o, a3 ); _mm256_storeu_pd ( o + 4, b3 );
+         }
+      }
+
+      for ( ; i < m; ++i ) {
+         const double * xi = x + std::size_t(i) * n;
+
+         for ( unsigned int q = q0; q < q1; ++q ) {
+            const double * c = panels + std::size_t(q) * n * dotsPanel;
+            __m256d a = _mm256_setzero_pd(), b = _mm256_setzero_pd();
+
+            for ( unsigned int j = 0; j < n; ++j ) {
+               __m256d v = _mm256_broadcast_sd ( xi + j );
+               a = _mm256_fmadd_pd ( v, _mm256_loadu_pd ( c + std::size_t(j) * dotsPanel ), a );
+               b = _mm256_fmadd_pd ( v, _mm256_loadu_pd ( c + std::size_t(j) * dotsPanel + 4 ), b );
+            }
+
+            double * o = out + std::size_t(i) * ldo + q * dotsPanel;
+            _mm256_storeu_pd ( o, a ); _mm256_storeu_pd ( o + 4, b );
+         }
+      }
+   }
+}
+
+// AVX-512 dot products: blocks of 8 points by a panel, held in 8 registers
+__attribute__((target("avx512f")))
+static void blockedDotsAVX512 ( const double * x, unsigned int m, const double * panels, unsigned int npanels,
+                                unsigned int n, double * out, unsigned int ldo ) {
+   static_assert ( dotsPanel == 8, "the AVX-512 dot products kernel assumes panels of 8 centroids" );
+   const unsigned int chunk = std::max ( 1u, 16384u / ( n * dotsPanel ) );
+
+   for ( unsigned int q0 = 0; q0 < npanels; q0 += chunk ) {
+      unsigned int q1 = std::min ( npanels, q0 + chunk );
+      unsigned int i = 0;
+
+      for ( ; i + 8 <= m; i += 8 ) {
+         const double * xi = x + std::size_t(i) * n;
+
+         for ( unsigned int q = q0; q < q1; ++q ) {
+            const double * c = panels + std::size_t(q) * n * dotsPanel;
+            __m512d a[8];
+            for ( unsigned int r = 0; r < 8; ++r ) a[r] = _mm512_setzero_pd();
+
+            for ( unsigned int j = 0; j < n; ++j ) {
+               __m512d cj = _mm512_loadu_pd ( c + std::size_t(j) * dotsPanel );
+               for ( unsigned int r = 0; r < 8; ++r )
+                  a[r] = _mm512_fmadd_pd ( _mm512_set1_pd ( xi[std::size_t(r) * n + j] ), cj, a[r] );
+            }
+
+            double * o = out + std::size_t(i) * ldo + q * dotsPanel;
+            for ( unsigned int r = 0; r < 8; ++r )
+               _mm512_storeu_pd ( o + std::size_t(r) * ldo, a[r] );
+         }
+      }
+
+      for ( ; i < m; ++i ) {
+         const double * xi = x + std::size_t(i) * n;
+
+         for ( unsigned int q = q0; q < q1; ++q ) {
+            const double * c = panels + std::size_t(q) * n * dotsPanel;
+            __m512d a = _mm512_setzero_pd();
+
+            for ( unsigned int j = 0; j < n; ++j )
+               a = _mm512_fmadd_pd ( _mm512_set1_pd ( xi[j] ), _mm512_loadu_pd ( c + std::size_t(j) * dotsPanel ), a );
+
+            _mm512_storeu_pd ( out + std::size_t(i) * ldo + q * dotsPanel, a );
+         }
+      }
+   }
+}
+
+// AVX2 kernels: 4 doubles per register, two accumulators, scalar tail
+
+__attribute__((target("avx2,fma")))
+static double sqEuclideanAVX2 ( const double * a, const double * b, unsigned int n ) {
+   __m256d s0 = _mm256_setzero_pd(), s1 = _mm256_setzero_pd();
+   unsigned int i = 0;
+   for ( ; i + 8 <= n; i += 8 ) {
+      __m256d x0 = _mm256_sub_pd ( _mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i) );
+      __m256d x1 = _mm256_sub_pd ( _mm256_loadu_pd(a + i + 4), _mm256_loadu_pd(b + i + 4) );
+      s0 = _mm256_fmadd_pd ( x0, x0, s0 );
+      s1 = _mm256_fmadd_pd ( x1, x1, s1 );
+   }
+   if ( i + 4 <= n ) {
+      __m256d x0 = _mm256_sub_pd ( _mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i) );
+      s0 = _mm256_fmadd_pd ( x0, x0, s0 );
+      i += 4;
+   }
+   s0 = _mm256_add_pd ( s0, s1 );
+   __m128d h = _mm_add_pd ( _mm256_castpd256_pd128(s0), _mm256_extractf128_pd(s0, 1) );
+   double sum = _mm_cvtsd_f64 ( _mm_add_sd ( h, _mm_unpackhi_pd(h, h) ) );
+   for ( ; i < n; ++i ) { double x = a[i] - b[i]; sum += x * x; }
+   return sum;
+}
+
+__attribute__((target("avx2")))
+static double manhattanAVX2 ( const double * a, const double * b, unsigned int n ) {
+   const __m256d signMask = _mm256_set1_pd ( -0.0 );
+   __m256d s0 = _mm256_setzero_pd(), s1 = _mm256_setzero_pd();
+   unsigned int i = 0;
+   for ( ; i + 8 <= n; i += 8 ) {
+      __m256d x0 = _mm256_sub_pd ( _mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i) );
+      __m256d x1 = _mm256_sub_pd ( _mm256_loadu_pd(a + i + 4), _mm256_loadu_pd(b + i + 4) );
+      s0 = _mm256_add_pd ( s0, _mm256_andnot_pd(signMask, x0) );
+      s1 = _mm256_add_pd ( s1, _mm256_andnot_pd(signMask, x1) );
+   }
+   if ( i + 4 <= n ) {
+      __m256d x0 = _mm256_sub_pd ( _mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i) );
+      s0 = _mm256_add_pd ( s0, _mm256_andnot_pd(signMask, x0) );
+      i += 4;
+   }
+   s0 = _mm256_add_pd ( s0, s1 );
+   __m128d h = _mm_add_pd ( _mm256_castpd256_pd128(s0), _mm256_extractf128_pd(s0, 1) );
+   double sum = _mm_cvtsd_f64 ( _mm_add_sd ( h, _mm_unpackhi_pd(h, h) ) );
+   for ( ; i < n; ++i ) sum += std::fabs ( a[i] - b[i] );
+   return sum;
+}
+
+// AVX-512 kernels: 8 doubles per register, the tail is handled with a masked load
+
+// Horizontal sum of a register
+// Done through memory rather than with _mm512_reduce_add_pd, whose lane
+// extractions trigger spurious -Wuninitialized warnings in GCC's headers
+__attribute__((target("avx512f")))
+static double hsum512 ( __m512d x ) {
+   alignas(64) double lanes[8];
+   _mm512_store_pd ( lanes, x );
+   return ( (lanes[0] + lanes[4]) + (lanes[1] + lanes[5]) ) + ( (lanes[2] + lanes[6]) + (lanes[3] + lanes[7]) );
+}
+
+__attribute__((target("avx512f")))
+static double sqEuclideanAVX512 ( const double * a, const double * b, unsigned int n ) {
+   __m512d s0 = _mm512_setzero_pd();
+   unsigned int i = 0;
+   for ( ; i + 8 <= n; i += 8 ) {
+      __m512d x = _mm512_sub_pd ( _mm512_loadu_pd(a + i), _mm512_loadu_pd(b + i) );
+      s0 = _mm512_fmadd_pd ( x, x, s0 );
+   }
+   if ( i < n ) {
+      __mmask8 m = (__mmask8) ( (1u << (n - i)) - 1 );
+      __m512d x = _mm512_sub_pd ( _mm512_maskz_loadu_pd(m, a + i), _mm512_maskz_loadu_pd(m, b + i) );
+      s0 = _mm512_fmadd_pd ( x, x, s0 );
+   }
+   return hsum512 ( s0 );
+}
+
+__attribute__((target("avx512f")))
+static double manhattanAVX512 ( const double * a, const double * b, unsigned int n ) {
+   __m512d s0 = _mm512_setzero_pd();
+   unsigned int i = 0;
+   for ( ; i + 8 <= n; i += 8 ) {
+      __m512d x = _mm512_sub_pd ( _mm512_loadu_pd(a + i), _mm512_loadu_pd(b + i) );
+      s0 = _mm512_add_pd ( s0, _mm512_abs_pd(x) );
+   }
+   if ( i < n ) {
+      __mmask8 m = (__mmask8) ( (1u << (n - i)) - 1 );
+      __m512d x = _mm512_sub_pd ( _mm512_maskz_loadu_pd(m, a + i), _mm512_maskz_loadu_pd(m, b + i) );
+      s0 = _mm512_add_pd ( s0, _mm512_abs_pd(x) );
+   }
+   return hsum512 ( s0 );
+}
+
+// Single precision kernels: 8 (AVX2) or 16 (AVX-512) floats per register,
+// otherwise as the double precision ones
+
+__attribute__((target("avx2,fma")))
+static float hsum256F ( __m256 x ) {
+   __m128 h = _mm_add_ps ( _mm256_castps256_ps128(x), _mm256_extractf128_ps(x, 1) );
+   h = _mm_add_ps ( h, _mm_movehl_ps(h, h) );
+   return _mm_cvtss_f32 ( _mm_add_ss ( h, _mm_movehdup_ps(h) ) );
+}
+
+__attribute__((target("avx2,fma")))
+static float sqEuclideanAVX2F ( const float * a, const float * b, unsigned int n ) {
+   __m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps();
+   unsigned int i = 0;
+   for ( ; i + 16 <= n; i += 16 ) {
+      __m256 x0 = _mm256_sub_ps ( _mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i) );
+      __m256 x1 = _mm256_sub_ps ( _mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8) );
+      s0 = _mm256_fmadd_ps ( x0, x0, s0 );
+      s1 = _mm256_fmadd_ps ( x1, x1, s1 );
+   }
+   if ( i + 8 <= n ) {
+      __m256 x0 = _mm256_sub_ps ( _mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i) );
+      s0 = _mm256_fmadd_ps ( x0, x0, s0 );
+      i += 8;
+   }
+   float sum = hsum256F ( _mm256_add_ps ( s0, s1 ) );
+   for ( ; i < n; ++i ) { float x = a[i] - b[i]; sum += x * x; }
+   return sum;
+}
+
+__attribute__((target("avx2,fma")))
+static float manhattanAVX2F ( const float * a, const float * b, unsigned int n ) {
+   const __m256 signMask = _mm256_set1_ps ( -0.0f );
+   __m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps();
+   unsigned int i = 0;
+   for ( ; i + 16 <= n; i += 16 ) {
+      __m256 x0 = _mm256_sub_ps ( _mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i) );
+      __m256 x1 = _mm256_sub_ps ( _mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8) );
+      s0 = _mm256_add_ps ( s0, _mm256_andnot_ps(signMask, x0) );
+      s1 = _mm256_add_ps ( s1, _mm256_andnot_ps(signMask, x1) );
+   }
+   if ( i + 8 <= n ) {
+      __m256 x0 = _mm256_sub_ps ( _mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i) );
+      s0 = _mm256_add_ps ( s0, _mm256_andnot_ps(signMask, x0) );
+      i += 8;
+   }
+   float sum = hsum256F ( _mm256_add_ps ( s0, s1 ) );
+   for ( ; i < n; ++i ) sum += std::fabs ( a[i] - b[i] );
+   return sum;
+}
+
+__attribute__((target("avx512f")))
+static float hsum512F ( __m512 x ) {
+   alignas(64) float lanes[16];
+   _mm512_store_ps ( lanes, x );
+   __m128 h = _mm_add_ps ( _mm_add_ps ( _mm_load_ps(lanes), _mm_load_ps(lanes + 4) ),
+                           _mm_add_ps ( _mm_load_ps(lanes + 8), _mm_load_ps(lanes + 12) ) );
+   h = _mm_add_ps ( h, _mm_movehl_ps(h, h) );
+   return _mm_cvtss_f32 ( _mm_add_ss ( h, _mm_shuffle_ps(h, h, 1) ) );
+}
+
+__attribute__((target("avx512f")))
+static float sqEuclideanAVX512F ( const float * a, const float * b, unsigned int n ) {
+   __m512 s0 = _mm512_setzero_ps();
+   unsigned int i = 0;
+   for ( ; i + 16 <= n; i += 16 ) {
+      __m512 x = _mm512_sub_ps ( _mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i) );
+      s0 = _mm512_fmadd_ps ( x, x, s0 );
+   }
+   if ( i < n ) {
+      __mmask16 m = (__mmask16) ( (1u << (n - i)) - 1 );
+      __m512 x = _mm512_sub_ps ( _mm512_maskz_loadu_ps(m, a + i), _mm512_maskz_loadu_ps(m, b + i) );
+      s0 = _mm512_fmadd_ps ( x, x, s0 );
+   }
+   return hsum512F ( s0 );
+}
+
+__attribute__((target("avx512f")))
+static float manhattanAVX512F ( const float * a, const float * b, unsigned int n ) {
+   __m512 s0 = _mm512_setzero_ps();
+   unsigned int i = 0;
+   for ( ; i + 16 <= n; i += 16 ) {
+      __m512 x = _mm512_sub_ps ( _mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i) );
+      s0 = _mm512_add_ps ( s0, _mm512_abs_ps(x) );
+   }
+   if ( i < n ) {
+      __mmask16 m = (__mmask16) ( (1u << (n - i)) - 1 );
+      __m512 x = _mm512_sub_ps ( _mm512_maskz_loadu_ps(m, a + i), _mm512_maskz_loadu_ps(m, b + i) );
+      s0 = _mm512_add_ps ( s0, _mm512_abs_ps(x) );
+   }
+   return hsum512F ( s0 );
+}
+
+#endif
+
+distKernel sqEuclideanKernel = sqEuclideanScalar<double>;
+distKernel manhattanKernel = manhattanScalar<double>;
+distKernelF sqEuclideanKernelF = sqEuclideanScalar<float>;
+distKernelF manhattanKernelF = manhattanScalar<float>;
+dotsKernel blockedDotsKernel = blockedDotsScalar;
+static const char * kernelName = "scalar";
+
+bool setDistKernels ( const std::string & isa ) {
+   if ( isa == "scalar" ) {
+      sqEuclideanKernel = sqEuclideanScalar<double>;
+      manhattanKernel = manhattanScalar<double>;
+      sqEuclideanKernelF = sqEuclideanScalar<float>;
+      manhattanKernelF = manhattanScalar<float>;
+      blockedDotsKernel = blockedDotsScalar;
+      kernelName = "scalar";
+      return true;
+   }
+
+#ifdef DIST_X86
+   __builtin_cpu_init();
+
+   if ( isa == "avx2" && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") ) {
+      sqEuclideanKernel = sqEuclideanAVX2;
+      manhattanKernel = manhattanAVX2;
+      sqEuclideanKernelF = sqEuclideanAVX2F;
+      manhattanKernelF = manhattanAVX2F;
+      blockedDotsKernel = blockedDotsAVX2;
+      kernelName = "avx2";
+      return true;
+   }
+
+   if ( isa == "avx512" && __builtin_cpu_supports("avx512f") ) {
+      sqEuclideanKernel = sqEuclideanAVX512;
+      manhattanKernel = manhattanAVX512;
+      sqEuclideanKernelF = sqEuclideanAVX512F;
+      manhattanKernelF = manhattanAVX512F;
+      blockedDotsKernel = blockedDotsAVX512;
+      kernelName = "avx512";
+      return true;
+   }
+#endif
+
+   return false;
+}
+
+const char * getDistKernels ( void ) { return kernelName; }
+
+// Selects the best kernels at startup
+// The environment variable KMEANS_SIMD (scalar, avx2, avx512) can force a choice
+static bool initDistKernels ( void ) {
+   const char * forced = std::getenv ( "KMEANS_SIMD" );
+   if ( forced && setDistKernels ( forced ) ) return true;
+   return setDistKernels ( "avx512" ) || setDistKernels ( "avx2" ) || setDistKernels ( "scalar" );
+}
+
+static bool distKernelsInitialized = initDistKernels();
@@ -3,46 +3,179 @@
 
 #include "point.h"
 #include <cmath>
+#include <cstring>
+#include <string>
+
+// Distance classes
+// Each class has a member function dist computing the distance between two
+// points given as pointers to their n contiguous coordinates, in double or
+// single precision; an overload taking two points is provided as well, and a
+// member function template dist<D> for points whose dimension D is known at
+// compile time (the loop over the coordinates is then fully unrolled and
+// vectorized by the compiler)
+// Single precision distances are also accumulated in single precision, which
+// doubles the width of the vectorized loops
+// Each class also has a static member function metric, turning a value returned
+// by dist into a proper metric distance (one satisfying the triangle
+// inequality), which is monotone in it; solvers pruning distance computations
+// with bounds work on these values
+
+// Distance kernels
+// The kernels for the squared euclidean and manhattan distances come in a
+// portable version and in AVX2 and AVX-512 versions (see distance.cpp); the best
+// version supported by the CPU is selected at startup
+using distKernel = double (*) ( const double *, const double *, unsigned int );
+extern distKernel sqEuclideanKernel;
+extern distKernel manhattanKernel;
+
+using distKernelF = float (*) ( const float *, const float *, unsigned int );
+extern distKernelF sqEuclideanKernelF;
+extern distKernelF manhattanKernelF;
+
+// Dot products kernel of the blocked assignment (see assignment.h)
+// Computes the dot products of m points, given as rows of n coordinates, with
+// the centroids packed in npanels panels of dotsPanel centroids each (a panel
+// stores coordinate j of its centroids contiguously, at j*dotsPanel); the dot
+// product of point i with centroid c is written to out[i*ldo + c]
+constexpr unsigned int dotsPanel = 8;
+using dotsKernel = void (*) ( const double *, unsigned int, const double *, unsigned int, unsigned int, double *, unsigned int );
+extern dotsKernel blockedDotsKernel;
+
+// Selects the kernels for a given instruction set (scalar, avx2, avx512)
+// Returns false, leaving the kernels unchanged, if the CPU does not support it
+bool setDistKernels ( const std::string & );
+
+// Name of the instruction set of the selected kernels
+const char * getDistKernels ( void );
+
+// Below this dimension the kernels are not worth an indirect call, and an
+// inlined scalar loop is used instead
+constexpr unsigned int distKernelMinDim = 4;
+
+// x^p for a compile-time integer p, by repeated squaring
+template < int p, typename T >
+inline T ipow ( T x ) {
+   static_assert ( p >= 0, "ipow requires a non-negative exponent" );
+   return p % 2 ? x * ipow<p/2>(x*x) : ipow<p/2>(x*x);
+}
+
+template <> inline double ipow<0> ( double ) { return 1; }
+template <> inline float ipow<0> ( float ) { return 1; }
+
+// Vector of 4 floats, for the single precision loops of dist<D>
+typedef float floatLanes __attribute__ (( vector_size ( 16 ) ));
 
 // P-distance class
+// Computes the sum of |a_i - b_i|^p (i.e. the p-th power of the p-norm)
 template < int p >
 class dist_p {
+   private:
+   // Plain loop over n coordinates, in the precision of the coordinates
+   template < typename T >
+   static T sumOf ( const T * a, const T * b, unsigned int n ) {
+      T sum = 0;
+      for ( unsigned int i = 0; i < n; ++i )
+         sum += ipow<p> ( std::fabs(a[i] - b[i]) );
+      return sum;
+   }
+
+   // Loops over D coordinates, for dist<D>
+   // Double precision sums are accumulated sequentially and left to the
+   // compiler; single precision ones are split over vectors of 4 partial sums,
+   // which the compiler would not vectorize reliably on its own
+   template < unsigned int D >
+   static double sumOf ( const double * a, const double * b ) {
+      double sum = 0;
+      for ( unsigned int i = 0; i < D; ++i ) {
+         double x = a[i] - b[i];
+         sum += ipow<p> ( p % 2 ? std::fabs(x) : x );
+      }
+      return sum;
+   }
+
+   template < unsigned int D >
+   static double sumOf ( const float * a, const float * b ) {
+      floatLanes partial[2] = {};
+      unsigned int i = 0;
+      for ( ; i + 8 <= D; i += 8 )
+         for ( unsigned int l = 0; l < 2; ++l ) {
+            floatLanes x, y;
+            std::memcpy ( &x, a + i + 4*l, sizeof(x) );
+            std::memcpy ( &y, b + i + 4*l, sizeof(y) );
+            x -= y;
+            if ( p % 2 ) x = x < 0 ? -x : x;
+            floatLanes power = x;
+            for ( int e = 1; e < p; ++e ) power *= x;
+            partial[l] += power;
+         }
+      floatLanes lanes = partial[0] + partial[1];
+      float sum = ( lanes[0] + lanes[2] ) + ( lanes[1] + lanes[3] );
+      for ( ; i < D; ++i )
+         sum += ipow<p> ( std::fabs(a[i] - b[i]) );
+      return sum;
+   }
+
    public:
+   static double metric ( double sum ) { return p == 1 ? sum : ( p == 2 ? std::sqrt(sum) : std::pow(sum, 1.0/p) ); }
+
+   template < unsigned int D, typename T >
+   double dist ( const T * a, const T * b ) { return sumOf<D> ( a, b ); }
+
+   double dist ( const double * a, const double * b, unsigned int n ) { return sumOf ( a, b, n ); }
+   double dist ( const float * a, const float * b, unsigned int n ) { return sumOf ( a, b, n ); }
+
    double dist ( const point & a, const point & b ) {
       assert ( a.getN() == b.getN() );
+      return dist ( a.data(), b.data(), a.getN() );
+   }
+};
 
-      double sum = 0; double x = 0; double xp = 0;
-      for ( unsigned int i = 0; i < a.getN(); ++i ) {
-         x = abs(a[i] - b[i]);
+// Manhattan distance: vectorized kernels
+template <>
+inline double dist_p<1>::dist ( const double * a, const double * b, unsigned int n ) {
+   return n >= distKernelMinDim ? manhattanKernel ( a, b, n ) : sumOf ( a, b, n );
+}
 
-         xp = x;
-         for ( int pp = 1; pp < p; ++pp ) xp *= x;
+template <>
+inline double dist_p<1>::dist ( const float * a, const float * b, unsigned int n ) {
+   return n >= distKernelMinDim ? manhattanKernelF ( a, b, n ) : sumOf ( a, b, n );
+}
 
-         sum += xp;
-      }
+// Squared euclidean distance: vectorized kernels
+template <>
+inline double dist_p<2>::dist ( const double * a, const double * b, unsigned int n ) {
+   return n >= distKernelMinDim ? sqEuclideanKernel ( a, b, n ) : sumOf ( a, b, n );
+}
 
-      return sum;
-   }
-};
+template <>
+inline double dist_p<2>::dist ( const float * a, const float * b, unsigned int n ) {
+   return n >= distKernelMinDim ? sqEuclideanKernelF ( a, b, n ) : sumOf ( a, b, n );
+}
 
 // Relevant aliases
 using dist_manhattan = dist_p<1>;
 using dist_euclidean = dist_p<2>;
 
 // Minkowski distance class
+// Computes ( sum of |a_i - b_i|^p )^(1/p)
 template < int p >
-class dist_minkowski {
+class dist_minkowski : private dist_p<p> {
    public:
-   double dist ( const point & a, const point & b ) {
-      assert ( a.getN() == b.getN() );
+   static double metric ( double d ) { return d; }
 
-      double sum = 0; double x = 0;
-      for ( unsigned int i = 0; i < a.getN(); ++i ) {
-         x = abs(a[i] - b[i]);
-         sum += pow(x, 1.0/p);
-      }
+   template < unsigned int D, typename T >
+   double dist ( const T * a, const T * b ) {
+      return dist_p<p>::metric ( dist_p<p>::template dist<D> ( a, b ) );
+   }
 
-      return pow(sum, p);
+   template < typename T >
+   double dist ( const T * a, const T * b, unsigned int n ) {
+      return dist_p<p>::metric ( dist_p<p>::dist ( a, b, n ) );
+   }
+
+   double dist ( const point & a, const point & b ) {
+      assert ( a.getN() == b.getN() );
+      return dist ( a.data(), b.data(), a.getN() );
    }
 };
 
@@ -0,0 +1,104 @@
+#include "kdtree.h"
+
+#include <algorithm>
+#include <numeric>
+
+template < typename real >
+void kdTree<real>::build ( const basicDataset<real> & data ) {
+   n = data.getN();
+   nodes.clear();
+   lo.clear();
+   hi.clear();
+   sums.clear();
+
+   perm.resize ( data.size() );
+   std::iota ( perm.begin(), perm.end(), 0u );
+
+   // A balanced tree has less than 4 nodes every leafSize points
+   std::size_t expected = 4 * ( data.size() / leafSize + 1 );
+   nodes.reserve ( expected );
+   lo.reserve ( expected * n );
+   hi.reserve ( expected * n );
+   sums.reserve ( expected * n );
+
+   if ( !data.empty() ) buildNode ( data, 0, data.size() );
+}
+
+template < typename real >
+int kdTree<real>::buildNode ( const basicDataset<real> & data, unsigned int begin, unsigned int end ) {
+   int id = nodes.size();
+   node nd;
+   nd.begin = begin;
+   nd.end = end;
+   nodes.push_back ( nd );
+
+   // Bounding box and sum of the points of the node
+   std::size_t offset = std::size_t(id) * n;
+   lo.resize ( offset + n );
+   hi.resize ( offset + n );
+   sums.resize ( offset + n, 0 );
+
+   for ( unsigned int j = 0; j < n; ++j ) lo[offset + j] = hi[offset + j] = data ( perm[begin], j );
+
+   for ( unsigned int p = begin; p < end; ++p )
+      for ( unsigned int j = 0; j < n; ++j ) {
+         double x = data ( perm[p], j );
+         lo[offset + j] = std::min ( lo[offset + j], x );
+         hi[offset + j] = std::max ( hi[offset + j], x );
+         sums[offset + j] += x;
+      }
+
+   unsigned int widest = 0;
+   for ( unsigned int j = 1; j < n; ++j )
+      if ( hi[offset + j] - lo[offset + j] > hi[offset + widest] - lo[offset + widest] ) widest = j;
+
+   // Leaves, also when all the points coincide; their points are visited in
+   // the order of the dataset
+   if ( end - begin <= leafSize || hi[offset + widest] == lo[offset + widest] ) {
+      std::sort ( perm.begin() + begin, perm.begin() + end );
+      return id;
+   }
+
+   unsigned int mid = begin + ( end - begin ) / 2;
+   std::nth_element ( perm.begin() + begin, perm.begin() + mid, perm.begin() + end,
+      [&] ( unsigned int a, unsigned int b ) { return data ( a, widest ) < data ( b, widest ); } );
+
+   // Children are built first, as they may move the nodes
+   int left = buildNode ( data, begin, mid );
+   int right = buildNode ( data, mid, end );
+   nodes[id].left = left;
+   nodes[id].right = right;
+
+   return id;
+}
+
+template < typename real >
+std::vector<unsigned int> kdTree<real>::frontier ( unsigned int m ) const {
+   std::vector<unsigned int> roots;
+   if ( empty() ) return roots;
+
+   // Splits the largest subtree until there are enough of them, or only leaves
+   roots.push_back ( 0 );
+   while ( roots.size() < m ) {
+      auto largest = std::max_element ( roots.begin(), roots.end(), [this] ( unsigned int a, unsigned int b ) {
+         return ( nodes[a].isLeaf() ? 0 : nodes[a].count() ) < ( nodes[b].isLeaf() ? 0 : nodes[b].count() );
+      } );
+      if ( nodes[*largest].isLeaf() ) break;
+
+      const node & nd = nodes[*largest];
+      *largest = nd.left;
+      roots.push_back ( nd.right );
+   }
+
+   return roots;
+}
+
+template < typename real >
+std::size_t kdTree<real>::memoryFootprint ( void ) const {
+   return nodes.capacity() * sizeof(node) + perm.capacity() * sizeof(unsigned int)
+        + ( lo.capacity() + hi.capacity() + sums.capacity() ) * sizeof(double);
+}
+
+// Both precisions of the coordinates are compiled here
+template class kdTree<double>;
+template class kdTree<float>;
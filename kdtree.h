@@ -0,0 +1,68 @@
+#ifndef _KDTREE_H
+#define _KDTREE_H
+
+#include "dataset.h"
+
+#include <vector>
+
+// Kd-tree over the points of a dataset, for the filtering solver (see
+// kmeans_kdtree.h)
+// The tree holds a permutation of the indices of the points: each node covers a
+// contiguous range of it, and stores the bounding box of its points, their sum
+// and their count; inner nodes split their points in two halves at the median
+// of the widest side of their box. Points are referred to by their index in
+// the dataset, which is neither modified nor copied, and must outlive the tree
+template < typename real >
+class kdTree {
+public:
+   struct node {
+      // Range of the node in the permutation
+      unsigned int begin = 0, end = 0;
+
+      // Children, -1 for leaves
+      int left = -1, right = -1;
+
+      bool isLeaf ( void ) const { return left < 0; }
+      unsigned int count ( void ) const { return end - begin; }
+   };
+
+   // Maximum number of points of a leaf
+   static constexpr unsigned int leafSize = 16;
+
+   // Builds the tree over the points of a dataset, replacing the previous one
+   // The root is node 0; an empty dataset gives an empty tree
+   void build ( const basicDataset<real> & );
+
+   bool empty ( void ) const { return nodes.empty(); }
+   unsigned int size ( void ) const { return nodes.size(); }
+
+   const node & getNode ( unsigned int id ) const { return nodes[id]; }
+
+   // Index in the dataset of the p-th point of the permutation
+   unsigned int index ( unsigned int p ) const { return perm[p]; }
+
+   // Corners of the bounding box and sum of the points of a node
+   const double * lower ( unsigned int id ) const { return lo.data() + std::size_t(id) * n; }
+   const double * upper ( unsigned int id ) const { return hi.data() + std::size_t(id) * n; }
+   const double * sum ( unsigned int id ) const { return sums.data() + std::size_t(id) * n; }
+
+   // Roots of disjoint subtrees covering the whole tree, at least m of them
+   // unless there are fewer leaves, to split the visit among threads
+   std::vector<unsigned int> frontier ( unsigned int m ) const;
+
+   // Memory taken by the tree, in bytes
+   std::size_t memoryFootprint ( void ) const;
+
+private:
+   unsigned int n = 0;
+
+   std::vector<node> nodes;
+   std::vector<unsigned int> perm;
+   std::vector<double> lo, hi, sums;
+
+   // Builds the subtree over the range [begin, end) of the permutation,
+   // returning its root
+   int buildNode ( const basicDataset<real> &, unsigned int, unsigned int );
+};
+
+#endif
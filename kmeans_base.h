@@ -3,13 +3,22 @@
 
 #include <vector>
 #include <numeric>
+#include <cmath>
 #include <iostream>
 #include <cassert>
 #include <random>
 #include <algorithm>
+#include <memory>
+#include <type_traits>
 
 #include "point.h"
+#include "dataset.h"
 #include "distance.h"
+#include "thread_pool.h"
+#include "seeding.h"
+#include "assignment.h"
+#include "dataset_io.h"
+#include "profiler.h"
 
 struct kMeansStop {
    // Maximum iterations
@@ -25,18 +34,92 @@ struct kMeansStop {
    int minLabelChanges = 1;
 };
 
-typedef std::vector<point> kMeansDataset;
-std::istream& operator>> ( std::istream &, kMeansDataset & );
+// K-means solver interface
+// Common interface of all the solvers, whatever their distance and dimension
+// template parameters; see kMeansBase for the description of the functions
+class kMeansSolver {
+public:
+   virtual ~kMeansSolver ( void ) = default;
+
+   virtual void setStop ( int, double, int ) = 0;
+   virtual kMeansStop getStop ( void ) const = 0;
+
+   virtual std::size_t getDatasetFootprint ( void ) const = 0;
+   virtual unsigned int getN ( void ) const = 0;
+   virtual void setK ( unsigned int ) = 0;
+   virtual unsigned int getK ( void ) const = 0;
+   virtual unsigned int size ( void ) const = 0;
+   virtual unsigned int getIter ( void ) const = 0;
+   virtual void setThreads ( unsigned int ) = 0;
+   virtual unsigned int getThreads ( void ) const = 0;
+   virtual bool setPersistentReduction ( bool ) = 0;
+   virtual double getCommTime ( void ) const = 0;
+   virtual double getOverlapTime ( void ) const = 0;
+   virtual bool setRebalance ( double ) = 0;
+   virtual unsigned int getMigrations ( void ) const = 0;
+   virtual double getMigratedPoints ( void ) const = 0;
+   virtual double getSkippedDistances ( void ) const = 0;
+   virtual double getBuildTime ( void ) const = 0;
+   virtual void setSeed ( unsigned long ) = 0;
+   virtual void setStartCentroids ( const std::vector<double> & ) = 0;
+   virtual std::vector<double> splitCentroids ( void ) = 0;
+   virtual unsigned long getSeed ( void ) const = 0;
+   virtual void setInit ( kMeansInit ) = 0;
+   virtual kMeansInit getInit ( void ) const = 0;
+   virtual double getInitTime ( void ) const = 0;
+   virtual void setAssignment ( kMeansAssign ) = 0;
+   virtual kMeansAssign getAssignment ( void ) const = 0;
+   virtual void setProfiling ( bool ) = 0;
+   virtual profileSummary getProfile ( void ) const = 0;
+
+   virtual void solve ( void ) = 0;
+   virtual void setTrueLabels ( std::vector<int>::const_iterator, std::vector<int>::const_iterator, int = -1 ) = 0;
+   virtual double purity ( void ) const = 0;
+   virtual double inertia ( void ) = 0;
+   virtual void printOutput ( std::ostream&, resultsFormat = resultsFormat::octave ) const = 0;
+   virtual bool writeOutput ( const std::string &, resultsFormat = resultsFormat::octave ) const = 0;
+};
 
 // K-means solver base class
-// The template parameter is a type that has a member function dist that takes
-// two const point& parameters and computes the distance between the points,
-// according to the desired metric
-template<typename dist_type = dist_euclidean>
-class kMeansBase : public dist_type {
+// The first template parameter is a type that has a member function dist that
+// takes two pointers to the coordinates of two points and their dimension, and
+// computes the distance between the points, according to the desired metric.
+// It must also have a member function template dist<D> taking only the two
+// pointers, for points whose dimension D is known at compile time
+// The second template parameter is the dimension of the points, if known at
+// compile time, or 0 if it is only known at runtime; solvers specialized on the
+// dimension get fully unrolled loops over the coordinates
+// The third template parameter is the type of the coordinates of the dataset:
+// with float, the dataset takes half the memory and the distances between
+// points and centroids are computed in single precision, while the centroids
+// and the sums of the clusters are still kept in double precision (mixed
+// precision)
+template<typename dist_type = dist_euclidean, unsigned int D = 0, typename real = double>
+class kMeansBase : public kMeansSolver, public dist_type {
 protected:
    using dist_type::dist;
 
+   // Dimension of the points: a compile-time constant if D is not 0
+   unsigned int dim ( void ) const { return D ? D : n; }
+
+   // Distance between two points given as pointers to their coordinates, in
+   // the precision of the coordinates
+   template < typename T >
+   double distance ( const T * a, const T * b ) {
+      return D ? this->template dist<D> ( a, b ) : dist ( a, b, n );
+   }
+
+   // Metric distance corresponding to a value returned by distance
+   double metric ( double d ) const { return dist_type::metric ( d ); }
+
+   // True if the metric distance a is larger than b by more than rounding errors
+   // Bounds-based solvers prune a centroid only if one of its bounds is safely
+   // greater than the distance to the nearest centroid, so that rounding never
+   // makes them pick a different centroid than a full search would; the margin
+   // follows the precision of the distances from the points
+   static constexpr double roundingMargin = std::is_same<real, float>::value ? 1e-5 : 1e-9;
+   static bool safelyGreater ( double a, double b ) { return a * ( 1 - roundingMargin ) > b * ( 1 + roundingMargin ); }
+
    // Number of clusters we are looking for
    unsigned int k = 1;
 
@@ -44,112 +127,256 @@ protected:
    unsigned int n = 1;
 
    // Points of the data set
-   kMeansDataset dataset;
+   // Coordinates and labels are stored in a contiguous structure of arrays
+   basicDataset<real> dataset;
 
    // Centroids
    // Centroid for cluster of label 0 is centroids[0], etc...
    std::vector<point> centroids;
 
+   // Coordinates of the centroids in the precision of the dataset, as k rows
+   // of n coordinates, kept up to date by packCentroids; distances from the
+   // points are computed with these
+   std::vector<real, alignedAllocator<real>> centroidCoords;
+   const real * centroid ( unsigned int kk ) const { return centroidCoords.data() + std::size_t(kk) * dim(); }
+
    // Counts of the points assigned to each cluster
    std::vector<int> counts;
 
    // Iterations counter
    int iter = 0;
 
+   // Sums of the points in each cluster, as k rows of n coordinates
+   // The Lloyd solvers keep them up to date by recording the points that change
+   // label in sumsDiff (one array per thread, merged in thread order), and only
+   // rebuild them from the whole dataset every recomputeInterval updates, to
+   // bound the drift due to rounding
+   std::vector<double> sums;
+   std::vector<std::vector<double>> sumsDiff;
+   int recomputeInterval = 10;
+   int sinceRecompute = 0;
+
+   // Records that point x moved from cluster a to cluster b, on thread t
+   void moveSums ( unsigned int t, const real * x, int a, int b ) {
+      double * from = sumsDiff[t].data() + std::size_t(a) * dim();
+      double * to = sumsDiff[t].data() + std::size_t(b) * dim();
+      for ( unsigned int nn = 0; nn < dim(); ++nn ) {
+         from[nn] -= x[nn];
+         to[nn] += x[nn];
+      }
+   }
+
+   // Brings the sums up to date with the labels, applying the recorded moves if
+   // incremental is true, or rebuilding them otherwise (or when they are due),
+   // and clears the recorded moves
+   void updateSums ( bool incremental );
+
    // Stopping criterion
    kMeansStop stoppingCriterion;
 
+   // Threads used by the solver within the process
+   // Solvers that support threading split their loops over the dataset among
+   // the threads of the pool; the others ignore it
+   std::unique_ptr<threadPool> pool { new threadPool(1) };
+
+   // Seed of the random choices (initial labels or centers, batches)
+   unsigned long seed = 0;
+
+   // Centroids the next solve starts from, if given (see setStartCentroids)
+   std::vector<double> startCentroids;
+
+   // Power iterations searching the principal axis of a cluster in
+   // splitCentroids
+   unsigned int splitIterations = 8;
+
+   // Initialization method, and time spent in the last initialization (msec)
+   kMeansInit initMethod = kMeansInit::random;
+   double initTime = 0;
+
+   // Assignment method requested, and the one used by the last solve (see
+   // assignment.h); solvers that only search pairwise ignore the former
+   kMeansAssign assignMode = kMeansAssign::automatic;
+   kMeansAssign assignUsed = kMeansAssign::pairwise;
+
+   // Blocked assignment: assigner with the current centroids, and buffers of
+   // each thread
+   blockAssigner assigner;
+   std::vector<blockWorkspace> workspaces;
+
+   // Chooses the assignment method for a solve, from the requested one, the
+   // distance and the dimension; called by the solvers that support blocked
+   // assignment before their iterations
+   void prepareAssignment ( void );
+
+   // Packs the current centroids for the distance computations, and for the
+   // blocked assignment if used; called whenever the centroids change
+   void packCentroids ( void );
+
+   // Finds the nearest centroid of m points with the blocked assignment, on
+   // thread t, a tile at a time; index(b) is the index in the dataset of the
+   // b-th point, and f ( b, x, label, dist ) is called for each of them with its
+   // coordinates, the label of the nearest centroid and the distance from it
+   template < typename Index, typename F >
+   void nearestBlocked ( unsigned int t, unsigned int m, Index index, F f );
+
+   // Communicator of the processes sharing the dataset
+   // A single process for sequential solvers; parallel ones set their own
+   MPI_Comm comm = MPI_COMM_SELF;
+
+   // Measurements of the last solve, if profiling is enabled (see profiler.h)
+   solverProfile profile;
+
    // Protected constructor that allows derived classes to construct  without a
    // dataset
-   kMeansBase ( unsigned int nn ) : n(nn) { }
+   kMeansBase ( unsigned int nn ) : n(nn) { assert ( D == 0 || D == n ); }
 
 public:
-   // Constructor: requires the dimension of the points and the dataset, as a range
-   kMeansBase ( unsigned int, kMeansDataset::const_iterator, kMeansDataset::const_iterator );
+   // Constructor: requires the dataset, which is copied in the solver
+   kMeansBase ( const basicDataset<real> & data ) : n(data.getN()), dataset(data) { assert ( D == 0 || D == n ); }
 
    // Destructor
    virtual ~kMeansBase ( void ) = default;
 
    // Getter and setter for the stopping criterion
-   void setStop ( int maxIter, double minDispl, int minLabCh ) {
+   void setStop ( int maxIter, double minDispl, int minLabCh ) override {
       stoppingCriterion.maxIter = maxIter;
       stoppingCriterion.minCentroidDisplacement = minDispl;
       stoppingCriterion.minLabelChanges = minLabCh;
    }
-   kMeansStop getStop ( void ) const { return stoppingCriterion; }
+   kMeansStop getStop ( void ) const override { return stoppingCriterion; }
 
    // Miscellaneous getters and setters
-   const std::vector<point> & getDataset ( void ) const { return dataset; }
-   unsigned int getN ( void ) const { return n; }
-   void setK ( unsigned int );
-   unsigned int getK ( void ) const { return k; }
-   unsigned int size ( void ) const { return dataset.size(); }
-   unsigned int getIter ( void ) const { return iter; }
+   const basicDataset<real> & getDataset ( void ) const { return dataset; }
+   std::size_t getDatasetFootprint ( void ) const override { return dataset.memoryFootprint(); }
+   unsigned int getN ( void ) const override { return n; }
+   void setK ( unsigned int ) override;
+   unsigned int getK ( void ) const override { return k; }
+   unsigned int size ( void ) const override { return dataset.size(); }
+   unsigned int getIter ( void ) const override { return iter; }
+
+   // Number of threads get and set
+   void setThreads ( unsigned int t ) override { pool.reset ( new threadPool ( std::max ( 1u, t ) ) ); }
+   unsigned int getThreads ( void ) const override { return pool->size(); }
+
+   // Persistent reduction set (see allreduceBuffer) and communication time
+   // Solvers that do not communicate do not support the former, and spend no
+   // time in the latter
+   bool setPersistentReduction ( bool p ) override { return !p; }
+   double getCommTime ( void ) const override { return 0; }
+
+   // Time reductions spent in flight while the solver computed, in
+   // milliseconds, for solvers that overlap them with their computations
+   double getOverlapTime ( void ) const override { return 0; }
+
+   // Load imbalance threshold set (see kMeansParallelBase::rebalance), and
+   // migrations done in the last solve with the points they moved; solvers
+   // that do not redistribute their points only accept 0 (disabled)
+   bool setRebalance ( double r ) override { return r <= 0; }
+   unsigned int getMigrations ( void ) const override { return 0; }
+   double getMigratedPoints ( void ) const override { return 0; }
+
+   // Fraction of the point-centroid distances skipped in the last solve, with
+   // respect to computing all of them at each iteration; solvers that do not
+   // prune computations skip none
+   double getSkippedDistances ( void ) const override { return 0; }
+
+   // Time spent building auxiliary structures over the dataset before the
+   // iterations, in milliseconds; solvers that need none spend no time in it
+   double getBuildTime ( void ) const override { return 0; }
+
+   // Number of incremental updates of the sums of the clusters between two
+   // complete recomputations get and set
+   void setRecomputeInterval ( int r ) { recomputeInterval = std::max ( 1, r ); }
+   int getRecomputeInterval ( void ) const { return recomputeInterval; }
+
+   // Assignment method get and set (see assignment.h)
+   // After a solve, get returns the method actually used
+   void setAssignment ( kMeansAssign a ) override { assignMode = a; }
+   kMeansAssign getAssignment ( void ) const override { return assignUsed; }
+
+   // Seed of the random choices of the solver get and set
+   // Solvers with different seeds start from different initial clusterings; seed
+   // 0 is the default
+   void setSeed ( unsigned long s ) override { seed = s; }
+   unsigned long getSeed ( void ) const override { return seed; }
+
+   // Centroids the next solve starts from, instead of those of the
+   // initialization method, as k rows of n coordinates
+   void setStartCentroids ( const std::vector<double> & c ) override { startCentroids = c; }
+
+   // Centroids of the current clustering, with the cluster of highest inertia
+   // split in two along its principal axis, at the spread that splits a
+   // Gaussian best, as k + 1 rows of n coordinates: the new one is last
+   // A warm start for the solve with one more cluster; collective over comm
+   std::vector<double> splitCentroids ( void ) override;
+
+   // Initialization method get and set (see seeding.h)
+   void setInit ( kMeansInit init ) override { initMethod = init; }
+   kMeansInit getInit ( void ) const override { return initMethod; }
+   double getInitTime ( void ) const override { return initTime; }
+
+   // Profiling of the solves enable, and measurements of the last one
+   // aggregated over the processes of the solver (see profiler.h); the latter
+   // is collective over them
+   void setProfiling ( bool p ) override { profile.setEnabled ( p ); }
+   profileSummary getProfile ( void ) const override { return summarizeProfile ( profile, comm ); }
 
    // Solve function
-   virtual void solve ( void ) = 0;
+   virtual void solve ( void ) override = 0;
 
    // Assigns random labels to the points of the dataset
    // Must be called after k has been set
    virtual void randomize ( void );
 
+   // Sets the initial labels and centroids, with the chosen method
+   // With random initialization, points get random labels; with the seeding
+   // methods, or if start centroids were given, points get the label of the
+   // nearest center. In all cases the centroids are then computed from the
+   // labels
+   void initialize ( void );
+
    // Function to compute the centroids
    virtual void computeCentroids ( void ) = 0;
 
    // Set the true labels from a vector
-   virtual void setTrueLabels ( std::vector<int>::const_iterator, std::vector<int>::const_iterator, int = -1 );
+   virtual void setTrueLabels ( std::vector<int>::const_iterator, std::vector<int>::const_iterator, int = -1 ) override;
 
    // Compute and return the purity of the clustering
    // Each cluster is assigned to the true label that is most frequent in it, then
    // we sum up the assignments to that label. Purity is the fraction of points in
    // the dataset that were assigned to the corresponding "true" cluster
    // True labels need to be set for the function to work (use setTrueLabels for that...)
-   virtual double purity ( void ) const;
+   virtual double purity ( void ) const override;
 
-   // Output of the dataset on a stream
+   // Compute and return the inertia of the clustering, that is the sum of the
+   // squared distances of the points from the centroid of their cluster, over
+   // the whole dataset shared by the processes of comm
+   double inertia ( void ) override;
+
+   // Output of the results on a stream, or to a file
    // Output is made in an Octave/MatLab-like syntax to facilitate interaction
-   // with other scripts
-   virtual void printOutput ( std::ostream& ) const;
+   // with other scripts, with the labels and the coordinates of all the points,
+   // or in a compact binary format with the labels and the centroids only (see
+   // dataset_io.h)
+   virtual void printOutput ( std::ostream&, resultsFormat = resultsFormat::octave ) const override;
+
+   // Returns false if the file cannot be written
+   virtual bool writeOutput ( const std::string &, resultsFormat = resultsFormat::octave ) const override;
 };
 
 // Read a vector of integers from a stream
 // Used to read true labels from file
 std::istream& operator>> ( std::istream&, std::vector<int> & );
 
-std::istream& operator>> ( std::istream &in, kMeansDataset &km ) {
-   unsigned int i = 0;
-   unsigned int n = 0;
-   double tmp = 0;
-
-   in >> n;
-   point p ( n );
-
-   while ( in >> tmp ) {
-      p[i] = tmp;
-      if ( i == n - 1 ) {
-         km.push_back(p);
-         i = 0;
-      }
-      else i++;
-   }
-
-   return in;
-}
-
-template <typename dist_type>
-kMeansBase<dist_type>::kMeansBase ( unsigned int nn, kMeansDataset::const_iterator a, kMeansDataset::const_iterator b ) : n(nn) {
-   dataset.assign ( a, b );
-}
-
-template <typename dist_type>
-void kMeansBase<dist_type>::setK ( unsigned int kk ) {
+template <typename dist_type, unsigned int D, typename real>
+void kMeansBase<dist_type, D, real>::setK ( unsigned int kk ) {
    k = kk;
    centroids = std::vector<point> ( kk, point(n) );
    counts = std::vector<int> ( kk, 0 );
 }
 
-template <typename dist_type>
-void kMeansBase<dist_type>::randomize ( void ) {
+template <typename dist_type, unsigned int D, typename real>
+void kMeansBase<dist_type, D, real>::randomize ( void ) {
    std::default_random_engine eng;
    std::uniform_int_distribution<unsigned int> dist ( 0, k - 1 );
 
@@ -157,40 +384,297 @@ void kMeansBase<dist_type>::randomize ( void ) {
 
    for ( unsigned int i = 0; i < dataset.size(); i += 1 ) {
       eng.seed ( i * 1000 );
+      eng.discard ( seed );
       unsigned int lab = dist(eng);
-      dataset[i].setLabel ( lab );
+      dataset.setLabel ( i, lab );
       counts[lab]++;
    }
 }
 
-template <typename dist_type>
-void kMeansBase<dist_type>::setTrueLabels ( std::vector<int>::const_iterator a, std::vector<int>::const_iterator b, int offset ) {
+template <typename dist_type, unsigned int D, typename real>
+void kMeansBase<dist_type, D, real>::initialize ( void ) {
+   double start = MPI_Wtime();
+
+   profile.clear();
+   PROFILE_PHASE ( profile, initialization );
+
+   // Start centroids are used once
+   std::vector<real> centers;
+   if ( startCentroids.size() == std::size_t(k) * n ) centers.assign ( startCentroids.begin(), startCentroids.end() );
+   startCentroids.clear();
+
+   if ( centers.empty() && initMethod == kMeansInit::random ) randomize();
+
+   else {
+      if ( centers.empty() ) {
+         auto metricDist = [this] ( const real * a, const real * b ) { return metric ( distance ( a, b ) ); };
+         kMeansSeeder<decltype(metricDist), real> seeder ( dataset, metricDist, comm, *pool, seed + 1 );
+
+         centers = initMethod == kMeansInit::kmeansPlusPlus ? seeder.plusPlus ( k ) : seeder.parallel ( k );
+      }
+
+      // Each point gets the label of the nearest center
+      unsigned int threads = pool->size();
+      std::vector<std::vector<int>> threadCounts ( threads, std::vector<int>(k, 0) );
+
+      pool->run ( [&] ( unsigned int t ) {
+         unsigned int begin = 0, share = 0;
+         datasetPartition ( dataset.size(), t, threads, begin, share );
+         coordBuffer<D, real> buf ( n );
+
+         for ( unsigned int i = begin; i < begin + share; ++i ) {
+            const real * x = dataset.getPoint ( i, buf.data() );
+            double nearestDist = distance ( x, centers.data() );
+            int nearestLabel = 0;
+
+            for ( unsigned int kk = 1; kk < k; ++kk ) {
+               double d = distance ( x, centers.data() + std::size_t(kk) * n );
+               if ( d < nearestDist ) {
+                  nearestDist = d;
+                  nearestLabel = kk;
+               }
+            }
+
+            dataset.setLabel ( i, nearestLabel );
+            threadCounts[t][nearestLabel]++;
+         }
+      } );
+
+      counts = std::vector<int> ( k, 0 );
+      for ( unsigned int t = 0; t < threads; ++t )
+         for ( unsigned int kk = 0; kk < k; ++kk )
+            counts[kk] += threadCounts[t][kk];
+
+      // Centers are also the centroids of the clusters left empty
+      for ( unsigned int kk = 0; kk < k; ++kk )
+         centroids[kk] = point ( n, std::vector<double> ( centers.begin() + std::size_t(kk) * n, centers.begin() + std::size_t(kk+1) * n ) );
+   }
+
+   computeCentroids();
+   initTime = ( MPI_Wtime() - start ) * 1000;
+}
+
+template <typename dist_type, unsigned int D, typename real>
+std::vector<double> kMeansBase<dist_type, D, real>::splitCentroids ( void ) {
+   unsigned int threads = pool->size();
+
+   // Runs f ( t, label, x ) on each local point, split among the threads, then
+   // sums the size values of the threads in thread order, and across processes
+   auto accumulate = [&] ( std::size_t size, auto f ) {
+      std::vector<std::vector<double>> partial ( threads, std::vector<double> ( size, 0 ) );
+
+      pool->run ( [&] ( unsigned int t ) {
+         unsigned int begin = 0, share = 0;
+         datasetPartition ( dataset.size(), t, threads, begin, share );
+         coordBuffer<D, real> buf ( n );
+
+         for ( unsigned int i = begin; i < begin + share; ++i )
+            f ( partial[t].data(), dataset.getLabel(i), dataset.getPoint ( i, buf.data() ) );
+      } );
+
+      std::vector<double> result ( size, 0 );
+      for ( unsigned int t = 0; t < threads; ++t )
+         for ( std::size_t j = 0; j < size; ++j )
+            result[j] += partial[t][j];
+
+      MPI_Allreduce ( MPI_IN_PLACE, result.data(), size, MPI_DOUBLE, MPI_SUM, comm );
+      return result;
+   };
+
+   // Squared deviations from the centroid along each coordinate, for each
+   // cluster, followed by the sizes of the clusters
+   std::vector<double> deviations = accumulate ( std::size_t(k) * n + k, [&] ( double * s, int l, const real * x ) {
+      const double * c = centroids[l].data();
+      double * d = s + std::size_t(l) * n;
+      for ( unsigned int j = 0; j < n; ++j )
+         d[j] += ( x[j] - c[j] ) * ( x[j] - c[j] );
+      s[std::size_t(k) * n + l] += 1;
+   } );
+
+   unsigned int h = 0;
+   double highest = -1;
+   for ( unsigned int kk = 0; kk < k; ++kk ) {
+      double clusterInertia = std::accumulate ( deviations.begin() + std::size_t(kk) * n, deviations.begin() + std::size_t(kk+1) * n, 0.0 );
+      if ( clusterInertia > highest ) {
+         highest = clusterInertia;
+         h = kk;
+      }
+   }
+
+   // Principal axis of the cluster, by power iterations on its scatter matrix
+   // starting from its standard deviations
+   const double * c = centroids[h].data();
+   std::vector<double> axis ( n );
+   for ( unsigned int j = 0; j < n; ++j ) axis[j] = std::sqrt ( deviations[std::size_t(h) * n + j] );
+
+   double variance = 0;
+   for ( unsigned int it = 0; it < splitIterations; ++it ) {
+      double norm = std::sqrt ( std::inner_product ( axis.begin(), axis.end(), axis.begin(), 0.0 ) );
+      if ( norm == 0 ) break;
+      for ( auto & a : axis ) a /= norm;
+
+      std::vector<double> scatter = accumulate ( n, [&] ( double * s, int l, const real * x ) {
+         if ( unsigned(l) != h ) return;
+         double projection = 0;
+         for ( unsigned int j = 0; j < n; ++j ) projection += ( x[j] - c[j] ) * axis[j];
+         for ( unsigned int j = 0; j < n; ++j ) s[j] += ( x[j] - c[j] ) * projection;
+      } );
+
+      // Variance of the cluster along the current axis (Rayleigh quotient)
+      variance = std::inner_product ( axis.begin(), axis.end(), scatter.begin(), 0.0 ) / std::max ( 1.0, deviations[std::size_t(k) * n + h] );
+      axis.swap ( scatter );
+   }
+
+   double norm = std::sqrt ( std::inner_product ( axis.begin(), axis.end(), axis.begin(), 0.0 ) );
+
+   // The 2-means of a Gaussian are at sqrt(2/pi) standard deviations from its
+   // mean along its principal axis
+   double offset = std::sqrt ( 2 * variance / 3.141592653589793 );
+
+   std::vector<double> result ( std::size_t(k + 1) * n );
+   for ( unsigned int kk = 0; kk < k; ++kk )
+      std::copy ( centroids[kk].data(), centroids[kk].data() + n, result.begin() + std::size_t(kk) * n );
+
+   for ( unsigned int j = 0; j < n; ++j ) {
+      double shift = norm > 0 ? offset * axis[j] / norm : 0;
+      result[std::size_t(h) * n + j] = c[j] + shift;
+      result[std::size_t(k) * n + j] = c[j] - shift;
+   }
+
+   return result;
+}
+
+template <typename dist_type, unsigned int D, typename real>
+void kMeansBase<dist_type, D, real>::updateSums ( bool incremental ) {
+   unsigned int threads = pool->size();
+   std::size_t sumsSize = std::size_t(k) * dim();
+
+   if ( incremental && sinceRecompute < recomputeInterval && sums.size() == sumsSize && sumsDiff.size() == threads ) {
+      for ( unsigned int t = 0; t < threads; ++t )
+         for ( std::size_t j = 0; j < sumsSize; ++j )
+            sums[j] += sumsDiff[t][j];
+      ++sinceRecompute;
+   }
+
+   // The local portion is split among the threads, each of which accumulates
+   // in its own array of sums; these are then merged in thread order
+   else {
+      sumsDiff.resize ( threads );
+
+      pool->run ( [&] ( unsigned int t ) {
+         unsigned int begin = 0, share = 0;
+         datasetPartition ( dataset.size(), t, threads, begin, share );
+
+         std::vector<double> & s = sumsDiff[t];
+         s.assign ( sumsSize, 0 );
+         coordBuffer<D, real> buf ( n );
+
+         for ( unsigned int i = begin; i < begin + share; i++ ) {
+            unsigned int l = dataset.getLabel(i);
+            const real * x = dataset.getPoint ( i, buf.data() );
+            double * c = s.data() + std::size_t(l) * dim();
+            for ( unsigned int nn = 0; nn < dim(); ++nn )
+               c[nn] += x[nn];
+         }
+      } );
+
+      sums.assign ( sumsSize, 0 );
+      for ( unsigned int t = 0; t < threads; ++t )
+         for ( std::size_t j = 0; j < sumsSize; ++j )
+            sums[j] += sumsDiff[t][j];
+      sinceRecompute = 0;
+   }
+
+   for ( auto & d : sumsDiff ) d.assign ( sumsSize, 0 );
+}
+
+template <typename dist_type, unsigned int D, typename real>
+void kMeansBase<dist_type, D, real>::packCentroids ( void ) {
+   centroidCoords.resize ( std::size_t(k) * dim() );
+   for ( unsigned int kk = 0; kk < k; ++kk )
+      std::copy ( centroids[kk].data(), centroids[kk].data() + dim(), centroidCoords.begin() + std::size_t(kk) * dim() );
+
+   if ( assignUsed == kMeansAssign::blocked ) assigner.setCentroids ( centroids );
+}
+
+template <typename dist_type, unsigned int D, typename real>
+void kMeansBase<dist_type, D, real>::prepareAssignment ( void ) {
+   bool euclidean = std::is_same<dist_type, dist_euclidean>::value;
+
+   if ( !euclidean || assignMode == kMeansAssign::pairwise ) assignUsed = kMeansAssign::pairwise;
+   else if ( assignMode == kMeansAssign::blocked ) assignUsed = kMeansAssign::blocked;
+   else assignUsed = dim() >= blockedMinDim ? kMeansAssign::blocked : kMeansAssign::pairwise;
+
+   workspaces.resize ( pool->size() );
+   packCentroids();
+}
+
+template <typename dist_type, unsigned int D, typename real>
+template <typename Index, typename F>
+void kMeansBase<dist_type, D, real>::nearestBlocked ( unsigned int t, unsigned int m, Index index, F f ) {
+   blockWorkspace & ws = workspaces[t];
+   ws.tile.resize ( std::size_t(blockAssigner::tileSize) * n );
+   std::vector<real, alignedAllocator<real>> gathered ( std::size_t(blockAssigner::tileSize) * n );
+   auto exact = [this] ( const double * a, const double * b ) { return distance ( a, b ); };
+
+   for ( unsigned int b0 = 0; b0 < m; b0 += blockAssigner::tileSize ) {
+      unsigned int count = std::min ( blockAssigner::tileSize, m - b0 );
+
+      // Points that are consecutive rows of the dataset are used in place,
+      // the others are gathered in a buffer
+      bool contiguous = dataset.getLayout() == datasetLayout::rowMajor;
+      for ( unsigned int b = 1; b < count && contiguous; ++b )
+         contiguous = index ( b0 + b ) == index ( b0 ) + b;
+
+      const real * points = gathered.data();
+      if ( contiguous ) points = dataset.row ( index ( b0 ) );
+
+      else for ( unsigned int b = 0; b < count; ++b ) {
+         real * row = gathered.data() + std::size_t(b) * n;
+         const real * x = dataset.getPoint ( index ( b0 + b ), row );
+         if ( x != row ) std::copy ( x, x + n, row );
+      }
+
+      assigner.assign ( tileAsDouble ( points, std::size_t(count) * n, ws.tile.data() ), count, ws, exact );
+
+      for ( unsigned int b = 0; b < count; ++b )
+         f ( b0 + b, points + std::size_t(b) * n, ws.labels[b], ws.dists[b] );
+   }
+}
+
+template <typename dist_type, unsigned int D, typename real>
+void kMeansBase<dist_type, D, real>::setTrueLabels ( std::vector<int>::const_iterator a, std::vector<int>::const_iterator b, int offset ) {
    auto cur = a;
    for ( unsigned int i = 0; i < (b - a); ++i ) {
-      dataset[i].setTrueLabel ( (*cur) + offset );
+      dataset.setTrueLabel ( i, (*cur) + offset );
       cur++;
    }
 }
 
-template<typename dist_type>
-double kMeansBase<dist_type>::purity ( void ) const {
+template<typename dist_type, unsigned int D, typename real>
+double kMeansBase<dist_type, D, real>::purity ( void ) const {
    // True labels of the clusters
    std::vector<int> trueLabels ( k, -1 );
 
+   // Number of true labels, which may exceed the number of clusters
+   unsigned int labels = k;
+   for ( unsigned int i = 0; i < dataset.size(); ++i )
+      labels = std::max ( labels, unsigned(dataset.getTrueLabel(i) + 1) );
+
    // Counts of the labels assigned to each cluster
    // On the rows ( i.e. counts[i] ) we have the vector of the amounts of points
    // for each label assigned to the cluster i ( that is : counts[i][j] is the
    // number of points with true label j assigned to cluster i)
-   std::vector<std::vector<int>> counts ( k, std::vector<int>(k,0) );
+   std::vector<std::vector<int>> counts ( k, std::vector<int>(labels,0) );
 
    // Iterate through the whole dataset and compute the counts
    for ( unsigned int i = 0; i < dataset.size(); ++i )
-      counts[dataset[i].getLabel()][dataset[i].getTrueLabel()] += 1;
+      counts[dataset.getLabel(i)][dataset.getTrueLabel(i)] += 1;
 
    // Compute the true labels
    for ( unsigned int kk = 0; kk < k; ++kk ) {
       int maxIdx = 0, maxCount = counts[kk][0];
-      for ( unsigned int j = 1; j < k; ++j ) {
+      for ( unsigned int j = 1; j < labels; ++j ) {
          if ( counts[kk][j] > maxCount ) {
             maxCount = counts[kk][j];
             maxIdx = j;
@@ -204,21 +688,40 @@ double kMeansBase<dist_type>::purity ( void ) const {
    double result = 0;
 
    for ( unsigned int i = 0; i < dataset.size(); ++i )
-      if ( dataset[i].getTrueLabel() == trueLabels[dataset[i].getLabel()] ) result += 1;
+      if ( dataset.getTrueLabel(i) == trueLabels[dataset.getLabel(i)] ) result += 1;
 
    return result / dataset.size();
 }
 
-template<typename dist_type>
-void kMeansBase<dist_type>::printOutput ( std::ostream &out ) const {
-   out << "dim = " << n << ";\nclusters = " << k << ";\n";
-   out << "dataset = [ ";
+template<typename dist_type, unsigned int D, typename real>
+double kMeansBase<dist_type, D, real>::inertia ( void ) {
+   unsigned int threads = pool->size();
+   std::vector<double> sums ( threads, 0 );
 
-   unsigned int i = 0;
-   for ( ; i < size()-1; ++i )
-      out << dataset[i] << ";\n";
+   pool->run ( [&] ( unsigned int t ) {
+      unsigned int begin = 0, share = 0;
+      datasetPartition ( dataset.size(), t, threads, begin, share );
+      coordBuffer<D, real> buf ( n );
+
+      for ( unsigned int i = begin; i < begin + share; ++i ) {
+         double d = metric ( distance ( dataset.getPoint ( i, buf.data() ), centroid ( dataset.getLabel(i) ) ) );
+         sums[t] += d * d;
+      }
+   } );
+
+   double result = std::accumulate ( sums.begin(), sums.end(), 0.0 );
+   MPI_Allreduce ( MPI_IN_PLACE, &result, 1, MPI_DOUBLE, MPI_SUM, comm );
+   return result;
+}
+
+template<typename dist_type, unsigned int D, typename real>
+void kMeansBase<dist_type, D, real>::printOutput ( std::ostream &out, resultsFormat format ) const {
+   printResults ( out, format, dataset, 0, dataset.size(), centroids, MPI_COMM_SELF, *pool );
+}
 
-   out << dataset[i] << "];";
+template<typename dist_type, unsigned int D, typename real>
+bool kMeansBase<dist_type, D, real>::writeOutput ( const std::string & path, resultsFormat format ) const {
+   return writeResults ( path, format, dataset, 0, dataset.size(), centroids, MPI_COMM_SELF, *pool );
 }
 
 std::istream& operator>> ( std::istream &in, std::vector<int> & out ) {
@@ -0,0 +1,229 @@
+#ifndef _KMEANS_ELKAN_H
+#define _KMEANS_ELKAN_H
+
+#include "kmeans_parallel.h"
+
+#include <limits>
+
+// K-means algorithm accelerated with the triangle inequality (Elkan's algorithm)
+
+// Each point keeps an upper bound on its distance from the centroid of its
+// cluster, and a lower bound on its distance from every other centroid. Bounds
+// are moved by the displacement of the centroids at each iteration, and along
+// with the distances between the centroids they rule out most of the distance
+// computations of the assignment step, once the centroids settle down
+
+// Centroids are pruned only when the bounds exclude them beyond rounding errors
+// and ties are broken as in kMeansG, so the labels are the same as kMeansG's
+// The bounds take k+1 values per point, thus the method suits moderate k
+
+template<typename dist_type = dist_euclidean, unsigned int D = 0, typename real = double>
+class kMeansElkan : public kMeansParallelBase<dist_type, D, real> {
+private:
+   // Upper bounds (one per local point) and lower bounds (k per local point,
+   // the lower bound of point i from centroid kk being lower[i*k + kk])
+   std::vector<double> upper;
+   std::vector<double> lower;
+
+   // Fraction of distances skipped in the last solve
+   double skipped = 0;
+
+public:
+   kMeansElkan ( const basicDataset<real> & data, MPI_Comm comm = MPI_COMM_WORLD ) :
+      kMeansParallelBase<dist_type, D, real> ( data, comm ) { }
+
+   // Solve method
+   void solve ( void ) override;
+
+   double getSkippedDistances ( void ) const override { return skipped; }
+};
+
+template<typename dist_type, unsigned int D, typename real>
+void kMeansElkan<dist_type, D, real>::solve ( void ) {
+   this->iter = 0;
+
+   int changesCount = this->stoppingCriterion.minLabelChanges + 1;
+   double centroidDispl = this->stoppingCriterion.minCentroidDisplacement + 1;
+   std::vector<point> oldCentroids;
+
+   unsigned int k = this->k;
+   unsigned int share = this->dataset.size();
+   upper.assign ( share, 0 );
+   lower.assign ( std::size_t(share) * k, 0 );
+
+   // Distances between the centroids, and half the distance from each centroid
+   // to the nearest of the others
+   std::vector<double> centroidDist ( std::size_t(k) * k, 0 );
+   std::vector<double> halfNearest ( k, 0 );
+
+   // Displacement of the centroids at the last iteration
+   std::vector<double> drift ( k, 0 );
+
+   // Distances actually computed, and those a full search would compute
+   double computed = 0, total = 0;
+
+   this->initialize();
+
+   while ( (this->stoppingCriterion.maxIter <= 0 || this->iter < this->stoppingCriterion.maxIter)
+        && (this->stoppingCriterion.minLabelChanges <= 0 || changesCount >= this->stoppingCriterion.minLabelChanges)
+        && (this->stoppingCriterion.minCentroidDisplacement <= 0 || centroidDispl >= this->stoppingCriterion.minCentroidDisplacement) ) {
+
+      oldCentroids = this->centroids;
+      changesCount = 0;
+
+      for ( unsigned int a = 0; a < k; ++a ) {
+         halfNearest[a] = std::numeric_limits<double>::max();
+         for ( unsigned int c = 0; c < k; ++c ) {
+            if ( c == a ) continue;
+            double d = this->metric ( this->distance ( this->centroids[a].data(), this->centroids[c].data() ) );
+            centroidDist[a*k + c] = d;
+            halfNearest[a] = std::min ( halfNearest[a], d / 2 );
+         }
+      }
+
+      // Assigns each point to the group of the closest centroid
+      // As in kMeansG, the local portion is split among the threads, each of
+      // which counts the changes on its own
+      unsigned int threads = this->pool->size();
+      std::vector<int> threadChanges ( threads, 0 );
+      std::vector<double> threadComputed ( threads, 0 );
+      std::vector<std::vector<int>> threadCounts ( threads, std::vector<int>(k, 0) );
+
+      timer work;
+      work.start();
+
+      this->pool->run ( [&] ( unsigned int t ) {
+         unsigned int begin = 0, count = 0;
+         datasetPartition ( share, t, threads, begin, count );
+
+         // Buffer for the coordinates of a point, used if the dataset is not row-major
+         coordBuffer<D, real> buf ( this->n );
+         std::vector<int> & countsDiff = threadCounts[t];
+
+         for ( unsigned int i = begin; i < begin + count; ++i ) {
+            const real * x = this->dataset.getPoint ( i, buf.data() );
+            double * l = lower.data() + std::size_t(i) * k;
+            int oldLabel = this->dataset.getLabel(i);
+            int nearestLabel = oldLabel;
+
+            // At the first iteration all the distances are computed
+            if ( this->iter == 0 ) {
+               double nearestDist = 0;
+               for ( unsigned int kk = 0; kk < k; ++kk ) {
+                  double d = this->distance ( x, this->centroid ( kk ) );
+                  l[kk] = this->metric ( d );
+                  if ( kk == 0 || d < nearestDist ) {
+                     nearestDist = d;
+                     nearestLabel = kk;
+                  }
+               }
+               upper[i] = l[nearestLabel];
+               threadComputed[t] += k;
+            }
+
+            // Later, only the centroids the bounds do not rule out are checked
+            // The distance from the current centroid is computed (making the
+            // upper bound tight) only when some other centroid is not ruled out
+            // by the loose bound
+            else if ( !this->safelyGreater ( halfNearest[oldLabel], upper[i] ) ) {
+               double u = upper[i], nearestDist = 0;
+               bool tight = false;
+
+               for ( unsigned int kk = 0; kk < k; ++kk ) {
+                  if ( int(kk) == nearestLabel ) continue;
+
+                  auto ruledOut = [&] ( void ) {
+                     return this->safelyGreater ( l[kk], u )
+                         || this->safelyGreater ( centroidDist[nearestLabel*k + kk] / 2, u );
+                  };
+
+                  if ( ruledOut() ) continue;
+
+                  if ( !tight ) {
+                     nearestDist = this->distance ( x, this->centroid ( nearestLabel ) );
+                     u = l[nearestLabel] = this->metric ( nearestDist );
+                     tight = true;
+                     threadComputed[t] += 1;
+                     if ( ruledOut() ) continue;
+                  }
+
+                  double d = this->distance ( x, this->centroid ( kk ) );
+                  l[kk] = this->metric ( d );
+                  threadComputed[t] += 1;
+
+                  // Ties go to the lowest label, as in a full search
+                  if ( d < nearestDist || ( d == nearestDist && int(kk) < nearestLabel ) ) {
+                     nearestDist = d;
+                     nearestLabel = kk;
+                     u = l[kk];
+                  }
+               }
+
+               upper[i] = u;
+            }
+
+            if ( oldLabel != nearestLabel ) {
+               countsDiff[oldLabel] -= 1;
+               countsDiff[nearestLabel] += 1;
+               this->dataset.setLabel(i, nearestLabel);
+               this->moveSums ( t, x, oldLabel, nearestLabel );
+               threadChanges[t]++;
+            }
+         }
+      } );
+      work.stop();
+
+      for ( unsigned int t = 0; t < threads; ++t ) {
+         changesCount += threadChanges[t];
+         computed += threadComputed[t];
+         for ( unsigned int kk = 0; kk < k; ++kk )
+            this->counts[kk] += threadCounts[t][kk];
+      }
+      total += double(share) * k;
+
+      // Recomputes the centroids in the current configuration
+      // The count of changes is reduced along with the centroids
+      std::vector<double> changes = { double(changesCount) };
+      this->computeCentroids ( changes, true );
+      changesCount = changes[0];
+
+      // Bounds are moved by the displacement of the centroids
+      for ( unsigned int kk = 0; kk < k; ++kk )
+         drift[kk] = this->metric ( this->distance ( oldCentroids[kk].data(), this->centroids[kk].data() ) );
+
+      this->pool->run ( [&] ( unsigned int t ) {
+         unsigned int begin = 0, count = 0;
+         datasetPartition ( share, t, threads, begin, count );
+
+         for ( unsigned int i = begin; i < begin + count; ++i ) {
+            upper[i] += drift[this->dataset.getLabel(i)];
+            double * l = lower.data() + std::size_t(i) * k;
+            for ( unsigned int kk = 0; kk < k; ++kk )
+               l[kk] = std::max ( 0.0, l[kk] - drift[kk] );
+         }
+      } );
+
+      // Compute the max displacement of the centroids
+      if ( this->stoppingCriterion.minCentroidDisplacement > 0 ) {
+         centroidDispl = 0;
+         for ( unsigned kk = 0; kk < k; kk += 1 ) {
+            double displ = this->dist ( oldCentroids[kk], this->centroids[kk] );
+            if ( displ > centroidDispl ) centroidDispl = displ;
+         }
+         centroidDispl = sqrt(centroidDispl);
+      }
+
+      // The points may be moved to balance the work of the processes, along
+      // with their bounds
+      if ( this->rebalance ( work.getTime(), { { &upper, 1 }, { &lower, k } } ) ) share = this->dataset.size();
+
+      ++this->iter;
+   }
+
+   // Statistics on the skipped distances, over all the processes
+   double stats[2] = { computed, total };
+   MPI_Allreduce ( MPI_IN_PLACE, stats, 2, MPI_DOUBLE, MPI_SUM, this->comm );
+   skipped = stats[1] > 0 ? 1 - stats[0] / stats[1] : 0;
+}
+
+#endif
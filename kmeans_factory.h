@@ -0,0 +1,122 @@
+#ifndef _KMEANS_FACTORY_H
+#define _KMEANS_FACTORY_H
+
+// Construction of the solvers from the name of the method, shared by the
+// program and the benchmarks
+
+#include "kmeans_seq.h"
+#include "kmeans_g.h"
+#include "kmeans_sgd.h"
+#include "kmeans_elkan.h"
+#include "kmeans_hamerly.h"
+#include "kmeans_yinyang.h"
+#include "kmeans_kdtree.h"
+
+#include <string>
+
+// Whether a method is offered for points of dimension n: the kd-tree is meant
+// for low-dimensional data only
+inline bool methodApplies ( const std::string & method, unsigned int n ) {
+   return method != "kdtree" || n <= kdTreeMaxDim;
+}
+
+// Allocates and configures the solver for a method, specialized on the
+// dimension D of the points (0 means that the dimension is known at runtime)
+// and on the type of their coordinates; parallel solvers run on the processes
+// of the communicator
+// Returns nullptr if the method is unknown or not offered for the dataset
+template < unsigned int D, typename real >
+kMeansSolver * makeSolver ( const std::string & method, const basicDataset<real> & dataset, int batchSize, int staleness,
+                            MPI_Comm comm = MPI_COMM_WORLD ) {
+   using distance = dist_euclidean;
+   kMeansSolver * solver = nullptr;
+
+   // Sequential kMeans
+   if ( method == "sequential" ) {
+      solver = new kMeansSeq<distance, D, real> ( dataset );
+      solver->setStop ( -1, -1, 1 );
+   }
+
+   // Parallel kMeans
+   else if ( method == "kmeans" ) {
+      solver = new kMeansG<distance, D, real> ( dataset, comm );
+      solver->setStop ( -1, -1, 1 );
+   }
+
+   // Parallel kMeans accelerated with the triangle inequality, with k+1 bounds
+   // per point (Elkan) or 2 bounds per point (Hamerly)
+   else if ( method == "elkan" ) {
+      solver = new kMeansElkan<distance, D, real> ( dataset, comm );
+      solver->setStop ( -1, -1, 1 );
+   }
+
+   else if ( method == "hamerly" ) {
+      solver = new kMeansHamerly<distance, D, real> ( dataset, comm );
+      solver->setStop ( -1, -1, 1 );
+   }
+
+   // Parallel kMeans accelerated with one bound per group of centroids, for
+   // large numbers of clusters
+   else if ( method == "yinyang" ) {
+      solver = new kMeansYinyang<distance, D, real> ( dataset, comm );
+      solver->setStop ( -1, -1, 1 );
+   }
+
+   // Parallel kMeans over a kd-tree of each local portion, for low-dimensional
+   // data
+   else if ( method == "kdtree" && methodApplies ( method, dataset.getN() ) ) {
+      solver = new kMeansKDTree<distance, D, real> ( dataset, comm );
+      solver->setStop ( -1, -1, 1 );
+   }
+
+   // Stochastic gradient descent kMeans
+   else if ( method == "kmeansSGD" ) {
+      auto tmp = new kMeansSGD<distance, D, real> ( dataset, comm );
+
+      tmp->setBatchSize ( batchSize );
+      tmp->setStaleness ( staleness );
+      tmp->setStop ( -1, -1, 50 );
+
+      solver = tmp;
+   }
+
+   // Mini-batch kMeans, stopping on the smoothed inertia of the batches
+   else if ( method == "minibatch" ) {
+      auto tmp = new kMeansSGD<distance, D, real> ( dataset, comm );
+
+      tmp->setMiniBatch ( true );
+      tmp->setBatchSize ( batchSize );
+      tmp->setStaleness ( staleness );
+      tmp->setStop ( -1, -1, -1 );
+
+      solver = tmp;
+   }
+
+   return solver;
+}
+
+// Dimensions for which the solvers are specialized at compile time
+inline bool specializedDimension ( unsigned int n ) {
+   for ( unsigned int d : { 2, 3, 8, 10, 16, 20, 32 } )
+      if ( n == d ) return true;
+   return false;
+}
+
+// Picks the solver specialized on the dimension of the dataset, falling back to
+// the generic one for the other dimensions
+template < typename real >
+kMeansSolver * makeSolver ( const std::string & method, const basicDataset<real> & dataset, int batchSize, int staleness,
+                            MPI_Comm comm = MPI_COMM_WORLD ) {
+   switch ( dataset.getN() ) {
+      case 2:  return makeSolver<2, real>  ( method, dataset, batchSize, staleness, comm );
+      case 3:  return makeSolver<3, real>  ( method, dataset, batchSize, staleness, comm );
+      case 8:  return makeSolver<8, real>  ( method, dataset, batchSize, staleness, comm );
+      case 10: return makeSolver<10, real> ( method, dataset, batchSize, staleness, comm );
+      case 16: return makeSolver<16, real> ( method, dataset, batchSize, staleness, comm );
+      case 20: return makeSolver<20, real> ( method, dataset, batchSize, staleness, comm );
+      case 32: return makeSolver<32, real> ( method, dataset, batchSize, staleness, comm );
+      default: return makeSolver<0, real>  ( method, dataset, batchSize, staleness, comm );
+   }
+}
+
+#endif
@@ -4,75 +4,119 @@
 #include "kmeans_parallel.h"
 #include "timer.h"
 
-template<typename dist_type = dist_euclidean>
-class kMeansG : public kMeansParallelBase<dist_type> {
+template<typename dist_type = dist_euclidean, unsigned int D = 0, typename real = double>
+class kMeansG : public kMeansParallelBase<dist_type, D, real> {
 public:
-   kMeansG ( unsigned int nn, kMeansDataset::const_iterator a, kMeansDataset::const_iterator b ) :
-      kMeansParallelBase<dist_type> ( nn, a, b ) { }
+   kMeansG ( const basicDataset<real> & data, MPI_Comm comm = MPI_COMM_WORLD ) :
+      kMeansParallelBase<dist_type, D, real> ( data, comm ) { }
 
    // Solve method
    void solve ( void ) override;
 };
 
-template<typename dist_type>
-void kMeansG<dist_type>::solve ( void ) {
-   int size; MPI_Comm_size ( MPI_COMM_WORLD, &size );
-   int rank; MPI_Comm_rank ( MPI_COMM_WORLD, &rank );
-
+template<typename dist_type, unsigned int D, typename real>
+void kMeansG<dist_type, D, real>::solve ( void ) {
    this->iter = 0;
 
    int changesCount = this->stoppingCriterion.minLabelChanges + 1;
    double centroidDispl = this->stoppingCriterion.minCentroidDisplacement + 1;
    std::vector<point> oldCentroids;
 
-   this->randomize();
-   this->computeCentroids();
+   this->initialize();
+   this->prepareAssignment();
 
    while ( (this->stoppingCriterion.maxIter <= 0 || this->iter < this->stoppingCriterion.maxIter)
         && (this->stoppingCriterion.minLabelChanges <= 0 || changesCount >= this->stoppingCriterion.minLabelChanges)
         && (this->stoppingCriterion.minCentroidDisplacement <= 0 || centroidDispl >= this->stoppingCriterion.minCentroidDisplacement) ) {
 
+      PROFILE_ITERATION ( this->profile );
+
       if ( this->stoppingCriterion.minCentroidDisplacement > 0 )
         oldCentroids = this->centroids;
 
       changesCount = 0;
 
-      // Assigns each point to the group of the closest centroid. The changes to
-      // be made are initially stored in the vector changes, and are applied only
-      // later while broadcasting them to the other processes
+      // Assigns each point to the group of the closest centroid
+      // The local portion is split among the threads; each of them counts the
+      // changes of labels and of cluster sizes on its own, and the results are
+      // merged afterwards
+      unsigned int threads = this->pool->size();
+      std::vector<int> threadChanges ( threads, 0 );
+      std::vector<std::vector<int>> threadCounts ( threads, std::vector<int>(this->k, 0) );
+
+      timer work;
+      work.start();
+
+      {
+         PROFILE_PHASE ( this->profile, assignment );
+
+         this->pool->run ( [&] ( unsigned int t ) {
+            unsigned int begin = 0, share = 0;
+            datasetPartition ( this->dataset.size(), t, threads, begin, share );
+
+            // Buffer for the coordinates of a point, used if the dataset is not row-major
+            coordBuffer<D, real> buf ( this->n );
+            std::vector<int> & countsDiff = threadCounts[t];
+
+            auto relabel = [&] ( unsigned int i, const real * x, int nearestLabel ) {
+               int oldLabel = this->dataset.getLabel(i);
+               if ( oldLabel != nearestLabel ) {
+                  countsDiff[oldLabel] -= 1;
+                  countsDiff[nearestLabel] += 1;
+                  this->dataset.setLabel(i, nearestLabel);
+                  this->moveSums ( t, x, oldLabel, nearestLabel );
+                  threadChanges[t]++;
+               }
+            };
+
+            if ( this->assignUsed == kMeansAssign::blocked ) {
+               this->nearestBlocked ( t, share, [begin] ( unsigned int b ) { return begin + b; },
+                  [&] ( unsigned int b, const real * x, int nearestLabel, double ) { relabel ( begin + b, x, nearestLabel ); } );
+               return;
+            }
 
-      double nearestDist = 0, d = 0;
-      int nearestLabel = 0;
+            for ( unsigned int i = begin; i < begin + share; i += 1 ) {
+               const real * x = this->dataset.getPoint ( i, buf.data() );
+               double nearestDist = this->distance ( x, this->centroid ( 0 ) );
+               int nearestLabel = 0;
 
-      for ( unsigned int i = 0; i < this->dataset.size(); i += 1 ) {
-         nearestDist = this->dist ( this->dataset[i], this->centroids[0] );
-         nearestLabel = 0;
+               // Finding the nearest of the centroids
+               for ( unsigned int kk = 1; kk < this->k; ++kk ) {
+                  double d = this->distance ( x, this->centroid ( kk ) );
 
-         // Finding the nearest of the centroids
-         for ( unsigned int kk = 1; kk < this->k; ++kk ) {
-            d = this->dist ( this->dataset[i], this->centroids[kk] );
+                  if ( d < nearestDist ) {
+                     nearestDist = d;
+                     nearestLabel = kk;
+                  }
+               }
 
-            if ( d < nearestDist ) {
-               nearestDist = d;
-               nearestLabel = kk;
+               relabel ( i, x, nearestLabel );
             }
-         }
-
-         int oldLabel = this->dataset[i].getLabel();
-         if ( oldLabel != nearestLabel ) {
-            this->counts[oldLabel] -= 1;
-            this->counts[nearestLabel] += 1;
-            this->dataset[i].setLabel(nearestLabel);
-            changesCount++;
+         } );
+      }
+      work.stop();
+
+      {
+         PROFILE_PHASE ( this->profile, accumulation );
+         for ( unsigned int t = 0; t < threads; ++t ) {
+            changesCount += threadChanges[t];
+            for ( unsigned int kk = 0; kk < this->k; ++kk )
+               this->counts[kk] += threadCounts[t][kk];
          }
       }
 
+      PROFILE_COUNT ( this->profile, assigned, this->dataset.size() );
+      PROFILE_COUNT ( this->profile, changes, changesCount );
+
       // Recomputes the centroids in the current configuration
-      this->computeCentroids();
-      MPI_Allreduce ( MPI_IN_PLACE, &changesCount, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD );
+      // The count of changes is reduced along with the centroids
+      std::vector<double> changes = { double(changesCount) };
+      this->computeCentroids ( changes, true );
+      changesCount = changes[0];
 
       // Compute the max displacement of the centroids
       if ( this->stoppingCriterion.minCentroidDisplacement > 0 ) {
+         PROFILE_PHASE ( this->profile, stopping );
          centroidDispl = 0;
          for ( unsigned kk = 0; kk < this->k; kk += 1 ) {
             double displ = this->dist ( oldCentroids[kk], this->centroids[kk] );
@@ -81,6 +125,9 @@ void kMeansG<dist_type>::solve ( void ) {
          centroidDispl = sqrt(centroidDispl);
       }
 
+      // The points may be moved to balance the work of the processes
+      this->rebalance ( work.getTime() );
+
       ++this->iter;
    }
 
@@ -0,0 +1,213 @@
+#ifndef _KMEANS_HAMERLY_H
+#define _KMEANS_HAMERLY_H
+
+#include "kmeans_parallel.h"
+
+#include <limits>
+
+// K-means algorithm accelerated with the triangle inequality (Hamerly's algorithm)
+
+// Each point keeps an upper bound on its distance from the centroid of its
+// cluster, and a single lower bound on its distance from all the other
+// centroids. If the upper bound does not exceed the lower bound, or half the
+// distance from its centroid to the nearest other centroid, the point cannot
+// change cluster and is skipped; otherwise all the distances are computed
+// With only two bounds per point, the method suits low-dimensional data, where
+// computing a distance costs about as much as reading a bound
+
+// As in kMeansElkan, points are skipped only when the bounds rule out a change
+// beyond rounding errors, so the labels are the same as kMeansG's
+
+template<typename dist_type = dist_euclidean, unsigned int D = 0, typename real = double>
+class kMeansHamerly : public kMeansParallelBase<dist_type, D, real> {
+private:
+   // Upper and lower bounds, one each per local point
+   std::vector<double> upper;
+   std::vector<double> lower;
+
+   // Fraction of distances skipped in the last solve
+   double skipped = 0;
+
+public:
+   kMeansHamerly ( const basicDataset<real> & data, MPI_Comm comm = MPI_COMM_WORLD ) :
+      kMeansParallelBase<dist_type, D, real> ( data, comm ) { }
+
+   // Solve method
+   void solve ( void ) override;
+
+   double getSkippedDistances ( void ) const override { return skipped; }
+};
+
+template<typename dist_type, unsigned int D, typename real>
+void kMeansHamerly<dist_type, D, real>::solve ( void ) {
+   this->iter = 0;
+
+   int changesCount = this->stoppingCriterion.minLabelChanges + 1;
+   double centroidDispl = this->stoppingCriterion.minCentroidDisplacement + 1;
+   std::vector<point> oldCentroids;
+
+   unsigned int k = this->k;
+   unsigned int share = this->dataset.size();
+   upper.assign ( share, 0 );
+   lower.assign ( share, 0 );
+
+   // Half the distance from each centroid to the nearest of the others
+   std::vector<double> halfNearest ( k, 0 );
+
+   // Displacement of the centroids at the last iteration
+   std::vector<double> drift ( k, 0 );
+
+   // Distances actually computed, and those a full search would compute
+   double computed = 0, total = 0;
+
+   this->initialize();
+
+   while ( (this->stoppingCriterion.maxIter <= 0 || this->iter < this->stoppingCriterion.maxIter)
+        && (this->stoppingCriterion.minLabelChanges <= 0 || changesCount >= this->stoppingCriterion.minLabelChanges)
+        && (this->stoppingCriterion.minCentroidDisplacement <= 0 || centroidDispl >= this->stoppingCriterion.minCentroidDisplacement) ) {
+
+      oldCentroids = this->centroids;
+      changesCount = 0;
+
+      std::fill ( halfNearest.begin(), halfNearest.end(), std::numeric_limits<double>::max() );
+      for ( unsigned int a = 0; a < k; ++a ) {
+         for ( unsigned int c = a + 1; c < k; ++c ) {
+            double d = this->metric ( this->distance ( this->centroids[a].data(), this->centroids[c].data() ) ) / 2;
+            halfNearest[a] = std::min ( halfNearest[a], d );
+            halfNearest[c] = std::min ( halfNearest[c], d );
+         }
+      }
+
+      // Assigns each point to the group of the closest centroid
+      // As in kMeansG, the local portion is split among the threads, each of
+      // which counts the changes on its own
+      unsigned int threads = this->pool->size();
+      std::vector<int> threadChanges ( threads, 0 );
+      std::vector<double> threadComputed ( threads, 0 );
+      std::vector<std::vector<int>> threadCounts ( threads, std::vector<int>(k, 0) );
+
+      timer work;
+      work.start();
+
+      this->pool->run ( [&] ( unsigned int t ) {
+         unsigned int begin = 0, count = 0;
+         datasetPartition ( share, t, threads, begin, count );
+
+         // Buffer for the coordinates of a point, used if the dataset is not row-major
+         coordBuffer<D, real> buf ( this->n );
+         std::vector<int> & countsDiff = threadCounts[t];
+
+         for ( unsigned int i = begin; i < begin + count; ++i ) {
+            int oldLabel = this->dataset.getLabel(i);
+            const real * x = nullptr;
+            double oldDist = 0;
+
+            // After the first iteration, the bounds are checked first with the
+            // loose upper bound, then with the tight one
+            if ( this->iter > 0 ) {
+               double bound = std::max ( halfNearest[oldLabel], lower[i] );
+               if ( this->safelyGreater ( bound, upper[i] ) ) continue;
+
+               x = this->dataset.getPoint ( i, buf.data() );
+               oldDist = this->distance ( x, this->centroid ( oldLabel ) );
+               upper[i] = this->metric ( oldDist );
+               threadComputed[t] += 1;
+               if ( this->safelyGreater ( bound, upper[i] ) ) continue;
+            }
+
+            else x = this->dataset.getPoint ( i, buf.data() );
+
+            // Full search, as in kMeansG, keeping track of the second nearest
+            // centroid for the lower bound
+            double nearestDist = 0, secondDist = std::numeric_limits<double>::max();
+            int nearestLabel = 0;
+
+            for ( unsigned int kk = 0; kk < k; ++kk ) {
+               double d = 0;
+               if ( this->iter > 0 && int(kk) == oldLabel ) d = oldDist;
+               else {
+                  d = this->distance ( x, this->centroid ( kk ) );
+                  threadComputed[t] += 1;
+               }
+
+               if ( kk == 0 || d < nearestDist ) {
+                  if ( kk > 0 ) secondDist = nearestDist;
+                  nearestDist = d;
+                  nearestLabel = kk;
+               }
+               else if ( d < secondDist ) secondDist = d;
+            }
+
+            upper[i] = this->metric ( nearestDist );
+            lower[i] = k > 1 ? this->metric ( secondDist ) : std::numeric_limits<double>::max();
+
+            if ( oldLabel != nearestLabel ) {
+               countsDiff[oldLabel] -= 1;
+               countsDiff[nearestLabel] += 1;
+               this->dataset.setLabel(i, nearestLabel);
+               this->moveSums ( t, x, oldLabel, nearestLabel );
+               threadChanges[t]++;
+            }
+         }
+      } );
+      work.stop();
+
+      for ( unsigned int t = 0; t < threads; ++t ) {
+         changesCount += threadChanges[t];
+         computed += threadComputed[t];
+         for ( unsigned int kk = 0; kk < k; ++kk )
+            this->counts[kk] += threadCounts[t][kk];
+      }
+      total += double(share) * k;
+
+      // Recomputes the centroids in the current configuration
+      // The count of changes is reduced along with the centroids
+      std::vector<double> changes = { double(changesCount) };
+      this->computeCentroids ( changes, true );
+      changesCount = changes[0];
+
+      // Bounds are moved by the displacement of the centroids: the lower bound
+      // by the largest displacement among the other centroids
+      for ( unsigned int kk = 0; kk < k; ++kk )
+         drift[kk] = this->metric ( this->distance ( oldCentroids[kk].data(), this->centroids[kk].data() ) );
+
+      unsigned int maxDrift = std::max_element ( drift.begin(), drift.end() ) - drift.begin();
+      double otherDrift = 0;
+      for ( unsigned int kk = 0; kk < k; ++kk )
+         if ( kk != maxDrift ) otherDrift = std::max ( otherDrift, drift[kk] );
+
+      this->pool->run ( [&] ( unsigned int t ) {
+         unsigned int begin = 0, count = 0;
+         datasetPartition ( share, t, threads, begin, count );
+
+         for ( unsigned int i = begin; i < begin + count; ++i ) {
+            unsigned int l = this->dataset.getLabel(i);
+            upper[i] += drift[l];
+            lower[i] -= l == maxDrift ? otherDrift : drift[maxDrift];
+         }
+      } );
+
+      // Compute the max displacement of the centroids
+      if ( this->stoppingCriterion.minCentroidDisplacement > 0 ) {
+         centroidDispl = 0;
+         for ( unsigned kk = 0; kk < k; kk += 1 ) {
+            double displ = this->dist ( oldCentroids[kk], this->centroids[kk] );
+            if ( displ > centroidDispl ) centroidDispl = displ;
+         }
+         centroidDispl = sqrt(centroidDispl);
+      }
+
+      // The points may be moved to balance the work of the processes, along
+      // with their bounds
+      if ( this->rebalance ( work.getTime(), { { &upper, 1 }, { &lower, 1 } } ) ) share = this->dataset.size();
+
+      ++this->iter;
+   }
+
+   // Statistics on the skipped distances, over all the processes
+   double stats[2] = { computed, total };
+   MPI_Allreduce ( MPI_IN_PLACE, stats, 2, MPI_DOUBLE, MPI_SUM, this->comm );
+   skipped = stats[1] > 0 ? 1 - stats[0] / stats[1] : 0;
+}
+
+#endif
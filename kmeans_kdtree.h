@@ -0,0 +1,280 @@
+#ifndef _KMEANS_KDTREE_H
+#define _KMEANS_KDTREE_H
+
+#include "kmeans_parallel.h"
+#include "kdtree.h"
+
+#include <numeric>
+
+// K-means algorithm over a kd-tree of the points (filtering algorithm, Kanungo
+// et al.)
+
+// Each process builds a kd-tree over its portion of the dataset before the
+// iterations. At each iteration the tree is visited from the root with all the
+// centroids as candidates: at each node, the candidate nearest to the midpoint
+// of the box of the node is kept, and the others are dropped if they are
+// farther than it from the corner of the box lying furthest in their direction,
+// as then they are farther from all the points of the box. A node left with a
+// single candidate is assigned to it as a whole, using the sum and count of its
+// points cached in the tree; in leaves, the nearest of the remaining candidates
+// is searched for each point
+// Pruning is effective when the boxes are small compared to the distances
+// between the centroids, i.e. for low-dimensional data
+// Since the corner test holds for all the p-distances, this works with any
+// dist_p or dist_minkowski distance
+
+// As in kMeansElkan, candidates are dropped only when the test rules them out
+// beyond rounding errors, so the labels are the same as kMeansG's
+
+// Highest dimension the solver is offered for: it was measured against kMeansG
+// on 2 to 8 dimensions, and beyond them the boxes cost more distances than
+// they save
+constexpr unsigned int kdTreeMaxDim = 8;
+
+template<typename dist_type = dist_euclidean, unsigned int D = 0, typename real = double>
+class kMeansKDTree : public kMeansParallelBase<dist_type, D, real> {
+private:
+   kdTree<real> tree;
+
+   // Time spent building the tree, in milliseconds
+   double buildTime = 0;
+
+   // Fraction of distances skipped in the last solve
+   double skipped = 0;
+
+   // State of a thread visiting the tree: candidates of the nodes on the path
+   // from the root (see filter), buffers for a corner of a box and for the
+   // coordinates of a point, sums and count changes of the clusters, label
+   // changes and distances computed, to the points of the leaves as well as to
+   // the midpoints and corners of the boxes
+   struct visit {
+      std::vector<int> candidates;
+      std::vector<double> corner;
+      coordBuffer<D, real> buf;
+      std::vector<double> sums;
+      std::vector<int> countsDiff;
+      int changes = 0;
+      double computed = 0;
+
+      visit ( unsigned int n, unsigned int k ) : corner(n), buf(n), sums(std::size_t(k) * n, 0), countsDiff(k, 0) { }
+   };
+
+   // Visits the subtree of a node, whose candidates are the centroids listed in
+   // v.candidates from first to last (in increasing order of label)
+   void filter ( unsigned int, std::size_t, std::size_t, visit & );
+
+   // Gives label l to point i, and to all the points of a node
+   void relabel ( unsigned int, int, visit & );
+   void assignNode ( unsigned int, int, visit & );
+
+public:
+   kMeansKDTree ( const basicDataset<real> & data, MPI_Comm comm = MPI_COMM_WORLD ) :
+      kMeansParallelBase<dist_type, D, real> ( data, comm ) { }
+
+   // Solve method
+   void solve ( void ) override;
+
+   // Reported as 0 when the boxes cost more distances than they save
+   double getSkippedDistances ( void ) const override { return skipped; }
+   double getBuildTime ( void ) const override { return buildTime; }
+
+   // The tree is built once over the local points, which therefore do not move
+   bool setRebalance ( double r ) override { return r <= 0; }
+};
+
+template<typename dist_type, unsigned int D, typename real>
+void kMeansKDTree<dist_type, D, real>::relabel ( unsigned int i, int l, visit & v ) {
+   int oldLabel = this->dataset.getLabel(i);
+   if ( oldLabel != l ) {
+      v.countsDiff[oldLabel] -= 1;
+      v.countsDiff[l] += 1;
+      this->dataset.setLabel(i, l);
+      v.changes++;
+   }
+}
+
+template<typename dist_type, unsigned int D, typename real>
+void kMeansKDTree<dist_type, D, real>::assignNode ( unsigned int id, int l, visit & v ) {
+   const typename kdTree<real>::node & nd = tree.getNode ( id );
+   for ( unsigned int p = nd.begin; p < nd.end; ++p )
+      relabel ( tree.index(p), l, v );
+
+   const double * s = tree.sum ( id );
+   double * c = v.sums.data() + std::size_t(l) * this->dim();
+   for ( unsigned int nn = 0; nn < this->dim(); ++nn )
+      c[nn] += s[nn];
+}
+
+template<typename dist_type, unsigned int D, typename real>
+void kMeansKDTree<dist_type, D, real>::filter ( unsigned int id, std::size_t first, std::size_t last, visit & v ) {
+   const typename kdTree<real>::node & nd = tree.getNode ( id );
+   std::vector<int> & candidates = v.candidates;
+
+   if ( last - first == 1 ) {
+      assignNode ( id, candidates[first], v );
+      return;
+   }
+
+   // Leaves: nearest candidate of each point, as in kMeansG
+   if ( nd.isLeaf() ) {
+      for ( unsigned int p = nd.begin; p < nd.end; ++p ) {
+         unsigned int i = tree.index(p);
+         const real * x = this->dataset.getPoint ( i, v.buf.data() );
+
+         int nearestLabel = candidates[first];
+         double nearestDist = this->distance ( x, this->centroid ( nearestLabel ) );
+
+         for ( std::size_t c = first + 1; c < last; ++c ) {
+            double d = this->distance ( x, this->centroid ( candidates[c] ) );
+
+            if ( d < nearestDist ) {
+               nearestDist = d;
+               nearestLabel = candidates[c];
+            }
+         }
+
+         relabel ( i, nearestLabel, v );
+
+         double * s = v.sums.data() + std::size_t(nearestLabel) * this->dim();
+         for ( unsigned int nn = 0; nn < this->dim(); ++nn )
+            s[nn] += x[nn];
+      }
+
+      v.computed += double(nd.count()) * ( last - first );
+      return;
+   }
+
+   const double * lo = tree.lower ( id );
+   const double * hi = tree.upper ( id );
+   double * corner = v.corner.data();
+
+   // Candidate nearest to the midpoint of the box
+   for ( unsigned int nn = 0; nn < this->dim(); ++nn )
+      corner[nn] = ( lo[nn] + hi[nn] ) / 2;
+
+   int best = candidates[first];
+   double bestDist = this->distance ( corner, this->centroids[best].data() );
+   for ( std::size_t c = first + 1; c < last; ++c ) {
+      double d = this->distance ( corner, this->centroids[candidates[c]].data() );
+      if ( d < bestDist ) {
+         bestDist = d;
+         best = candidates[c];
+      }
+   }
+
+   // The candidates of the children are appended to those of the node, and
+   // removed when they have been visited
+   std::size_t top = candidates.size();
+   const double * b = this->centroids[best].data();
+
+   for ( std::size_t c = first; c < last; ++c ) {
+      int z = candidates[c];
+
+      if ( z != best ) {
+         const double * cz = this->centroids[z].data();
+         for ( unsigned int nn = 0; nn < this->dim(); ++nn )
+            corner[nn] = cz[nn] > b[nn] ? hi[nn] : lo[nn];
+
+         if ( this->safelyGreater ( this->metric ( this->distance ( corner, cz ) ), this->metric ( this->distance ( corner, b ) ) ) ) continue;
+      }
+
+      candidates.push_back ( z );
+   }
+
+   // Distances to the midpoint, and to the two corners of each candidate but
+   // the best one
+   v.computed += double(last - first) + 2 * double(last - first - 1);
+
+   std::size_t end = candidates.size();
+   filter ( nd.left, top, end, v );
+   filter ( nd.right, top, end, v );
+   candidates.resize ( top );
+}
+
+template<typename dist_type, unsigned int D, typename real>
+void kMeansKDTree<dist_type, D, real>::solve ( void ) {
+   this->iter = 0;
+
+   int changesCount = this->stoppingCriterion.minLabelChanges + 1;
+   double centroidDispl = this->stoppingCriterion.minCentroidDisplacement + 1;
+   std::vector<point> oldCentroids;
+
+   unsigned int k = this->k;
+   unsigned int share = this->dataset.size();
+
+   if ( tree.size() == 0 ) {
+      double start = MPI_Wtime();
+      tree.build ( this->dataset );
+      buildTime = ( MPI_Wtime() - start ) * 1000;
+   }
+
+   // Subtrees visited by the threads: several per thread, assigned cyclically,
+   // as their costs vary with the number of candidates left
+   unsigned int threads = this->pool->size();
+   std::vector<unsigned int> roots = tree.frontier ( threads > 1 ? 4 * threads : 1 );
+
+   // Distances actually computed, and those a full search would compute
+   double computed = 0, total = 0;
+
+   this->initialize();
+
+   // Sums of the clusters over the local points, rebuilt from the tree at each
+   // iteration
+   std::vector<double> localSums;
+
+   while ( (this->stoppingCriterion.maxIter <= 0 || this->iter < this->stoppingCriterion.maxIter)
+        && (this->stoppingCriterion.minLabelChanges <= 0 || changesCount >= this->stoppingCriterion.minLabelChanges)
+        && (this->stoppingCriterion.minCentroidDisplacement <= 0 || centroidDispl >= this->stoppingCriterion.minCentroidDisplacement) ) {
+
+      oldCentroids = this->centroids;
+      changesCount = 0;
+
+      std::vector<visit> visits ( threads, visit ( this->n, k ) );
+
+      this->pool->run ( [&] ( unsigned int t ) {
+         visit & v = visits[t];
+         for ( unsigned int r = t; r < roots.size(); r += threads ) {
+            v.candidates.resize ( k );
+            std::iota ( v.candidates.begin(), v.candidates.end(), 0 );
+            filter ( roots[r], 0, k, v );
+         }
+      } );
+
+      // The sums of the threads are merged in thread order
+      localSums.assign ( std::size_t(k) * this->dim(), 0 );
+      for ( unsigned int t = 0; t < threads; ++t ) {
+         changesCount += visits[t].changes;
+         computed += visits[t].computed;
+         for ( unsigned int kk = 0; kk < k; ++kk )
+            this->counts[kk] += visits[t].countsDiff[kk];
+         for ( std::size_t j = 0; j < localSums.size(); ++j )
+            localSums[j] += visits[t].sums[j];
+      }
+      total += double(share) * k;
+
+      // Recomputes the centroids in the current configuration
+      // The count of changes is reduced along with the centroids
+      std::vector<double> changes = { double(changesCount) };
+      this->reduceCentroids ( localSums, changes );
+      changesCount = changes[0];
+
+      // Compute the max displacement of the centroids
+      if ( this->stoppingCriterion.minCentroidDisplacement > 0 ) {
+         centroidDispl = 0;
+         for ( unsigned kk = 0; kk < k; kk += 1 ) {
+            double displ = this->dist ( oldCentroids[kk], this->centroids[kk] );
+            if ( displ > centroidDispl ) centroidDispl = displ;
+         }
+         centroidDispl = sqrt(centroidDispl);
+      }
+
+      ++this->iter;
+   }
+
+   // Statistics on the skipped distances, over all the processes
+   double stats[2] = { computed, total };
+   MPI_Allreduce ( MPI_IN_PLACE, stats, 2, MPI_DOUBLE, MPI_SUM, this->comm );
+   skipped = stats[1] > 0 ? std::max ( 0.0, 1 - stats[0] / stats[1] ) : 0;
+}
+
+#endif
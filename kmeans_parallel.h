@@ -2,49 +2,148 @@
 #define _KMEANS_PARALLEL_H
 
 #include "kmeans_base.h"
+#include "reduction.h"
 
 // Parallel k-means base class
 // Computations of base functions ( computeCentroids, randomize ) are done in
 // parallel. Each process is meant to store only a portion of the dataset.
 // Thus, the field counts contains only local counts of points in each cluster
-template<typename dist_type = dist_euclidean>
-class kMeansParallelBase : public kMeansBase<dist_type> {
+template<typename dist_type = dist_euclidean, unsigned int D = 0, typename real = double>
+class kMeansParallelBase : public kMeansBase<dist_type, D, real> {
 protected:
    // Info about the portion of dataset assigned to the process
    int datasetSize = 0; // Size of the complete dataset
    int datasetShare = 0; // Size of the local share of the dataset
    int datasetBegin = 0; // Index of the complete dataset where the local portion begins
+
+   // Global counts of points in each cluster, as of the last computeCentroids
+   std::vector<int> globalCounts;
+
+   // Buffer for the values reduced across processes at each iteration
+   allreduceBuffer reduction;
+
+   // Computes the centroids, also summing across processes the values in extra
+   // within the same collective; solvers use it to reduce all their
+   // per-iteration quantities at once
+   // If incremental is true, the local sums are only updated with the moves
+   // recorded since the last call (see moveSums), instead of being rebuilt
+   void computeCentroids ( std::vector<double> & extra, bool incremental = false );
+
+   // Computes the centroids as above, but from sums of the local points in each
+   // cluster that the solver computed itself (k rows of n coordinates), with the
+   // local counts; the sums kept from the labels are left untouched
+   void reduceCentroids ( const std::vector<double> & localSums, std::vector<double> & extra );
+
+   // Load balancing
+   // Processes may do different amounts of work on portions of the same size
+   // (pruning solvers skip more distances on some portions, nodes may differ),
+   // and the slowest one delays every reduction. Solvers call rebalance at the
+   // end of each iteration with the time spent on their local points: every
+   // rebalanceWindow iterations, if the slowest process took more than
+   // 1 + rebalanceThreshold times the mean, the portions are resized in
+   // proportion to the throughput measured on each process, and points are
+   // moved between neighbouring processes. Portions stay contiguous and in rank
+   // order, so that datasetBegin and datasetShare keep describing them
+   double rebalanceThreshold = 0; // Disabled if 0
+   unsigned int rebalanceWindow = 3;
+   double measuredTime = 0;
+   unsigned int measuredIters = 0;
+   bool migrated = false;
+   unsigned int migrations = 0;
+   double migratedPoints = 0;
+
+   // Per-point values of a solver (e.g. bounds), moved along with the points:
+   // those of local point i are (*values)[i*stride, (i+1)*stride)
+   struct pointValues {
+      std::vector<double> * values;
+      std::size_t stride;
+   };
+
+   // Called at the end of each iteration with the time spent on the local
+   // points, in milliseconds; returns true if the local portion changed, in
+   // which case the values are those of the new portion
+   // The first iteration of a solve, and the first after a migration, are not
+   // measured; collective
+   bool rebalance ( double, const std::vector<pointValues> & = {} );
+
+   // Moves the points so that process r holds [bounds[r], bounds[r+1]) of the
+   // complete dataset, with their labels, true labels and values, then
+   // recomputes the local counts and rebuilds the sums at the next update
+   void migrate ( const std::vector<unsigned int> &, const std::vector<pointValues> & = {} );
+
+private:
+   // Packs the local sums, the local counts and the extra values in the
+   // reduction buffer, in this order
+   void packReduction ( const std::vector<double> &, const std::vector<double> & );
+
+   // Sums the buffer across processes, then computes the centroids from the
+   // global sums and counts and copies back the extra values
+   void updateCentroids ( std::vector<double> & );
+
 public:
-   kMeansParallelBase ( unsigned int, kMeansDataset::const_iterator, kMeansDataset::const_iterator );
+   // Constructor: requires the complete dataset, of which only the local portion
+   // is copied in the solver, or the local portion only, if the dataset was read
+   // in a partitioned way (see dataset_io.h), and the communicator of the
+   // processes sharing it, which run the solver together
+   kMeansParallelBase ( const basicDataset<real> &, MPI_Comm = MPI_COMM_WORLD );
 
    void randomize ( void ) override;
-   void computeCentroids ( void ) override;
+   void computeCentroids ( void ) override { std::vector<double> none; computeCentroids ( none ); }
    double purity ( void ) const override;
 
    void setTrueLabels ( std::vector<int>::const_iterator, std::vector<int>::const_iterator, int = -1 ) override;
 
+   // Persistent reduction get and set (see allreduceBuffer)
+   bool setPersistentReduction ( bool p ) override { return reduction.setPersistent ( p ); }
+
+   // Time spent reducing values across processes, in milliseconds
+   double getCommTime ( void ) const override { return reduction.getCommTime(); }
+   double getOverlapTime ( void ) const override { return reduction.getOverlapTime(); }
+
+   // Load imbalance threshold set, and migrations of the last solve (see
+   // rebalance); the migrated points are summed over the processes that sent
+   // them
+   bool setRebalance ( double r ) override { rebalanceThreshold = std::max ( 0.0, r ); return true; }
+   unsigned int getMigrations ( void ) const override { return migrations; }
+   double getMigratedPoints ( void ) const override { return migratedPoints; }
+
    // We have to override here because the dataset is split across different processes.
-   // Output is done by process 0, which collects the results from other processes too
-   void printOutput ( std::ostream& ) const override;
+   // Printing is done by process 0 of the communicator, which collects the
+   // results from other processes too, while files are written by all the
+   // processes, each at the position of its portion
+   void printOutput ( std::ostream&, resultsFormat = resultsFormat::octave ) const override;
+   bool writeOutput ( const std::string &, resultsFormat = resultsFormat::octave ) const override;
 };
 
-template<typename dist_type>
-kMeansParallelBase<dist_type>::kMeansParallelBase ( unsigned int n, kMeansDataset::const_iterator a, kMeansDataset::const_iterator b )
-   : kMeansBase<dist_type> (n) {
-   int size; MPI_Comm_size ( MPI_COMM_WORLD, &size );
-   int rank; MPI_Comm_rank ( MPI_COMM_WORLD, &rank );
-
-   datasetSize = b - a;
-   int r = datasetSize % size;
+template<typename dist_type, unsigned int D, typename real>
+kMeansParallelBase<dist_type, D, real>::kMeansParallelBase ( const basicDataset<real> & data, MPI_Comm cc )
+   : kMeansBase<dist_type, D, real> ( data.getN() ), reduction ( cc ) {
+   this->comm = cc;
+   int size; MPI_Comm_size ( cc, &size );
+   int rank; MPI_Comm_rank ( cc, &rank );
+
+   // The dataset is already the local portion, read by this process only
+   if ( data.isPartition() ) {
+      datasetSize = data.getGlobalSize();
+      datasetShare = data.size();
+      datasetBegin = data.getGlobalBegin();
+      this->dataset = data;
+   }
 
-   datasetShare = datasetSize / size + ( rank < r );
-   datasetBegin = ( rank < r ? datasetShare * rank : (datasetShare + 1)*r + datasetShare*(rank - r) );
+   // The complete dataset is split evenly and the local portion is copied
+   else {
+      unsigned int begin = 0, share = 0;
+      datasetPartition ( data.size(), rank, size, begin, share );
 
-   this->dataset.assign ( a + datasetBegin, a + datasetBegin + datasetShare );
+      datasetSize = data.size();
+      datasetShare = share;
+      datasetBegin = begin;
+      this->dataset = data.slice ( datasetBegin, datasetBegin + datasetShare );
+   }
 }
 
-template<typename dist_type>
-void kMeansParallelBase<dist_type>::randomize ( void ) {
+template<typename dist_type, unsigned int D, typename real>
+void kMeansParallelBase<dist_type, D, real>::randomize ( void ) {
    std::default_random_engine eng;
    std::uniform_int_distribution<unsigned int> dist ( 0, this->k - 1 );
 
@@ -52,69 +151,243 @@ void kMeansParallelBase<dist_type>::randomize ( void ) {
 
    for ( unsigned int i = 0; i < this->dataset.size(); i += 1 ) {
       eng.seed ( (i + datasetBegin) * 1000 );
+      eng.discard ( this->seed );
       unsigned int lab = dist(eng);
-      this->dataset[i].setLabel ( lab );
+      this->dataset.setLabel ( i, lab );
       this->counts[lab]++;
    }
 }
 
-template<typename dist_type>
-void kMeansParallelBase<dist_type>::computeCentroids ( void ) {
-   int size; MPI_Comm_size ( MPI_COMM_WORLD, &size );
-   int rank; MPI_Comm_rank ( MPI_COMM_WORLD, &rank );
-
+template<typename dist_type, unsigned int D, typename real>
+void kMeansParallelBase<dist_type, D, real>::computeCentroids ( std::vector<double> & extra, bool incremental ) {
    // Centroids are computed in parallel
-   // Each process accumulates, for each cluster, the sum of the points in that
+   // Each process keeps, for each cluster, the sum of the points in that
    // cluster and their amount, over a portion of the whole dataset
-   // Partial results are then gathered by process 0, who computes the average
-   // and assign the result to the centroids member
+   // Partial results are then summed across processes, and each process
+   // computes the average and assigns the result to the centroids member
+   {
+      PROFILE_PHASE ( this->profile, accumulation );
+      this->updateSums ( incremental );
+      packReduction ( this->sums, extra );
+   }
+
+   updateCentroids ( extra );
+}
+
+template<typename dist_type, unsigned int D, typename real>
+void kMeansParallelBase<dist_type, D, real>::reduceCentroids ( const std::vector<double> & localSums, std::vector<double> & extra ) {
+   {
+      PROFILE_PHASE ( this->profile, accumulation );
+      packReduction ( localSums, extra );
+   }
+
+   updateCentroids ( extra );
+}
+
+template<typename dist_type, unsigned int D, typename real>
+void kMeansParallelBase<dist_type, D, real>::packReduction ( const std::vector<double> & localSums, const std::vector<double> & extra ) {
+   // Local sums, cluster counts and extra values are summed across processes
+   // with one collective
+   std::size_t sumsSize = std::size_t(this->k) * this->dim();
+   reduction.reset ( sumsSize + this->k + extra.size() );
+
+   std::copy ( localSums.begin(), localSums.end(), reduction.data() );
+
+   for ( unsigned int kk = 0; kk < this->k; ++kk )
+      reduction[sumsSize + kk] = this->counts[kk];
+
+   std::copy ( extra.begin(), extra.end(), reduction.data() + sumsSize + this->k );
+}
 
-   this->centroids = std::vector<point> ( this->k, point(this->n) );
+template<typename dist_type, unsigned int D, typename real>
+void kMeansParallelBase<dist_type, D, real>::updateCentroids ( std::vector<double> & extra ) {
+   std::size_t sumsSize = std::size_t(this->k) * this->dim();
 
-   // Each process computes the local sums
-   for ( unsigned int i = 0; i < this->dataset.size(); i++ ) {
-      unsigned int l = this->dataset[i].getLabel();
-      for ( unsigned int nn = 0; nn < this->n; ++nn )
-         this->centroids[l][nn] += this->dataset[i][nn];
+   {
+      PROFILE_PHASE ( this->profile, reduction );
+      reduction.reduce();
    }
 
-   // Cluster counts are collected across processes
-   std::vector<int> allcounts ( this->k, 0 );
-   MPI_Allreduce ( this->counts.data(), allcounts.data(), this->k, MPI_INT, MPI_SUM, MPI_COMM_WORLD );
+   PROFILE_COUNT ( this->profile, reduced, reduction.size() );
+   PROFILE_PHASE ( this->profile, update );
 
-   // Partial sums are collected and the average is calculated
+   // The average is calculated from the global sums and counts
+   // Clusters left empty keep their previous centroid
+   globalCounts.resize ( this->k );
    for ( unsigned int kk = 0; kk < this->k; ++kk ) {
-      mpi_point_allreduce ( &this->centroids[kk] );
-      this->centroids[kk] = this->centroids[kk] / allcounts[kk];
+      globalCounts[kk] = reduction[sumsSize + kk];
+      if ( globalCounts[kk] == 0 ) continue;
+
+      double * c = this->centroids[kk].data();
+      const double * sum = reduction.data() + std::size_t(kk) * this->dim();
+      for ( unsigned int nn = 0; nn < this->dim(); ++nn )
+         c[nn] = sum[nn] / globalCounts[kk];
    }
+
+   std::copy ( reduction.data() + sumsSize + this->k, reduction.data() + reduction.size(), extra.begin() );
+   this->packCentroids();
 }
 
-template<typename dist_type>
-double kMeansParallelBase<dist_type>::purity ( void ) const {
-   int size; MPI_Comm_size ( MPI_COMM_WORLD, &size );
-   int rank; MPI_Comm_rank ( MPI_COMM_WORLD, &rank );
+template<typename dist_type, unsigned int D, typename real>
+bool kMeansParallelBase<dist_type, D, real>::rebalance ( double time, const std::vector<pointValues> & values ) {
+   if ( rebalanceThreshold <= 0 ) return false;
+
+   // Counters are reset at the start of each solve
+   if ( this->iter == 0 ) {
+      migrations = 0;
+      migratedPoints = 0;
+      migrated = true;
+   }
+
+   // The iteration after a migration is spent warming up the new points
+   if ( migrated ) {
+      migrated = false;
+      measuredTime = 0;
+      measuredIters = 0;
+      return false;
+   }
 
+   measuredTime += time;
+   if ( ++measuredIters < rebalanceWindow ) return false;
+
+   int size; MPI_Comm_size ( this->comm, &size );
+
+   std::vector<double> times ( size );
+   std::vector<int> shares ( size );
+   MPI_Allgather ( &measuredTime, 1, MPI_DOUBLE, times.data(), 1, MPI_DOUBLE, this->comm );
+   MPI_Allgather ( &datasetShare, 1, MPI_INT, shares.data(), 1, MPI_INT, this->comm );
+   measuredTime = 0;
+   measuredIters = 0;
+
+   double slowest = *std::max_element ( times.begin(), times.end() ), mean = 0;
+   for ( double t : times ) mean += t / size;
+   if ( mean <= 0 || slowest <= ( 1 + rebalanceThreshold ) * mean ) return false;
+
+   // Throughput of each process, in points per millisecond; processes with no
+   // points, or too fast to be measured, are given the mean of the others
+   std::vector<double> weights ( size, 0 );
+   double total = 0;
+   int measured = 0;
+   for ( int r = 0; r < size; ++r ) {
+      if ( shares[r] == 0 || times[r] <= 0 ) continue;
+      weights[r] = shares[r] / times[r];
+      total += weights[r];
+      ++measured;
+   }
+   if ( measured == 0 ) return false;
+   for ( auto & w : weights ) if ( w == 0 ) w = total / measured;
+
+   // Boundaries are moved halfway to those following the throughput, which
+   // damps the oscillations due to noise in the measurements
+   std::vector<unsigned int> bounds = weightedPartition ( datasetSize, weights );
+   unsigned int current = 0;
+   for ( int r = 0; r < size; ++r ) {
+      bounds[r] = ( uint64_t(bounds[r]) + current ) / 2;
+      current += shares[r];
+   }
+
+   migrate ( bounds, values );
+   return true;
+}
+
+template<typename dist_type, unsigned int D, typename real>
+void kMeansParallelBase<dist_type, D, real>::migrate ( const std::vector<unsigned int> & bounds, const std::vector<pointValues> & values ) {
+   int size; MPI_Comm_size ( this->comm, &size );
+   int rank; MPI_Comm_rank ( this->comm, &rank );
+
+   std::vector<int> shares ( size );
+   MPI_Allgather ( &datasetShare, 1, MPI_INT, shares.data(), 1, MPI_INT, this->comm );
+
+   std::vector<unsigned int> current ( size + 1, 0 );
+   for ( int r = 0; r < size; ++r ) current[r+1] = current[r] + shares[r];
+
+   // Points sent to process r are those of the local portion in its new one,
+   // and points received from it those of its portion in the new local one;
+   // counts and displacements are in points
+   std::vector<int> sendCounts ( size, 0 ), sendDispls ( size, 0 ), recvCounts ( size, 0 ), recvDispls ( size, 0 );
+   for ( int r = 0; r < size; ++r ) {
+      unsigned int a = std::max ( current[rank], bounds[r] ), b = std::min ( current[rank+1], bounds[r+1] );
+      if ( a < b ) { sendCounts[r] = b - a; sendDispls[r] = a - current[rank]; }
+
+      a = std::max ( current[r], bounds[rank] ); b = std::min ( current[r+1], bounds[rank+1] );
+      if ( a < b ) { recvCounts[r] = b - a; recvDispls[r] = a - bounds[rank]; }
+   }
+
+   unsigned int share = bounds[rank+1] - bounds[rank];
+   double sent = datasetShare - sendCounts[rank];
+
+   // Exchanges blocks of width values of the given type per point
+   auto exchange = [&] ( const void * send, void * recv, MPI_Datatype type, int width ) {
+      MPI_Datatype block;
+      MPI_Type_contiguous ( width, type, &block );
+      MPI_Type_commit ( &block );
+      MPI_Alltoallv ( send, sendCounts.data(), sendDispls.data(), block,
+                      recv, recvCounts.data(), recvDispls.data(), block, this->comm );
+      MPI_Type_free ( &block );
+   };
+
+   // Points are exchanged as rows, and the layout is restored afterwards
+   datasetLayout layout = this->dataset.getLayout();
+   if ( layout != datasetLayout::rowMajor ) this->dataset.setLayout ( datasetLayout::rowMajor );
+
+   basicDataset<real> moved ( this->n, share );
+   exchange ( this->dataset.data(), moved.data(), mpiDatatype<real>(), this->n );
+   exchange ( this->dataset.labelData(), moved.labelData(), MPI_INT, 1 );
+   exchange ( this->dataset.trueLabelData(), moved.trueLabelData(), MPI_INT, 1 );
+
+   for ( const auto & v : values ) {
+      std::vector<double> received ( share * v.stride );
+      exchange ( v.values->data(), received.data(), MPI_DOUBLE, v.stride );
+      v.values->swap ( received );
+   }
+
+   if ( layout != datasetLayout::rowMajor ) moved.setLayout ( layout );
+   this->dataset = std::move ( moved );
+
+   datasetBegin = bounds[rank];
+   datasetShare = share;
+
+   this->counts.assign ( this->k, 0 );
+   for ( unsigned int i = 0; i < share; ++i )
+      this->counts[this->dataset.getLabel(i)] += 1;
+   this->sinceRecompute = this->recomputeInterval;
+
+   MPI_Allreduce ( MPI_IN_PLACE, &sent, 1, MPI_DOUBLE, MPI_SUM, this->comm );
+   migratedPoints += sent;
+   ++migrations;
+   migrated = true;
+}
+
+template<typename dist_type, unsigned int D, typename real>
+double kMeansParallelBase<dist_type, D, real>::purity ( void ) const {
    // True labels of the clusters
    std::vector<int> trueLabels ( this->k, -1 );
 
+   // Number of true labels over all the processes, which may exceed the number
+   // of clusters
+   unsigned int labels = this->k;
+   for ( unsigned int i = 0; i < this->dataset.size(); ++i )
+      labels = std::max ( labels, unsigned(this->dataset.getTrueLabel(i) + 1) );
+   MPI_Allreduce ( MPI_IN_PLACE, &labels, 1, MPI_UNSIGNED, MPI_MAX, this->comm );
+
    // Counts of the labels assigned to each cluster
-   // counts[i*k + j] = n means that the cluster i has n elements with label j
-   std::vector<int> counts ( this->k * this->k, 0 );
+   // counts[i*labels + j] = n means that the cluster i has n elements with label j
+   std::vector<int> counts ( this->k * labels, 0 );
 
    // Iterate through the whole dataset and compute the counts
-   for ( const auto & i : this->dataset ) {
-      counts[ i.getLabel()*this->k + i.getTrueLabel() ] += 1;
+   for ( unsigned int i = 0; i < this->dataset.size(); ++i ) {
+      counts[ this->dataset.getLabel(i)*labels + this->dataset.getTrueLabel(i) ] += 1;
    }
 
-   MPI_Allreduce ( MPI_IN_PLACE, counts.data(), this->k * this->k, MPI_INT, MPI_SUM, MPI_COMM_WORLD );
+   MPI_Allreduce ( MPI_IN_PLACE, counts.data(), this->k * labels, MPI_INT, MPI_SUM, this->comm );
 
    // Compute the true labels
    for ( unsigned int kk = 0; kk < this->k; ++kk ) {
-      int maxIdx = 0, maxCount = counts[kk * this->k];
+      int maxIdx = 0, maxCount = counts[kk * labels];
 
-      for ( unsigned int j = 1; j < this->k; ++j ) {
-         if ( counts[kk * this->k + j] > maxCount ) {
-            maxCount = counts[kk * this->k + j];
+      for ( unsigned int j = 1; j < labels; ++j ) {
+         if ( counts[kk * labels + j] > maxCount ) {
+            maxCount = counts[kk * labels + j];
             maxIdx = j;
          }
       }
@@ -126,57 +399,26 @@ double kMeansParallelBase<dist_type>::purity ( void ) const {
    int result = 0;
 
    for ( unsigned int i = 0; i < this->dataset.size(); ++i )
-      if ( this->dataset[i].getTrueLabel() == trueLabels[this->dataset[i].getLabel()] ) result += 1;
+      if ( this->dataset.getTrueLabel(i) == trueLabels[this->dataset.getLabel(i)] ) result += 1;
 
-   MPI_Allreduce ( MPI_IN_PLACE, &result, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD );
+   MPI_Allreduce ( MPI_IN_PLACE, &result, 1, MPI_INT, MPI_SUM, this->comm );
 
    return result / double(datasetSize);
 }
 
-template<typename dist_type>
-void kMeansParallelBase<dist_type>::setTrueLabels ( std::vector<int>::const_iterator a, std::vector<int>::const_iterator b, int offset ) {
-   kMeansBase<dist_type>::setTrueLabels ( a + datasetBegin, a + datasetBegin + datasetShare, offset );
+template<typename dist_type, unsigned int D, typename real>
+void kMeansParallelBase<dist_type, D, real>::setTrueLabels ( std::vector<int>::const_iterator a, std::vector<int>::const_iterator b, int offset ) {
+   kMeansBase<dist_type, D, real>::setTrueLabels ( a + datasetBegin, a + datasetBegin + datasetShare, offset );
 }
 
-template<typename dist_type>
-void kMeansParallelBase<dist_type>::printOutput ( std::ostream &out ) const {
-   int size; MPI_Comm_size ( MPI_COMM_WORLD, &size );
-   int rank; MPI_Comm_rank ( MPI_COMM_WORLD, &rank );
-
-   // Process 0 receives the data from the others and prints it
-   if ( rank == 0 ) {
-      // General info about the dataset
-      out << "dim = " << this->n << ";\nclusters = " << this->k << ";\n";
-      out << "dataset = [ " << this->dataset[0];
-
-      // Print process 0's own portion of dataset
-      unsigned int i = 1;
-      for ( ; i < this->size(); ++i )
-         out << ";\n" << this->dataset[i];
-
-      // Receive and print the others' portions
-      for ( int proc = 1; proc < size; ++proc ) {
-         // First receive the number of points of that process ...
-         int share = 0;
-         MPI_Recv ( &share, 1, MPI_INT, proc, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE );
-
-         // ... then receive and print the actual points
-         for ( int i = 0; i < share; ++i )
-            out << ";\n" << mpi_point_recv ( proc, this->n );
-      }
-
-      out << "];";
-   }
-
-   // Other processes just send the result to rank 0
-   // First they send the local share of points, then they send the actual points
-   else {
-      int share = datasetShare;
-      MPI_Send ( &share, 1, MPI_INT, 0, 0, MPI_COMM_WORLD );
+template<typename dist_type, unsigned int D, typename real>
+void kMeansParallelBase<dist_type, D, real>::printOutput ( std::ostream &out, resultsFormat format ) const {
+   printResults ( out, format, this->dataset, datasetBegin, datasetSize, this->centroids, this->comm, *this->pool );
+}
 
-      for ( int i = 0; i < share; ++i )
-         mpi_point_send ( 0, this->dataset[i] );
-   }
+template<typename dist_type, unsigned int D, typename real>
+bool kMeansParallelBase<dist_type, D, real>::writeOutput ( const std::string & path, resultsFormat format ) const {
+   return writeResults ( path, format, this->dataset, datasetBegin, datasetSize, this->centroids, this->comm, *this->pool );
 }
 
 #endif
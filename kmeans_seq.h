@@ -5,34 +5,48 @@
 
 // The class performs classic kmeans algorithm without parallelization
 // Used for timing reference
-template<typename dist_type = dist_euclidean>
-class kMeansSeq : public kMeansBase<dist_type> {
+template<typename dist_type = dist_euclidean, unsigned int D = 0, typename real = double>
+class kMeansSeq : public kMeansBase<dist_type, D, real> {
 public:
-   kMeansSeq ( unsigned int nn, kMeansDataset::const_iterator a, kMeansDataset::const_iterator b ) :
-      kMeansBase<dist_type> ( nn, a, b ) { }
+   kMeansSeq ( const basicDataset<real> & data ) :
+      kMeansBase<dist_type, D, real> ( data ) { }
 
    // Randomize and compute centroids are overridden to be without parallelization
    // Function to recompute the centroids
-   void computeCentroids ( void ) override;
+   // If incremental is true, the sums are only updated with the moves recorded
+   // since the last call (see moveSums), instead of being rebuilt
+   void computeCentroids ( void ) override { computeCentroids ( false ); }
+   void computeCentroids ( bool incremental );
 
    // Solve method
    void solve ( void ) override;
 };
 
-template<typename dist_type>
-void kMeansSeq<dist_type>::computeCentroids ( void ) {
-   this->centroids = std::vector<point> ( this->k, point(this->n) );
+template<typename dist_type, unsigned int D, typename real>
+void kMeansSeq<dist_type, D, real>::computeCentroids ( bool incremental ) {
+   {
+      PROFILE_PHASE ( this->profile, accumulation );
+      this->updateSums ( incremental );
+   }
+
+   PROFILE_PHASE ( this->profile, update );
+
+   // Clusters left empty keep their previous centroid
+   for ( unsigned int kk = 0; kk < this->k; ++kk ) {
+      if ( this->counts[kk] == 0 ) continue;
 
-   for ( auto & i : this->dataset ) {
-      int lab = i.getLabel();
-      for ( unsigned int nn = 0; nn < this->n; ++nn )
-         this->centroids[lab][nn] += i[nn] / this->counts[lab];
+      double * c = this->centroids[kk].data();
+      const double * sum = this->sums.data() + std::size_t(kk) * this->dim();
+      for ( unsigned int nn = 0; nn < this->dim(); ++nn )
+         c[nn] = sum[nn] / this->counts[kk];
    }
+
+   this->packCentroids();
 }
 
-template<typename dist_type>
-void kMeansSeq<dist_type>::solve ( void ) {
-   this->randomize();
+template<typename dist_type, unsigned int D, typename real>
+void kMeansSeq<dist_type, D, real>::solve ( void ) {
+   this->initialize();
 
    this->iter = 0;
 
@@ -41,46 +55,69 @@ void kMeansSeq<dist_type>::solve ( void ) {
    double centroidDispl = this->stoppingCriterion.minCentroidDisplacement + 1;
    std::vector<point> oldCentroids;
 
-   this->computeCentroids();
+   // Buffer for the coordinates of a point, used if the dataset is not row-major
+   coordBuffer<D, real> buf ( this->n );
+
+   this->prepareAssignment();
 
    while ( (this->stoppingCriterion.maxIter <= 0 || this->iter < this->stoppingCriterion.maxIter)
         && (this->stoppingCriterion.minLabelChanges <= 0 || changes >= this->stoppingCriterion.minLabelChanges)
         && (this->stoppingCriterion.minCentroidDisplacement <= 0 || centroidDispl >= this->stoppingCriterion.minCentroidDisplacement) ) {
 
+      PROFILE_ITERATION ( this->profile );
+
       if ( this->stoppingCriterion.minCentroidDisplacement > 0 )
          oldCentroids = this->centroids;
 
       changes = 0;
 
-      // Assigns each point to the group of the closest centroid
-      for ( unsigned int i = 0; i < this->dataset.size(); i++ ) {
-         double nearestDist = this->dist ( this->dataset[i], this->centroids[0] );
-         int nearestLabel = 0;
-
-         for ( unsigned int kk = 1; kk < this->k; ++kk ) {
-            double d = this->dist ( this->dataset[i], this->centroids[kk] );
-
-            if ( d < nearestDist ) {
-               nearestDist = d;
-               nearestLabel = kk;
-            }
-         }
-
-         int oldLabel = this->dataset[i].getLabel();
+      auto relabel = [&] ( unsigned int i, const real * x, int nearestLabel ) {
+         int oldLabel = this->dataset.getLabel(i);
          if ( oldLabel != nearestLabel ) {
             changes++;
             this->counts[oldLabel]--;
             this->counts[nearestLabel]++;
-            this->dataset[i].setLabel(nearestLabel);
+            this->dataset.setLabel(i, nearestLabel);
+            this->moveSums ( 0, x, oldLabel, nearestLabel );
          }
+      };
+
+      // Assigns each point to the group of the closest centroid
+      // Label changes are recorded on the fly, and are part of the assignment
+      {
+         PROFILE_PHASE ( this->profile, assignment );
+
+         if ( this->assignUsed == kMeansAssign::blocked )
+            this->nearestBlocked ( 0, this->dataset.size(), [] ( unsigned int i ) { return i; },
+               [&] ( unsigned int i, const real * x, int nearestLabel, double ) { relabel ( i, x, nearestLabel ); } );
+
+         else for ( unsigned int i = 0; i < this->dataset.size(); i++ ) {
+            const real * x = this->dataset.getPoint ( i, buf.data() );
+            double nearestDist = this->distance ( x, this->centroid ( 0 ) );
+            int nearestLabel = 0;
+
+            for ( unsigned int kk = 1; kk < this->k; ++kk ) {
+               double d = this->distance ( x, this->centroid ( kk ) );
+
+               if ( d < nearestDist ) {
+                  nearestDist = d;
+                  nearestLabel = kk;
+               }
+            }
 
+            relabel ( i, x, nearestLabel );
+         }
       }
 
+      PROFILE_COUNT ( this->profile, assigned, this->dataset.size() );
+      PROFILE_COUNT ( this->profile, changes, changes );
+
       // Computes the centroids in the current configuration
-      this->computeCentroids();
+      this->computeCentroids ( true );
 
       // Compute the max displacement of the centroids
       if ( this->stoppingCriterion.minCentroidDisplacement > 0 ) {
+         PROFILE_PHASE ( this->profile, stopping );
          centroidDispl = 0;
          for ( unsigned kk = 0; kk < this->k; ++kk ) {
             double displ = this->dist ( oldCentroids[kk], this->centroids[kk] );
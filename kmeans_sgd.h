@@ -4,6 +4,8 @@
 #include "kmeans_parallel.h"
 #include "timer.h"
 
+#include <limits>
+
 // K-Means algorithm using stochastic gradient descent
 
 // At each iteration, we pick a random point from the dataset, we compute its
@@ -12,28 +14,106 @@
 
 // Iterations stop when there are no more changes in the centroids
 
-template<typename dist_type = dist_euclidean>
-class kMeansSGD : public kMeansParallelBase<dist_type> {
+// In mini-batch mode, the points of each batch are instead drawn without
+// replacement, going through the dataset in an order shuffled at each epoch,
+// and they move the centroids towards them with a learning rate that decays
+// with the number of points each centroid has been updated with (mini-batch
+// k-means, Sculley 2010). Labels are only assigned to the whole dataset at the
+// end, and iterations stop when the inertia of the batches, smoothed over the
+// last ones, has not improved for a number of batches
+
+// Both modes can be pipelined: the reduction of each batch is started without
+// waiting for it, and the next batches are drawn and assigned while it is in
+// flight, against centroids that lack the updates of at most staleness batches
+// Updates are still applied in the order of the batches, and all processes
+// apply the same ones, so they always agree on the centroids
+
+template<typename dist_type = dist_euclidean, unsigned int D = 0, typename real = double>
+class kMeansSGD : public kMeansParallelBase<dist_type, D, real> {
 private:
    // Batch size
    // Each process will sample batchSize/nproc elements from its portion of the
    // dataset at each iteration
    int batchSize = 20;
+
+   // Mini-batch mode, and number of batches without improvement of the
+   // smoothed inertia after which it stops
+   bool miniBatch = false;
+   int patience = 10;
+
+   // Maximum number of batches whose reductions are in flight while the next
+   // one is assigned (0 means that each batch waits for the previous one)
+   int staleness = 0;
+
+   // Reduction buffers of the batches, used in turn: the one of batch j is
+   // pipeline[j % pipeline.size()]
+   std::vector<std::unique_ptr<allreduceBuffer>> pipeline;
+
+   void setupPipeline ( void );
+   void solveMiniBatch ( void );
 public:
-   kMeansSGD ( unsigned int nn, kMeansDataset::const_iterator a, kMeansDataset::const_iterator b ) :
-      kMeansParallelBase<dist_type> ( nn, a, b ) { }
+   kMeansSGD ( const basicDataset<real> & data, MPI_Comm comm = MPI_COMM_WORLD ) :
+      kMeansParallelBase<dist_type, D, real> ( data, comm ) { }
 
    void solve ( void ) override;
 
    // Batch size get-set
    int getBatchSize ( void ) const { return batchSize; }
    void setBatchSize ( int bs ) { batchSize = bs; }
+
+   // Mini-batch mode get-set
+   bool getMiniBatch ( void ) const { return miniBatch; }
+   void setMiniBatch ( bool mb ) { miniBatch = mb; }
+
+   // Patience of the mini-batch mode get-set
+   int getPatience ( void ) const { return patience; }
+   void setPatience ( int p ) { patience = p; }
+
+   // Staleness bound get-set
+   int getStaleness ( void ) const { return staleness; }
+   void setStaleness ( int s ) { staleness = std::max ( 0, s ); }
+
+   // Communication statistics include the reductions of the batches
+   double getCommTime ( void ) const override;
+   double getOverlapTime ( void ) const override;
+
+   // Each process draws the same number of points per batch, whatever the size
+   // of its portion, so moving points would not move work
+   bool setRebalance ( double r ) override { return r <= 0; }
 };
 
-template<typename dist_type>
-void kMeansSGD<dist_type>::solve ( void ) {
-   int size; MPI_Comm_size ( MPI_COMM_WORLD, &size );
-   int rank; MPI_Comm_rank ( MPI_COMM_WORLD, &rank );
+template<typename dist_type, unsigned int D, typename real>
+void kMeansSGD<dist_type, D, real>::setupPipeline ( void ) {
+   pipeline.clear();
+   for ( int j = 0; j <= staleness; ++j ) {
+      pipeline.emplace_back ( new allreduceBuffer ( this->comm ) );
+      pipeline.back()->setPersistent ( this->reduction.getPersistent() );
+   }
+}
+
+template<typename dist_type, unsigned int D, typename real>
+double kMeansSGD<dist_type, D, real>::getCommTime ( void ) const {
+   double result = this->reduction.getCommTime();
+   for ( auto & r : pipeline ) result += r->getCommTime();
+   return result;
+}
+
+template<typename dist_type, unsigned int D, typename real>
+double kMeansSGD<dist_type, D, real>::getOverlapTime ( void ) const {
+   double result = this->reduction.getOverlapTime();
+   for ( auto & r : pipeline ) result += r->getOverlapTime();
+   return result;
+}
+
+template<typename dist_type, unsigned int D, typename real>
+void kMeansSGD<dist_type, D, real>::solve ( void ) {
+   if ( miniBatch ) {
+      solveMiniBatch();
+      return;
+   }
+
+   int size; MPI_Comm_size ( this->comm, &size );
+   int rank; MPI_Comm_rank ( this->comm, &rank );
 
    // Parallelization: we draw entries in batches. Each process draws a portion
    // of the batch and performs the algorithm, Size of each batch is in the
@@ -42,8 +122,9 @@ void kMeansSGD<dist_type>::solve ( void ) {
    this->iter = 0;
 
    // Randomize initial assignments
-   this->randomize();
-   this->computeCentroids();
+   this->initialize();
+   this->prepareAssignment();
+   setupPipeline();
 
    int changesCount = this->stoppingCriterion.minLabelChanges + 1;
    double centroidDispl = this->stoppingCriterion.minCentroidDisplacement + 1;
@@ -53,87 +134,434 @@ void kMeansSGD<dist_type>::solve ( void ) {
    // algorithm stops when it reaches a fixed number (see below)
    // This helps checking that actual convergence takes place
    int stopIters = 0;
+   bool more = true;
 
-   std::default_random_engine eng ( 10000 * rank );
+   std::default_random_engine eng ( 10000 * rank + 7919 * this->seed );
    std::uniform_int_distribution<unsigned int> distro ( 0, this->dataset.size() - 1 );
 
-   std::vector<int> oldGlobalCounts ( this->k, 0 );
-   std::vector<int> newGlobalCounts ( this->k, 0 );
+   // Changes of the centroids, counts of the points in each cluster and number
+   // of label changes are packed in the reduction buffer of the batch, in this
+   // order, and summed across processes with one collective per batch
+   // Global counts before each batch are those computed after the previous one
+   std::size_t diffSize = std::size_t(this->k) * this->dim();
+
+   // Buffer for the coordinates of a point, used if the dataset is not row-major
+   coordBuffer<D, real> buf ( this->n );
+
+   // Indices of the points of the batch drawn by this process, and labels of
+   // their nearest centroids
+   unsigned int threads = this->pool->size();
+   std::vector<unsigned int> batch;
+   std::vector<int> nearest;
+
+   // Number of batches whose reduction has been started, and applied
+   std::size_t issued = 0, applied = 0;
+
+   // Applies the oldest reduction in flight to the centroids and checks if
+   // stopping criterion is satisfied, possibly incrementing the counter
+   auto apply = [&] ( void ) {
+      allreduceBuffer & reduction = *pipeline[applied % pipeline.size()];
+      {
+         PROFILE_PHASE ( this->profile, reduction );
+         reduction.wait();
+      }
+      ++applied;
+
+      {
+         PROFILE_PHASE ( this->profile, update );
+
+         if ( this->stoppingCriterion.minCentroidDisplacement > 0 )
+            oldCentroids = this->centroids;
+
+         for ( unsigned int kk = 0; kk < this->k; ++kk ) {
+            int oldCount = this->globalCounts[kk];
+            int newCount = reduction[diffSize + kk];
+            this->globalCounts[kk] = newCount;
+
+            // Clusters left empty keep their previous centroid
+            if ( newCount == 0 ) continue;
+
+            double * c = this->centroids[kk].data();
+            const double * diff = reduction.data() + std::size_t(kk) * this->dim();
+            for ( unsigned int nn = 0; nn < this->dim(); ++nn )
+               c[nn] = ( c[nn] * oldCount + diff[nn] ) / newCount;
+         }
+
+         changesCount = reduction[diffSize + this->k];
+         this->packCentroids();
+      }
+
+      PROFILE_PHASE ( this->profile, stopping );
+
+      // Compute the max displacement of the centroids for the stopping criterion
+      if ( this->stoppingCriterion.minCentroidDisplacement > 0 ) {
+         centroidDispl = 0;
+         for ( unsigned kk = 0; kk < this->k; ++kk ) {
+            double displ = this->dist ( oldCentroids[kk], this->centroids[kk] );
+            if ( displ > centroidDispl ) centroidDispl = displ;
+         }
+         centroidDispl = sqrt(centroidDispl);
+      }
+
+      ++this->iter;
+
+      // Another batch is drawn only if the criteria were not met for a fixed
+      // number of iterations before this one
+      more = more && stopIters < 15;
 
-   while ( stopIters < 15 ) {
-      // Checks if stopping criterion is satisfied at this iteration, and possibly
-      // increment the counter
       if ( (this->stoppingCriterion.maxIter <= 0 || this->iter < this->stoppingCriterion.maxIter)
         && (this->stoppingCriterion.minLabelChanges <= 0 || changesCount >= this->stoppingCriterion.minLabelChanges)
         && (this->stoppingCriterion.minCentroidDisplacement <= 0 || centroidDispl >= this->stoppingCriterion.minCentroidDisplacement) ) stopIters = 0;
       else stopIters++;
+   };
 
-      if ( this->stoppingCriterion.minCentroidDisplacement > 0 )
-         oldCentroids = this->centroids;
-
+   while ( more ) {
+      PROFILE_ITERATION ( this->profile );
       changesCount = 0;
 
-      std::vector<point> centroidDiff  ( this->k, point(this->n) );
+      allreduceBuffer & reduction = *pipeline[issued % pipeline.size()];
+      reduction.reset ( diffSize + this->k + 1 );
+
+      // Draws the assigned portion of the batch
+      // Points are drawn by the calling thread, so that the batch does not
+      // depend on the number of threads
+      batch.clear();
+      for ( int i = rank; i < batchSize; i += size )
+         batch.push_back ( distro(eng) );
 
-      MPI_Allreduce ( this->counts.data(), oldGlobalCounts.data(), this->k, MPI_INT, MPI_SUM, MPI_COMM_WORLD );
+      // Finds the nearest centroid to each point of the batch
+      // This is the bulk of the work, and is split among the threads
+      nearest.resize ( batch.size() );
 
-      // Determines the changes to be made on the assigned portion of the batch.
-      // Those changes are initially stored in the vector changes, and only later
-      // sent to the other processes and applied
-      for ( int i = rank; i < batchSize; i += size ) {
-         // Randomly selects a point
-         unsigned int idx = distro(eng);
+      {
+         PROFILE_PHASE ( this->profile, assignment );
 
-         // Find the nearest centroid to the selected point
-         int nearestLabel = 0;
-         double nearestDist = this->dist ( this->dataset[idx], this->centroids[0] );
+         this->pool->run ( [&] ( unsigned int t ) {
+            unsigned int begin = 0, share = 0;
+            datasetPartition ( batch.size(), t, threads, begin, share );
 
-         for ( unsigned int kk = 1; kk < this->k; ++kk ) {
-            double d = this->dist ( this->dataset[idx], this->centroids[kk] );
-            if ( d < nearestDist ) {
-               nearestDist = d;
-               nearestLabel = kk;
+            if ( this->assignUsed == kMeansAssign::blocked ) {
+               this->nearestBlocked ( t, share, [&] ( unsigned int b ) { return batch[begin + b]; },
+                  [&] ( unsigned int b, const real *, int nearestLabel, double ) { nearest[begin + b] = nearestLabel; } );
+               return;
             }
-         }
 
-         // Assigns the chosen label
-         int oldLabel = this->dataset[idx].getLabel();
+            // Buffer for the coordinates of a point, used if the dataset is not row-major
+            coordBuffer<D, real> buf ( this->n );
+
+            for ( unsigned int b = begin; b < begin + share; ++b ) {
+               const real * x = this->dataset.getPoint ( batch[b], buf.data() );
+               int nearestLabel = 0;
+               double nearestDist = this->distance ( x, this->centroid ( 0 ) );
 
-         if ( oldLabel != nearestLabel ) {
-            this->counts[oldLabel] -= 1;
-            this->counts[nearestLabel] += 1;
-            this->dataset[idx].setLabel(nearestLabel);
-            changesCount++;
+               for ( unsigned int kk = 1; kk < this->k; ++kk ) {
+                  double d = this->distance ( x, this->centroid ( kk ) );
+                  if ( d < nearestDist ) {
+                     nearestDist = d;
+                     nearestLabel = kk;
+                  }
+               }
 
-            for ( unsigned int nn = 0; nn < this->n; ++nn ) {
-               centroidDiff[oldLabel][nn] -= this->dataset[idx][nn];
-               centroidDiff[nearestLabel][nn] += this->dataset[idx][nn];
+               nearest[b] = nearestLabel;
+            }
+         } );
+      }
+
+      // Assigns the chosen labels, in the order in which the points were drawn
+      // This is done by a single thread, since a point can be drawn more than
+      // once in a batch
+      // Local labels and counts are always up to date, even if the centroids
+      // may lack the latest batches
+      {
+         PROFILE_PHASE ( this->profile, accumulation );
+
+         for ( unsigned int b = 0; b < batch.size(); ++b ) {
+            unsigned int idx = batch[b];
+            int oldLabel = this->dataset.getLabel(idx);
+            int nearestLabel = nearest[b];
+
+            if ( oldLabel != nearestLabel ) {
+               this->counts[oldLabel] -= 1;
+               this->counts[nearestLabel] += 1;
+               this->dataset.setLabel(idx, nearestLabel);
+               changesCount++;
+
+               const real * x = this->dataset.getPoint ( idx, buf.data() );
+               double * oldDiff = reduction.data() + std::size_t(oldLabel) * this->dim();
+               double * newDiff = reduction.data() + std::size_t(nearestLabel) * this->dim();
+               for ( unsigned int nn = 0; nn < this->dim(); ++nn ) {
+                  oldDiff[nn] -= x[nn];
+                  newDiff[nn] += x[nn];
+               }
             }
          }
+
+         for ( unsigned int kk = 0; kk < this->k; ++kk )
+            reduction[diffSize + kk] = this->counts[kk];
+         reduction[diffSize + this->k] = changesCount;
       }
 
-      MPI_Allreduce ( this->counts.data(), newGlobalCounts.data(), this->k, MPI_INT, MPI_SUM, MPI_COMM_WORLD );
+      PROFILE_COUNT ( this->profile, assigned, batch.size() );
+      PROFILE_COUNT ( this->profile, changes, changesCount );
+      PROFILE_COUNT ( this->profile, reduced, reduction.size() );
 
-      for ( unsigned int kk = 0; kk < this->k; ++kk ) {
-         mpi_point_allreduce ( &centroidDiff[kk] );
-         for ( unsigned int nn = 0; nn < this->n; ++nn )
-            this->centroids[kk][nn] = ( this->centroids[kk][nn] * oldGlobalCounts[kk] + centroidDiff[kk][nn] ) / newGlobalCounts[kk];
+      // Lets MPI progress the reductions in flight, then starts this one and
+      // applies the oldest ones beyond the staleness bound
+      {
+         PROFILE_PHASE ( this->profile, reduction );
+
+         for ( std::size_t j = applied; j < issued; ++j )
+            pipeline[j % pipeline.size()]->test();
+
+         if ( staleness > 0 ) reduction.start();
+         else reduction.reduce();
       }
+      ++issued;
+
+      while ( issued - applied > std::size_t(staleness) ) apply();
+   }
 
-      MPI_Allreduce ( MPI_IN_PLACE, &changesCount, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD );
+   // The batches still in flight are applied as well
+   while ( applied < issued ) apply();
+}
 
-      // Compute the max displacement of the centroids for the stopping criterion
-      if ( this->stoppingCriterion.minCentroidDisplacement > 0 ) {
-         centroidDispl = 0;
-         for ( unsigned kk = 0; kk < this->k; ++kk ) {
-            double displ = this->dist ( oldCentroids[kk], this->centroids[kk] );
-            if ( displ > centroidDispl ) centroidDispl = displ;
+template<typename dist_type, unsigned int D, typename real>
+void kMeansSGD<dist_type, D, real>::solveMiniBatch ( void ) {
+   int size; MPI_Comm_size ( this->comm, &size );
+   int rank; MPI_Comm_rank ( this->comm, &rank );
+
+   this->iter = 0;
+   this->initialize();
+   this->prepareAssignment();
+   setupPipeline();
+
+   // Local points, visited in an order that is shuffled again at each epoch
+   std::vector<unsigned int> order ( this->dataset.size() );
+   std::iota ( order.begin(), order.end(), 0 );
+   std::default_random_engine eng ( 10000 * rank + 7919 * this->seed );
+   std::shuffle ( order.begin(), order.end(), eng );
+   std::size_t next = 0;
+
+   // Portion of the batch drawn by this process
+   unsigned int batchBegin = 0, batchShare = 0;
+   datasetPartition ( batchSize, rank, size, batchBegin, batchShare );
+   if ( order.empty() ) batchShare = 0;
+
+   // Number of points each centroid has been updated with: the learning rate of
+   // a centroid for each of the points of a batch is its inverse
+   std::vector<double> updates ( this->k, 0 );
+
+   // Inertia per point of the batches, smoothed with an exponential moving
+   // average whose weight grows with the fraction of the dataset in a batch
+   double alpha = std::min ( 1.0, 2.0 * batchSize / ( this->datasetSize + 1 ) );
+   double smoothed = 0, best = std::numeric_limits<double>::infinity();
+   int noImprovement = 0;
+
+   // Sums of the points of the batch nearest to each centroid, their counts, the
+   // inertia and the size of the batch are packed in the reduction buffer of
+   // the batch, in this order, and summed across processes with one collective
+   std::size_t sumsSize = std::size_t(this->k) * this->dim();
+
+   unsigned int threads = this->pool->size();
+   std::vector<unsigned int> batch;
+   std::vector<std::vector<double>> sums ( threads );
+   std::vector<double> inertias ( threads );
+
+   // Number of batches whose reduction has been started, and applied
+   std::size_t issued = 0, applied = 0;
+   bool more = true;
+
+   // Applies the oldest reduction in flight to the centroids and checks the
+   // stopping criteria
+   auto apply = [&] ( void ) {
+      allreduceBuffer & reduction = *pipeline[applied % pipeline.size()];
+      {
+         PROFILE_PHASE ( this->profile, reduction );
+         reduction.wait();
+      }
+      ++applied;
+
+      // Each centroid moves towards the points of the batch nearest to it;
+      // with one point at a time, this is c += ( x - c ) / updates
+      double centroidDispl = 0;
+      {
+         PROFILE_PHASE ( this->profile, update );
+
+         for ( unsigned int kk = 0; kk < this->k; ++kk ) {
+            double count = reduction[sumsSize + kk];
+            if ( count == 0 ) continue;
+            updates[kk] += count;
+
+            point old = this->centroids[kk];
+            double * c = this->centroids[kk].data();
+            const double * sum = reduction.data() + std::size_t(kk) * this->dim();
+            for ( unsigned int nn = 0; nn < this->dim(); ++nn )
+               c[nn] += ( sum[nn] - count * c[nn] ) / updates[kk];
+
+            if ( this->stoppingCriterion.minCentroidDisplacement > 0 )
+               centroidDispl = std::max ( centroidDispl, this->metric ( this->distance ( old.data(), c ) ) );
          }
-         centroidDispl = sqrt(centroidDispl);
+
+         this->packCentroids();
       }
 
+      PROFILE_PHASE ( this->profile, stopping );
+
+      double batchInertia = reduction[sumsSize + this->k] / std::max ( 1.0, reduction[sumsSize + this->k + 1] );
+      smoothed = this->iter == 0 ? batchInertia : ( 1 - alpha ) * smoothed + alpha * batchInertia;
       ++this->iter;
+
+      if ( smoothed < best ) {
+         best = smoothed;
+         noImprovement = 0;
+      }
+      else ++noImprovement;
+
+      if ( noImprovement >= patience ) more = false;
+      if ( this->stoppingCriterion.maxIter > 0 && this->iter >= this->stoppingCriterion.maxIter ) more = false;
+      if ( this->stoppingCriterion.minCentroidDisplacement > 0 && centroidDispl < this->stoppingCriterion.minCentroidDisplacement ) more = false;
+   };
+
+   while ( more ) {
+      PROFILE_ITERATION ( this->profile );
+
+      batch.clear();
+      for ( unsigned int b = 0; b < batchShare; ++b ) {
+         if ( next == order.size() ) {
+            std::shuffle ( order.begin(), order.end(), eng );
+            next = 0;
+         }
+         batch.push_back ( order[next++] );
+      }
+
+      // Each thread accumulates the sums, counts and inertia over its part of
+      // the batch; these are then merged in thread order
+      {
+         PROFILE_PHASE ( this->profile, assignment );
+
+         this->pool->run ( [&] ( unsigned int t ) {
+            unsigned int begin = 0, share = 0;
+            datasetPartition ( batch.size(), t, threads, begin, share );
+
+            std::vector<double> & s = sums[t];
+            s.assign ( sumsSize + this->k, 0 );
+            inertias[t] = 0;
+
+            auto accumulate = [&] ( const real * x, int nearestLabel, double nearestDist ) {
+               double * c = s.data() + std::size_t(nearestLabel) * this->dim();
+               for ( unsigned int nn = 0; nn < this->dim(); ++nn )
+                  c[nn] += x[nn];
+               s[sumsSize + nearestLabel] += 1;
+
+               double m = this->metric ( nearestDist );
+               inertias[t] += m * m;
+            };
+
+            if ( this->assignUsed == kMeansAssign::blocked ) {
+               this->nearestBlocked ( t, share, [&] ( unsigned int b ) { return batch[begin + b]; },
+                  [&] ( unsigned int, const real * x, int nearestLabel, double nearestDist ) { accumulate ( x, nearestLabel, nearestDist ); } );
+               return;
+            }
+
+            coordBuffer<D, real> buf ( this->n );
+
+            for ( unsigned int b = begin; b < begin + share; ++b ) {
+               const real * x = this->dataset.getPoint ( batch[b], buf.data() );
+               int nearestLabel = 0;
+               double nearestDist = this->distance ( x, this->centroid ( 0 ) );
+
+               for ( unsigned int kk = 1; kk < this->k; ++kk ) {
+                  double d = this->distance ( x, this->centroid ( kk ) );
+                  if ( d < nearestDist ) {
+                     nearestDist = d;
+                     nearestLabel = kk;
+                  }
+               }
+
+               accumulate ( x, nearestLabel, nearestDist );
+            }
+         } );
+      }
+
+      allreduceBuffer & reduction = *pipeline[issued % pipeline.size()];
+      {
+         PROFILE_PHASE ( this->profile, accumulation );
+
+         reduction.reset ( sumsSize + this->k + 2 );
+         for ( unsigned int t = 0; t < threads; ++t ) {
+            for ( std::size_t j = 0; j < sumsSize + this->k; ++j )
+               reduction[j] += sums[t][j];
+            reduction[sumsSize + this->k] += inertias[t];
+         }
+         reduction[sumsSize + this->k + 1] = batch.size();
+      }
+
+      PROFILE_COUNT ( this->profile, assigned, batch.size() );
+      PROFILE_COUNT ( this->profile, reduced, reduction.size() );
+
+      // Lets MPI progress the reductions in flight, then starts this one and
+      // applies the oldest ones beyond the staleness bound
+      {
+         PROFILE_PHASE ( this->profile, reduction );
+
+         for ( std::size_t j = applied; j < issued; ++j )
+            pipeline[j % pipeline.size()]->test();
+
+         if ( staleness > 0 ) reduction.start();
+         else reduction.reduce();
+      }
+      ++issued;
+
+      while ( issued - applied > std::size_t(staleness) ) apply();
+   }
+
+   // The batches still in flight are applied as well
+   while ( applied < issued ) apply();
+
+   // Finally, each point gets the label of the nearest centroid
+   std::vector<std::vector<int>> threadCounts ( threads, std::vector<int>(this->k, 0) );
+
+   {
+      PROFILE_PHASE ( this->profile, assignment );
+
+      this->pool->run ( [&] ( unsigned int t ) {
+         unsigned int begin = 0, share = 0;
+         datasetPartition ( this->dataset.size(), t, threads, begin, share );
+
+         if ( this->assignUsed == kMeansAssign::blocked ) {
+            this->nearestBlocked ( t, share, [begin] ( unsigned int b ) { return begin + b; },
+               [&] ( unsigned int b, const real *, int nearestLabel, double ) {
+                  this->dataset.setLabel ( begin + b, nearestLabel );
+                  threadCounts[t][nearestLabel]++;
+               } );
+            return;
+         }
+
+         coordBuffer<D, real> buf ( this->n );
+
+         for ( unsigned int i = begin; i < begin + share; ++i ) {
+            const real * x = this->dataset.getPoint ( i, buf.data() );
+            int nearestLabel = 0;
+            double nearestDist = this->distance ( x, this->centroid ( 0 ) );
+
+            for ( unsigned int kk = 1; kk < this->k; ++kk ) {
+               double d = this->distance ( x, this->centroid ( kk ) );
+               if ( d < nearestDist ) {
+                  nearestDist = d;
+                  nearestLabel = kk;
+               }
+            }
+
+            this->dataset.setLabel ( i, nearestLabel );
+            threadCounts[t][nearestLabel]++;
+         }
+      } );
    }
+
+   this->counts.assign ( this->k, 0 );
+   for ( unsigned int t = 0; t < threads; ++t )
+      for ( unsigned int kk = 0; kk < this->k; ++kk )
+         this->counts[kk] += threadCounts[t][kk];
 }
 
 #endif
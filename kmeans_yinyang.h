@@ -0,0 +1,281 @@
+#ifndef _KMEANS_YINYANG_H
+#define _KMEANS_YINYANG_H
+
+#include "kmeans_parallel.h"
+
+#include <limits>
+
+// K-means algorithm accelerated with grouped bounds (Yinyang k-means)
+
+// The centroids are split in groups of about ten, by clustering the initial
+// centroids. Each point keeps an upper bound on its distance from the centroid
+// of its cluster, and for each group a lower bound on its distance from the
+// centroids of the group (other than its own). At each iteration a group is
+// searched only if its lower bound does not exceed the upper bound, and the
+// point is skipped altogether if no group is
+// Bounds take k/10 + 1 values per point, so the method suits large k, where
+// the k bounds per point of kMeansElkan would not fit in memory
+
+// As in kMeansElkan, groups are skipped only when the bounds rule them out
+// beyond rounding errors, so the labels are the same as kMeansG's
+
+template<typename dist_type = dist_euclidean, unsigned int D = 0, typename real = double>
+class kMeansYinyang : public kMeansParallelBase<dist_type, D, real> {
+private:
+   // Groups of centroids: group of each centroid, and centroids of each group
+   std::vector<unsigned int> groupOf;
+   std::vector<std::vector<unsigned int>> groups;
+
+   // Upper bounds (one per local point) and lower bounds (one per group per
+   // local point, the bound of point i for group g being lower[i*groups + g])
+   std::vector<double> upper;
+   std::vector<double> lower;
+
+   // Fraction of distances skipped in the last solve
+   double skipped = 0;
+
+   // Splits the current centroids in groups, with a few iterations of k-means
+   // on the centroids themselves; the result is the same on all processes
+   void groupCentroids ( void );
+
+public:
+   kMeansYinyang ( const basicDataset<real> & data, MPI_Comm comm = MPI_COMM_WORLD ) :
+      kMeansParallelBase<dist_type, D, real> ( data, comm ) { }
+
+   // Solve method
+   void solve ( void ) override;
+
+   double getSkippedDistances ( void ) const override { return skipped; }
+};
+
+template<typename dist_type, unsigned int D, typename real>
+void kMeansYinyang<dist_type, D, real>::groupCentroids ( void ) {
+   unsigned int k = this->k;
+   unsigned int ngroups = std::max ( 1u, k / 10 );
+
+   // Groups are seeded with evenly spaced centroids
+   std::vector<point> seeds;
+   for ( unsigned int g = 0; g < ngroups; ++g )
+      seeds.push_back ( this->centroids[ std::size_t(g) * k / ngroups ] );
+
+   groupOf.assign ( k, 0 );
+
+   for ( unsigned int it = 0; it < 5; ++it ) {
+      for ( unsigned int kk = 0; kk < k; ++kk ) {
+         double nearestDist = 0;
+         for ( unsigned int g = 0; g < ngroups; ++g ) {
+            double d = this->distance ( this->centroids[kk].data(), seeds[g].data() );
+            if ( g == 0 || d < nearestDist ) {
+               nearestDist = d;
+               groupOf[kk] = g;
+            }
+         }
+      }
+
+      // Empty groups keep their seed
+      std::vector<point> sums ( ngroups, point(this->n) );
+      std::vector<int> sizes ( ngroups, 0 );
+      for ( unsigned int kk = 0; kk < k; ++kk ) {
+         sums[groupOf[kk]] += this->centroids[kk];
+         sizes[groupOf[kk]] += 1;
+      }
+
+      for ( unsigned int g = 0; g < ngroups; ++g )
+         if ( sizes[g] > 0 ) seeds[g] = sums[g] / sizes[g];
+   }
+
+   groups.assign ( ngroups, std::vector<unsigned int>() );
+   for ( unsigned int kk = 0; kk < k; ++kk )
+      groups[groupOf[kk]].push_back ( kk );
+}
+
+template<typename dist_type, unsigned int D, typename real>
+void kMeansYinyang<dist_type, D, real>::solve ( void ) {
+   this->iter = 0;
+
+   int changesCount = this->stoppingCriterion.minLabelChanges + 1;
+   double centroidDispl = this->stoppingCriterion.minCentroidDisplacement + 1;
+   std::vector<point> oldCentroids;
+
+   // Distances actually computed, and those a full search would compute
+   double computed = 0, total = 0;
+
+   this->initialize();
+   groupCentroids();
+
+   unsigned int k = this->k;
+   unsigned int ngroups = groups.size();
+   unsigned int share = this->dataset.size();
+   upper.assign ( share, 0 );
+   lower.assign ( std::size_t(share) * ngroups, 0 );
+
+   // Displacement of the centroids at the last iteration, and largest
+   // displacement within each group
+   std::vector<double> drift ( k, 0 );
+   std::vector<double> groupDrift ( ngroups, 0 );
+
+   const double infinity = std::numeric_limits<double>::infinity();
+
+   while ( (this->stoppingCriterion.maxIter <= 0 || this->iter < this->stoppingCriterion.maxIter)
+        && (this->stoppingCriterion.minLabelChanges <= 0 || changesCount >= this->stoppingCriterion.minLabelChanges)
+        && (this->stoppingCriterion.minCentroidDisplacement <= 0 || centroidDispl >= this->stoppingCriterion.minCentroidDisplacement) ) {
+
+      oldCentroids = this->centroids;
+      changesCount = 0;
+
+      // Assigns each point to the group of the closest centroid
+      // As in kMeansG, the local portion is split among the threads, each of
+      // which counts the changes on its own
+      unsigned int threads = this->pool->size();
+      std::vector<int> threadChanges ( threads, 0 );
+      std::vector<double> threadComputed ( threads, 0 );
+      std::vector<std::vector<int>> threadCounts ( threads, std::vector<int>(k, 0) );
+
+      timer work;
+      work.start();
+
+      this->pool->run ( [&] ( unsigned int t ) {
+         unsigned int begin = 0, count = 0;
+         datasetPartition ( share, t, threads, begin, count );
+
+         // Buffer for the coordinates of a point, used if the dataset is not row-major
+         coordBuffer<D, real> buf ( this->n );
+         std::vector<int> & countsDiff = threadCounts[t];
+
+         // Metric distances from the centroids of the searched groups, and
+         // whether each group was searched
+         std::vector<double> dists ( k, 0 );
+         std::vector<char> searched ( ngroups, 0 );
+
+         for ( unsigned int i = begin; i < begin + count; ++i ) {
+            double * l = lower.data() + std::size_t(i) * ngroups;
+            int oldLabel = this->dataset.getLabel(i);
+            int nearestLabel = oldLabel;
+            double nearestDist = 0, u = upper[i];
+            bool found = this->iter > 0;
+            const real * x = nullptr;
+
+            // After the first iteration, the point is skipped if all the groups
+            // are ruled out, first by the loose upper bound, then by the tight one
+            if ( this->iter > 0 ) {
+               double minLower = *std::min_element ( l, l + ngroups );
+               if ( this->safelyGreater ( minLower, u ) ) continue;
+
+               x = this->dataset.getPoint ( i, buf.data() );
+               nearestDist = this->distance ( x, this->centroid ( oldLabel ) );
+               u = dists[oldLabel] = this->metric ( nearestDist );
+               threadComputed[t] += 1;
+               if ( this->safelyGreater ( minLower, u ) ) {
+                  upper[i] = u;
+                  continue;
+               }
+            }
+
+            else x = this->dataset.getPoint ( i, buf.data() );
+
+            // Searches the groups that are not ruled out; ties go to the lowest
+            // label, as in a full search
+            for ( unsigned int g = 0; g < ngroups; ++g ) {
+               searched[g] = this->iter == 0 || !this->safelyGreater ( l[g], u );
+               if ( !searched[g] ) continue;
+
+               for ( unsigned int kk : groups[g] ) {
+                  if ( this->iter > 0 && int(kk) == oldLabel ) continue;
+
+                  double d = this->distance ( x, this->centroid ( kk ) );
+                  dists[kk] = this->metric ( d );
+                  threadComputed[t] += 1;
+
+                  if ( !found || d < nearestDist || ( d == nearestDist && int(kk) < nearestLabel ) ) {
+                     nearestDist = d;
+                     nearestLabel = kk;
+                     u = dists[kk];
+                     found = true;
+                  }
+               }
+            }
+
+            // Lower bounds of the searched groups are recomputed, excluding the
+            // new nearest centroid; if the point leaves the group of its old
+            // centroid unsearched, the distance from it joins that bound
+            for ( unsigned int g = 0; g < ngroups; ++g ) {
+               if ( !searched[g] ) continue;
+               l[g] = infinity;
+               for ( unsigned int kk : groups[g] )
+                  if ( int(kk) != nearestLabel ) l[g] = std::min ( l[g], dists[kk] );
+            }
+
+            if ( this->iter > 0 && nearestLabel != oldLabel && !searched[groupOf[oldLabel]] )
+               l[groupOf[oldLabel]] = std::min ( l[groupOf[oldLabel]], dists[oldLabel] );
+
+            upper[i] = u;
+
+            if ( oldLabel != nearestLabel ) {
+               countsDiff[oldLabel] -= 1;
+               countsDiff[nearestLabel] += 1;
+               this->dataset.setLabel(i, nearestLabel);
+               this->moveSums ( t, x, oldLabel, nearestLabel );
+               threadChanges[t]++;
+            }
+         }
+      } );
+      work.stop();
+
+      for ( unsigned int t = 0; t < threads; ++t ) {
+         changesCount += threadChanges[t];
+         computed += threadComputed[t];
+         for ( unsigned int kk = 0; kk < k; ++kk )
+            this->counts[kk] += threadCounts[t][kk];
+      }
+      total += double(share) * k;
+
+      // Recomputes the centroids in the current configuration
+      // The count of changes is reduced along with the centroids
+      std::vector<double> changes = { double(changesCount) };
+      this->computeCentroids ( changes, true );
+      changesCount = changes[0];
+
+      // Bounds are moved by the displacement of the centroids: the lower bound
+      // of each group by the largest displacement within the group
+      std::fill ( groupDrift.begin(), groupDrift.end(), 0 );
+      for ( unsigned int kk = 0; kk < k; ++kk ) {
+         drift[kk] = this->metric ( this->distance ( oldCentroids[kk].data(), this->centroids[kk].data() ) );
+         groupDrift[groupOf[kk]] = std::max ( groupDrift[groupOf[kk]], drift[kk] );
+      }
+
+      this->pool->run ( [&] ( unsigned int t ) {
+         unsigned int begin = 0, count = 0;
+         datasetPartition ( share, t, threads, begin, count );
+
+         for ( unsigned int i = begin; i < begin + count; ++i ) {
+            upper[i] += drift[this->dataset.getLabel(i)];
+            double * l = lower.data() + std::size_t(i) * ngroups;
+            for ( unsigned int g = 0; g < ngroups; ++g )
+               l[g] -= groupDrift[g];
+         }
+      } );
+
+      // Compute the max displacement of the centroids
+      if ( this->stoppingCriterion.minCentroidDisplacement > 0 ) {
+         centroidDispl = 0;
+         for ( unsigned kk = 0; kk < k; kk += 1 ) {
+            double displ = this->dist ( oldCentroids[kk], this->centroids[kk] );
+            if ( displ > centroidDispl ) centroidDispl = displ;
+         }
+         centroidDispl = sqrt(centroidDispl);
+      }
+
+      // The points may be moved to balance the work of the processes, along
+      // with their bounds
+      if ( this->rebalance ( work.getTime(), { { &upper, 1 }, { &lower, ngroups } } ) ) share = this->dataset.size();
+
+      ++this->iter;
+   }
+
+   // Statistics on the skipped distances, over all the processes
+   double stats[2] = { computed, total };
+   MPI_Allreduce ( MPI_IN_PLACE, stats, 2, MPI_DOUBLE, MPI_SUM, this->comm );
+   skipped = stats[1] > 0 ? 1 - stats[0] / stats[1] : 0;
+}
+
+#endif
@@ -1,14 +1,16 @@
-#include "kmeans_seq.h"
-#include "kmeans_g.h"
-#include "kmeans_sgd.h"
+#include "kmeans_factory.h"
 
 #include "timer.h"
+#include "dataset_io.h"
+#include "synthetic.h"
 
 #include <iostream>
 #include <iomanip>
 #include <fstream>
 #include <cstdlib>
 #include <string>
+#include <limits>
+#include <algorithm>
 
 #include "GetPot"
 
@@ -16,6 +18,16 @@ using std::cout;
 using std::clog;
 using std::endl;
 
+// Parses a number of clusters, or a range first:last of numbers of clusters
+// (first = last for a single number)
+bool parseClusters ( const std::string & arg, int & first, int & last ) {
+   char * end = nullptr;
+   first = std::strtol ( arg.c_str(), &end, 10 );
+   last = first;
+   if ( *end == ':' ) last = std::strtol ( end + 1, &end, 10 );
+   return !arg.empty() && arg[0] != ':' && *end == '\0' && first >= 1 && last >= first;
+}
+
 void printHelp ( void ) {
    clog << "Stochastic Gradient Descent applied to K-Means" << endl;
    clog << "Michele Bucelli, Jose' Villafan" << endl;
@@ -25,26 +37,144 @@ void printHelp ( void ) {
            "in R^n and performs k-means clustering on it, using one of three\n"
            "possible algorithms, making use of parallel computing where needed." << endl << endl;
    clog << "Usage: mpirun -np <processes> kmeans -t|--test <testname>\n"
-        << "              -k <clusters> -m|--method <method> [--purity]\n"
-        << "              [--no-output] [--no-log]" << endl << endl;
-   clog << "Output: result of the clustering is printed on the standard output\n"
-        << "in an Octave/MatLab-compatible format." << endl << endl;
+        << "              -k <clusters>|<first>:<last> -m|--method <method>\n"
+        << "              [--purity] [--no-output] [--no-log] [--column-major]\n"
+        << "              [--threads <threads>] [--persistent]\n"
+        << "              [--rebalance <threshold>]\n"
+        << "              [--restarts <restarts> [--groups <groups>]]\n"
+        << "              [--init random|kmeans++|kmeans-parallel]\n"
+        << "              [--batch <size>] [--staleness <batches>]\n"
+        << "              [--assignment auto|pairwise|blocked]\n"
+        << "              [--precision double|single]\n"
+        << "              [--output <file>] [--format octave|binary]\n"
+        << "              [--profile [table|json]]\n"
+        << "       mpirun -np 1 kmeans -t|--test <testname> --convert\n"
+        << "       mpirun -np <processes> kmeans -t|--test synth:<spec>\n"
+        << "              --generate <testname> [--text]" << endl << endl;
+   clog << "Output: result of the clustering is printed on the standard output,\n"
+        << "or written to the file given with --output, in an Octave/MatLab-compatible\n"
+        << "format or in a compact binary format." << endl << endl;
    clog << "Parameters:\n"
         << " -t|--test <testname> : specifies the name of the test; there must\n"
-        << "      be a corresponding <testname>.txt file in the benchmarks\n"
-        << "      subfolder; if purity testing is enabled, there must also be\n"
-        << "      a <testname>-truelabels.txt file in the benchmarks subfolder\n"
+        << "      be a corresponding <testname>.bin (binary) or <testname>.txt\n"
+        << "      (text) file in the benchmarks subfolder; if purity testing is\n"
+        << "      enabled and the true labels are not stored in the binary file,\n"
+        << "      there must also be a <testname>-truelabels.txt file in the\n"
+        << "      benchmarks subfolder\n"
+        << "      A test named synth:<spec> is instead a Gaussian mixture generated\n"
+        << "      in memory by the processes, each its own portion, with true labels;\n"
+        << "      <spec> is a comma separated list of key=value, among N (points),\n"
+        << "      d (dimension), k (clusters), sd (mean standard deviation of the\n"
+        << "      clusters), range (centers in [-range, range]^d) and seed, e.g.\n"
+        << "      synth:N=1e8,d=20,k=50 (defaults: N=1e6,d=20,k=5,sd=4,range=10,\n"
+        << "      seed=1); the dataset depends only on <spec>\n"
         << " -k <clusters> : number of clusters the algorithm should produce\n"
+        << " -k <first>:<last> : solves for each number of clusters in the range,\n"
+        << "      reading the dataset once: the first solve starts from the\n"
+        << "      initialization method, and each of the others from the\n"
+        << "      centroids of the previous one, with its cluster of highest\n"
+        << "      inertia split in two along its principal axis; the inertia,\n"
+        << "      iterations and time of each solve are reported, and the\n"
+        << "      clustering with <last> clusters is output\n"
         << " -m|--method <method> : specifies the method to be used; available\n"
         << "      methods are:\n"
         << "       - sequential - performs k-means without parallelization\n"
         << "       - kmeans - performs k-means in parallel\n"
+        << "       - elkan - performs k-means in parallel, skipping the distance\n"
+        << "         computations ruled out by the triangle inequality (same\n"
+        << "         result as kmeans, k+1 bounds per point)\n"
+        << "       - hamerly - as elkan, with 2 bounds per point (suited to\n"
+        << "         low-dimensional data)\n"
+        << "       - yinyang - as elkan, with k/10+1 bounds per point (suited\n"
+        << "         to large numbers of clusters)\n"
+        << "       - kdtree - performs k-means in parallel over a kd-tree of the\n"
+        << "         local points, assigning whole subtrees to a centroid when the\n"
+        << "         others are ruled out (same result as kmeans, for data of up\n"
+        << "         to 8 dimensions)\n"
         << "       - kmeansSGD - performs k-means with stochastic gradient descent\n"
-        << "       - compare - tests both kmeans and kmeansSGD methods reporting\n"
+        << "       - minibatch - performs mini-batch k-means, moving the centroids\n"
+        << "         towards batches drawn without replacement, with learning rates\n"
+        << "         decaying for each centroid, until the smoothed inertia of the\n"
+        << "         batches stops improving\n"
+        << "       - compare - tests all the parallel methods reporting\n"
         << "         timing results; no output is produced in this case\n"
         << " --purity : enables purity evaluation for the produced clusters\n"
         << " --no-output : disables output result\n"
-        << " -q|--quiet : disables logging\n" << endl;
+        << " --output <file> : writes the result to a file, each process writing\n"
+        << "      its own points, instead of printing it on the standard output\n"
+        << " --format <format> : format of the result; available formats are:\n"
+        << "       - octave - Octave/MatLab syntax, with the label and the\n"
+        << "         coordinates of each point, as read by plotScript.m (default)\n"
+        << "       - binary - header, centroids and labels of the points only\n"
+        << "         (see dataset_io.h)\n"
+        << " --column-major : stores the coordinates of the dataset in column-major\n"
+        << "      order (each coordinate contiguous across points)\n"
+        << " --threads <threads> : number of threads used by each process for\n"
+        << "      parsing text input and by the parallel solvers\n"
+        << "      (default: 1)\n"
+        << " --init <method> : initialization of the clusters; available\n"
+        << "      methods are:\n"
+        << "       - random - each point gets a random label (default)\n"
+        << "       - kmeans++ - k-means++ seeding, drawing one center at a time\n"
+        << "       - kmeans-parallel - k-means|| seeding, drawing many candidate\n"
+        << "         centers in a few rounds across the processes, then reducing\n"
+        << "         them to k centers\n"
+        << " --batch <size> : number of points of each batch, across all the\n"
+        << "      processes, for kmeansSGD and minibatch (default: 1000)\n"
+        << " --staleness <batches> : lets kmeansSGD and minibatch assign each\n"
+        << "      batch while the reductions of up to this many previous batches\n"
+        << "      are in flight, overlapping communication and computation\n"
+        << "      (default: 0, each batch waits for the previous one)\n"
+        << " --assignment <method> : search of the nearest centroids in\n"
+        << "      sequential, kmeans, kmeansSGD and minibatch; available methods\n"
+        << "      are:\n"
+        << "       - pairwise - one distance computation per point and centroid\n"
+        << "       - blocked - tiles of points against all the centroids, through\n"
+        << "         dot products computed as a blocked matrix product (same\n"
+        << "         result as pairwise)\n"
+        << "       - auto - blocked from dimension 32 on (default)\n"
+        << " --precision <precision> : precision of the coordinates of the points\n"
+        << "      in the solvers; available precisions are:\n"
+        << "       - double - double precision (default)\n"
+        << "       - single - coordinates stored and distances computed in single\n"
+        << "         precision, halving the memory taken by the dataset, while the\n"
+        << "         centroids and the sums of the clusters stay in double\n"
+        << "         precision\n"
+        << " --profile [table|json] : reports the time spent by sequential, kmeans,\n"
+        << "      kmeansSGD and minibatch in each phase of their iterations, with\n"
+        << "      its minimum, mean and maximum across the processes, the time of\n"
+        << "      the iterations and counters of the work done, as a table or as a\n"
+        << "      JSON object per method (default: table); not available if built\n"
+        << "      with PROFILE=F\n"
+        << " --persistent : sets up the per-iteration reduction of the parallel\n"
+        << "      solvers as a persistent collective, if supported by MPI\n"
+        << " --rebalance <threshold> : with kmeans, elkan, hamerly and yinyang,\n"
+        << "      measures the time each process spends on its points, and when\n"
+        << "      the slowest one exceeds the mean by more than threshold (e.g.\n"
+        << "      0.1 for 10%), moves points between neighbouring processes so that\n"
+        << "      their portions follow their measured throughput (default: 0,\n"
+        << "      disabled); the output is written in the order of the dataset\n"
+        << " --restarts <restarts> : runs the parallel method that many times,\n"
+        << "      with different seeds for the initialization (and the batches\n"
+        << "      of the stochastic methods), reports the iterations, time,\n"
+        << "      inertia (and purity) of each run, and outputs the clustering\n"
+        << "      with the lowest inertia; restart 0 is the run without restarts\n"
+        << " --groups <groups> : with --restarts, splits the processes in that\n"
+        << "      many groups of consecutive ranks, each of which reads the\n"
+        << "      dataset once and runs its share of the restarts one after the\n"
+        << "      other, concurrently with the other groups (default: as many\n"
+        << "      groups as restarts, up to the number of processes)\n"
+        << " -q|--quiet : disables logging\n"
+        << " --convert : converts <testname>.txt and <testname>-truelabels.txt\n"
+        << "      to the binary file <testname>.bin, which is memory mapped and\n"
+        << "      used in place by the following runs, then exits\n"
+        << " --generate <testname> : writes the synthetic dataset of the test to\n"
+        << "      <testname>.bin, with the true labels, in the benchmarks subfolder,\n"
+        << "      each process writing its own portion, then exits\n"
+        << " --text : with --generate, writes <testname>.txt and\n"
+        << "      <testname>-truelabels.txt instead\n" << endl;
+   clog << "The instruction set used by the distance kernels is chosen at startup;\n"
+        << "it can be forced by setting KMEANS_SIMD to scalar, avx2 or avx512." << endl;
 }
 
 int main ( int argc, char * argv[] ) {
@@ -62,100 +192,535 @@ int main ( int argc, char * argv[] ) {
    }
 
    std::string test = cmdLine.follow("g1M-20-5", 2, "-t", "--test" ); // Test name
-   std::string method = cmdLine.follow("sequential", 2, "-m", "--method" ); // Method : sequential, kmeans, kmeansSGD, compare
-   int k = cmdLine.follow(5, 1, "-k" ); // Number of clusters
+   std::string method = cmdLine.follow("sequential", 2, "-m", "--method" ); // Method : sequential, kmeans, elkan, hamerly, yinyang, kdtree, kmeansSGD, minibatch, compare
+   std::string clustersArg = cmdLine.follow("5", 1, "-k" ); // Number of clusters, or range first:last of them
    bool purityTest = cmdLine.search("-p") || cmdLine.search("--purity"); // Purity flag test
    bool suppressOutput = cmdLine.search("--no-output"); // Disable output
    bool suppressLog = cmdLine.search("-q") || cmdLine.search("--quiet"); // Disable log
    bool verbose = cmdLine.search("-v") || cmdLine.search("--verbose"); // Verbose log
+   bool columnMajor = cmdLine.search("--column-major"); // Column-major coordinates layout
+   bool convert = cmdLine.search("--convert"); // Conversion of the dataset to binary format
+   std::string generateName = cmdLine.follow("", "--generate"); // Test written from a synthetic dataset
+   bool generateText = cmdLine.search("--text"); // Synthetic dataset written in text format
+   unsigned int threads = cmdLine.follow(1, "--threads"); // Threads per process
+   bool persistent = cmdLine.search("--persistent"); // Persistent reduction
+   double rebalance = cmdLine.follow(0.0, "--rebalance"); // Load imbalance threshold of the parallel solvers
+   int restarts = cmdLine.follow(1, "--restarts"); // Solves with different seeds, of which the best is kept
+   int groups = cmdLine.follow(0, "--groups"); // Groups of processes running the restarts concurrently
+   int batchSize = cmdLine.follow(1000, "--batch"); // Batch size of the stochastic methods
+   int staleness = cmdLine.follow(0, "--staleness"); // Batches in flight in the stochastic methods
+   std::string initArg = cmdLine.follow("random", "--init"); // Initialization : random, kmeans++, kmeans-parallel
+
+   std::string assignArg = cmdLine.follow("auto", "--assignment"); // Assignment : auto, pairwise, blocked
+   std::string precision = cmdLine.follow("double", "--precision"); // Precision of the coordinates : double, single
+   std::string outputPath = cmdLine.follow("", "--output"); // Output file, instead of the standard output
+   std::string formatArg = cmdLine.follow("octave", "--format"); // Output format : octave, binary
+   bool profiling = cmdLine.search("--profile"); // Per-phase profile of the solvers
+   std::string profileArg = cmdLine.follow("table", "--profile"); // Profile report : table, json
+
+   int k = 0, lastK = 0;
+   if ( !parseClusters ( clustersArg, k, lastK ) ) {
+      if ( rank == 0 ) clog << "Error: invalid number of clusters " << clustersArg << endl;
+      MPI_Finalize();
+      return 1;
+   }
+
+   // With a range of numbers of clusters, k is the first of them
+   bool sweep = lastK > k;
+
+   kMeansInit init = kMeansInit::random;
+   if ( !parseInit ( initArg, init ) ) {
+      if ( rank == 0 ) clog << "Error: unknown initialization method " << initArg << endl;
+      MPI_Finalize();
+      return 1;
+   }
+
+   kMeansAssign assign = kMeansAssign::automatic;
+   if ( !parseAssign ( assignArg, assign ) ) {
+      if ( rank == 0 ) clog << "Error: unknown assignment method " << assignArg << endl;
+      MPI_Finalize();
+      return 1;
+   }
+
+   if ( precision != "double" && precision != "single" ) {
+      if ( rank == 0 ) clog << "Error: unknown precision " << precision << endl;
+      MPI_Finalize();
+      return 1;
+   }
+
+   bool single = precision == "single";
+
+   resultsFormat format = resultsFormat::octave;
+   if ( !parseResultsFormat ( formatArg, format ) ) {
+      if ( rank == 0 ) clog << "Error: unknown output format " << formatArg << endl;
+      MPI_Finalize();
+      return 1;
+   }
+
+   // The argument of --profile is optional
+   if ( profileArg.empty() || profileArg[0] == '-' ) profileArg = "table";
+
+   if ( profiling && profileArg != "table" && profileArg != "json" ) {
+      if ( rank == 0 ) clog << "Error: unknown profile report " << profileArg << endl;
+      MPI_Finalize();
+      return 1;
+   }
+
+   if ( profiling && !profilingCompiled ) {
+      if ( rank == 0 ) clog << "Error: profiling is not compiled in (build with PROFILE=T)" << endl;
+      MPI_Finalize();
+      return 1;
+   }
+
+   if ( restarts < 1 ) {
+      if ( rank == 0 ) clog << "Error: invalid number of restarts " << restarts << endl;
+      MPI_Finalize();
+      return 1;
+   }
+
+   std::vector<std::string> parallelMethods = { "kmeans", "elkan", "hamerly", "yinyang", "kdtree", "kmeansSGD", "minibatch" };
+
+   if ( restarts > 1 && std::find ( parallelMethods.begin(), parallelMethods.end(), method ) == parallelMethods.end() ) {
+      if ( rank == 0 ) clog << "Error: --restarts requires one of the parallel methods" << endl;
+      MPI_Finalize();
+      return 1;
+   }
+
+   if ( restarts > 1 && profiling ) {
+      if ( rank == 0 ) clog << "Error: --profile is not available with --restarts" << endl;
+      MPI_Finalize();
+      return 1;
+   }
+
+   if ( sweep && ( method == "compare" || restarts > 1 || profiling ) ) {
+      if ( rank == 0 ) clog << "Error: a range of clusters requires a single method, without --restarts and --profile" << endl;
+      MPI_Finalize();
+      return 1;
+   }
+
+   if ( groups == 0 ) groups = std::min ( restarts, size );
+
+   if ( groups < 1 || groups > std::min ( restarts, size ) ) {
+      if ( rank == 0 ) clog << "Error: the number of groups must be between 1 and the number of processes and of restarts" << endl;
+      MPI_Finalize();
+      return 1;
+   }
+
+   // Synthetic datasets are generated instead of being read
+   bool synthetic = isSynthetic ( test );
+   syntheticSpec spec;
+
+   if ( synthetic && !parseSynthetic ( test, spec ) ) {
+      if ( rank == 0 ) clog << "Error: invalid synthetic dataset " << test << endl;
+      MPI_Finalize();
+      return 1;
+   }
+
+   if ( synthetic && convert ) {
+      if ( rank == 0 ) clog << "Error: synthetic datasets are written with --generate" << endl;
+      MPI_Finalize();
+      return 1;
+   }
+
+   if ( !synthetic && !generateName.empty() ) {
+      if ( rank == 0 ) clog << "Error: --generate requires a synthetic dataset (-t synth:<spec>)" << endl;
+      MPI_Finalize();
+      return 1;
+   }
+
+   // Dataset file: the binary version is preferred, if present; the format is
+   // then detected from the content of the file
+   std::string datasetPath = "./benchmarks/" + test + ".bin";
+   if ( convert || !std::ifstream ( datasetPath ) ) datasetPath = "./benchmarks/" + test + ".txt";
+   bool binary = !synthetic && isBinaryDataset ( datasetPath );
 
    if ( rank == 0 && !suppressLog && verbose ) {
       clog << "-----------------------------------------" << endl;
-      clog << "Dataset source: ./benchmarks/" << test << ".txt" << endl;
-      if ( purityTest ) clog << "True labels source: ./benchmarks/" << test << "-truelabels.txt" << endl;
+      if ( synthetic ) clog << "Dataset source: " << syntheticName ( spec ) << " (synthetic)" << endl;
+      else clog << "Dataset source: " << datasetPath << ( binary ? " (binary)" : " (text)" ) << endl;
    }
 
    // Read the dataset
-   std::ifstream datasetIn ( "./benchmarks/" + test + ".txt" );
+   // Parallel methods read it partitioned: each process reads only its own
+   // portion, so that the complete dataset is never stored by any process. The
+   // sequential method and the conversion need the complete dataset instead
+   // Synthetic datasets are generated in the same way, with their true labels
+   bool partitioned = ( method != "sequential" && !convert ) || !generateName.empty();
+
+   // Communicator of the processes sharing the dataset: with restarts run by
+   // several groups, each group of consecutive ranks reads it on its own
+   int group = rank * groups / size;
+   MPI_Comm dataComm = MPI_COMM_WORLD;
+   if ( groups > 1 && generateName.empty() ) MPI_Comm_split ( MPI_COMM_WORLD, group, rank, &dataComm );
+   std::string labelsPath = "./benchmarks/" + test + "-truelabels.txt";
+
+   kMeansDataset dataset;
+   std::vector<int> trueLabels;
+   bool loaded = false;
+
+   // Threads of the parser and of the generator, released once the dataset is
+   // ready, as the solvers have pools of their own
+   std::unique_ptr<threadPool> ioPool ( new threadPool ( std::max ( 1u, threads ) ) );
+
+   timer loadTm;
+   loadTm.start();
+
+   if ( synthetic ) {
+      if ( partitioned ) generateSyntheticPartition ( spec, dataset, trueLabels, dataComm, *ioPool );
+      else generateSynthetic ( spec, 0, spec.points, dataset, trueLabels, *ioPool );
+      loaded = true;
+   }
 
-   if ( datasetIn.fail() ) {
+   else if ( partitioned ) {
+      if ( binary ) loaded = loadBinaryDatasetPartition ( datasetPath, dataset, trueLabels, dataComm );
+      else loaded = loadTextDatasetPartition ( datasetPath, dataset, dataComm, *ioPool );
+   }
+
+   else if ( binary ) loaded = loadBinaryDataset ( datasetPath, dataset, trueLabels );
+
+   else loaded = loadTextDataset ( datasetPath, dataset, *ioPool ) && dataset.size() > 0;
+
+   if ( !loaded ) {
       if ( rank == 0 ) clog << "Error: couldn't read dataset file" << endl;
       return 1;
    }
 
-   kMeansDataset dataset;
-   datasetIn >> dataset;
-   unsigned int n = dataset[0].getN();
-   datasetIn.close();
+   loadTm.stop();
+   if ( rank == 0 && !suppressLog && verbose && synthetic )
+      clog << "Generation time (process 0): " << loadTm.getTime() << " msec" << endl;
 
-   // Read the true labels
-   std::ifstream trueLabelsIn ( "./benchmarks/" + test + "-truelabels.txt" );
+   // Synthetic dataset written to the benchmarks, by all the processes
+   if ( !generateName.empty() ) {
+      std::string path = "./benchmarks/" + generateName + ( generateText ? ".txt" : ".bin" );
+      bool written = false;
 
-   if ( purityTest && trueLabelsIn.fail() ) {
-      if ( rank == 0 ) clog << "Error: couldn't read true labels file" << endl;
+      timer writeTm;
+      writeTm.start();
+      if ( generateText ) {
+         written = writeTextDatasetPartition ( path, dataset, MPI_COMM_WORLD, *ioPool );
+         written = written && writeTextLabelsPartition ( "./benchmarks/" + generateName + "-truelabels.txt", trueLabels, MPI_COMM_WORLD );
+      }
+      else written = writeBinaryDatasetPartition ( path, dataset, trueLabels, MPI_COMM_WORLD );
+      writeTm.stop();
+
+      if ( rank == 0 ) {
+         if ( !written ) clog << "Error: couldn't write " << path << endl;
+         else if ( !suppressLog )
+            clog << syntheticName ( spec ) << " written to " << path << " in " << writeTm.getTime() << " msec" << endl;
+      }
+
+      MPI_Finalize();
+      return written ? 0 : 1;
+   }
+
+   ioPool.reset();
+
+   unsigned int n = dataset.getN();
+
+   if ( !methodApplies ( method, n ) ) {
+      if ( rank == 0 ) clog << "Error: the kdtree method is meant for dimensions up to " << kdTreeMaxDim << endl;
+      MPI_Finalize();
       return 1;
    }
 
-   std::vector<int> trueLabels;
-   trueLabelsIn >> trueLabels;
-   trueLabelsIn.close();
+   // Read the true labels, unless they were stored in the binary file
+   if ( trueLabels.empty() && ( purityTest || convert ) ) {
+      bool labelsRead = false;
+
+      if ( partitioned ) labelsRead = loadTextLabelsPartition ( labelsPath, dataset, trueLabels, dataComm );
+
+      else labelsRead = loadTextLabels ( labelsPath, trueLabels );
+
+      if ( purityTest && !labelsRead ) {
+         if ( rank == 0 ) clog << "Error: couldn't read true labels file" << endl;
+         return 1;
+      }
+
+      if ( rank == 0 && !suppressLog && verbose && purityTest )
+         clog << "True labels source: " << labelsPath << endl;
+   }
+
+   // Conversion of the dataset to the binary format
+   if ( convert ) {
+      std::string binaryPath = "./benchmarks/" + test + ".bin";
+
+      if ( rank == 0 ) {
+         if ( !writeBinaryDataset ( binaryPath, dataset, trueLabels ) )
+            clog << "Error: couldn't write binary dataset file" << endl;
+         else if ( !suppressLog )
+            clog << "Dataset converted to " << binaryPath << ( trueLabels.empty() ? "" : " (with true labels)" ) << endl;
+      }
+
+      MPI_Finalize();
+      return 0;
+   }
+
+   if ( purityTest ) {
+      if ( trueLabels.size() != dataset.size() ) {
+         if ( rank == 0 ) clog << "Error: true labels don't match the dataset" << endl;
+         return 1;
+      }
+
+      dataset.setTrueLabels ( trueLabels );
+      trueLabels.clear();
+   }
+
+   if ( columnMajor ) dataset.setLayout ( datasetLayout::colMajor );
+
+   // In single precision the coordinates are converted once, and the double
+   // precision dataset is released
+   kMeansDatasetF datasetF;
+   std::size_t footprint = dataset.memoryFootprint();
+
+   if ( single ) {
+      datasetF = kMeansDatasetF ( dataset );
+      footprint = datasetF.memoryFootprint();
+   }
 
    // Dataset info on log
    if ( rank == 0 && !suppressLog && verbose ) {
       clog << "-----------------------------------------" << endl;
       clog << "Test name: " << test << endl;
-      clog << "Dataset size: " << dataset.size() << endl;
-      clog << "Dataset dimension: " << n << endl;
-      clog << "Clusters: " << k << endl;
+      clog << "Dataset size: " << dataset.getGlobalSize() << endl;
+      if ( partitioned ) clog << "Partitioned input: " << dataset.size() << " points read by process 0" << endl;
+      clog << "Dataset dimension: " << n << ( specializedDimension(n) ? " (specialized)" : " (generic)" ) << endl;
+      clog << "Dataset memory: " << footprint / 1048576.0 << " MB";
+      if ( dataset.isMapped() && !single ) clog << " (+ " << dataset.mappedFootprint() / 1048576.0 << " MB mapped)";
+      clog << endl;
+      clog << "Precision: " << precision << endl;
+      clog << "Distance kernels: " << getDistKernels() << endl;
+      clog << "Clusters: " << clustersArg << endl;
       clog << "-----------------------------------------" << endl;
    }
 
-   std::vector<std::string> methods = { "sequential", "kmeans", "kmeansSGD" };
+   if ( single ) dataset.clear();
+
+   // Exit status: failures to write the output are reported at the end
+   int status = 0;
+
+   // Restarts: restart r runs with seed r on group r % groups, each group
+   // running its restarts one after the other on its copy of the dataset; the
+   // clustering with the lowest inertia over all of them is output by its group
+   if ( restarts > 1 ) {
+      int groupRank; MPI_Comm_rank ( dataComm, &groupRank );
+
+      // Iterations, time, inertia and purity of each restart, set by process 0
+      // of its group and summed over all the processes
+      const unsigned int fields = 4;
+      std::vector<double> stats ( std::size_t(restarts) * fields, 0 );
+
+      // Best clustering of the group
+      kMeansSolver * best = nullptr;
+      double bestInertia = std::numeric_limits<double>::max();
+      unsigned int solverThreads = 1;
+
+      timer totalTm;
+      totalTm.start();
+
+      for ( int r = group; r < restarts; r += groups ) {
+         kMeansSolver * solver = single ? makeSolver ( method, datasetF, batchSize, staleness, dataComm )
+                                        : makeSolver ( method, dataset, batchSize, staleness, dataComm );
+
+         solver->setK ( k );
+         solver->setSeed ( r );
+         solver->setInit ( init );
+         solver->setAssignment ( assign );
+         solver->setThreads ( threads );
+         solver->setPersistentReduction ( persistent );
+         solver->setRebalance ( rebalance );
+         solverThreads = solver->getThreads();
+
+         timer tm;
+         tm.start();
+         solver->solve();
+         tm.stop();
+
+         double inertia = solver->inertia();
+         double purity = purityTest ? solver->purity() : 0;
+
+         if ( groupRank == 0 ) {
+            double * s = stats.data() + std::size_t(r) * fields;
+            s[0] = solver->getIter();
+            s[1] = tm.getTime();
+            s[2] = inertia;
+            s[3] = purity;
+         }
 
-   for ( auto i : methods ) {
-      MPI_Barrier(MPI_COMM_WORLD);
+         if ( inertia < bestInertia ) {
+            delete best;
+            best = solver;
+            bestInertia = inertia;
+         }
+         else delete solver;
+      }
 
-      if ( method != i && method != "compare" ) continue;
-      if ( i == "sequential" && (rank != 0 || method == "compare") ) continue;
+      MPI_Allreduce ( MPI_IN_PLACE, stats.data(), stats.size(), MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD );
+      totalTm.stop();
 
-      // Allocate and configurate the solver
-      using distance = dist_euclidean;
-      kMeansBase<distance> * solver = nullptr;
+      // The first of the restarts with the lowest inertia, which is also the
+      // best one of its group
+      int bestRestart = 0;
+      for ( int r = 1; r < restarts; ++r )
+         if ( stats[r * fields + 2] < stats[bestRestart * fields + 2] ) bestRestart = r;
 
-      // Sequential kMeans
-      if ( i == "sequential" ) {
-         solver = new kMeansSeq<distance> ( n, dataset.begin(), dataset.end() );
-         solver->setStop ( -1, -1, 1 );
+      if ( rank == 0 && !suppressLog ) {
+         for ( int r = 0; r < restarts; ++r ) {
+            const double * s = stats.data() + std::size_t(r) * fields;
+            int g = r % groups;
+
+            // Processes of the group, ranks [ceil(g size / groups), ceil((g+1) size / groups))
+            int procs = ( (g + 1) * size + groups - 1 ) / groups - ( g * size + groups - 1 ) / groups;
+
+            clog << std::setw(10) << method << " | restart " << std::setw(3) << r << " | group " << std::setw(2) << g << ": "
+                 << std::setw(2) << procs << " proc x " << std::setw(2) << solverThreads << " thr | "
+                 << std::setw(10) << s[1] << " msec | " << std::setw(10) << s[0] << " iter | "
+                 << std::setw(12) << s[2] << " inertia";
+            if ( purityTest ) clog << " | " << std::setw(10) << s[3] << " purity";
+            clog << ( r == bestRestart ? " | best" : "" ) << endl;
+         }
 
-         if ( purityTest )
-            solver->setTrueLabels ( trueLabels.begin(), trueLabels.end() );
+         if ( verbose ) {
+            clog << "Restarts: " << restarts << " on " << groups << " groups, " << totalTm.getTime() << " msec" << endl;
+            clog << "Best: restart " << bestRestart << ", inertia " << stats[bestRestart * fields + 2] << endl;
+         }
       }
 
-      // Parallel kMeans
-      else if ( i == "kmeans" ) {
-         solver = new kMeansG<distance> ( n, dataset.begin(), dataset.end() );
-         solver->setStop ( -1, -1, 1 );
+      // Results are output by the group of the best restart
+      int written = 1;
+      if ( !suppressOutput && group == bestRestart % groups ) {
+         if ( outputPath.empty() ) best->printOutput ( cout, format );
+         else written = best->writeOutput ( outputPath, format );
       }
 
-      // Stochastic gradient descent kMeans
-      else if ( i == "kmeansSGD" ) {
-         auto tmp = new kMeansSGD<distance> ( n, dataset.begin(), dataset.end() );
+      MPI_Allreduce ( MPI_IN_PLACE, &written, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD );
+      if ( !written ) {
+         status = 1;
+         if ( rank == 0 ) clog << "Error: couldn't write output file " << outputPath << endl;
+      }
 
-         tmp->setBatchSize ( 1000 );
-         tmp->setStop ( -1, -1, 50 );
+      delete best;
+      if ( dataComm != MPI_COMM_WORLD ) MPI_Comm_free ( &dataComm );
+      MPI_Finalize();
+      return status;
+   }
 
-         solver = tmp;
+   // Range of numbers of clusters: one solver runs all the solves, each of which
+   // starts from the previous clustering with a cluster split in two
+   if ( sweep ) {
+      // The sequential method runs on process 0 only
+      if ( method == "sequential" && rank != 0 ) {
+         MPI_Finalize();
+         return 0;
       }
 
-      solver->setK ( k );
+      kMeansSolver * solver = single ? makeSolver ( method, datasetF, batchSize, staleness ) : makeSolver ( method, dataset, batchSize, staleness );
+      MPI_Comm solverComm = method == "sequential" ? MPI_COMM_SELF : MPI_COMM_WORLD;
+      int solverSize; MPI_Comm_size ( solverComm, &solverSize );
+
+      solver->setInit ( init );
+      solver->setAssignment ( assign );
+      if ( method != "sequential" ) {
+         solver->setThreads ( threads );
+         if ( !solver->setPersistentReduction ( persistent ) && rank == 0 && !suppressLog )
+            clog << "Persistent collectives are not supported by this MPI library" << endl;
+         if ( !solver->setRebalance ( rebalance ) && rank == 0 && !suppressLog )
+            clog << "Method " << method << " does not rebalance its points" << endl;
+      }
+
+      dataset.clear();
+      datasetF.clear();
+
+      timer totalTm;
+      totalTm.start();
+
+      // Centroids of the next solve, and time spent computing them
+      std::vector<double> start;
+      double splitTime = 0;
+
+      for ( int kk = k; kk <= lastK; ++kk ) {
+         solver->setK ( kk );
+         solver->setStartCentroids ( start );
+
+         timer tm;
+         tm.start();
+         solver->solve();
+         tm.stop();
+
+         double inertia = solver->inertia();
+         double purity = purityTest ? solver->purity() : 0;
+
+         if ( rank == 0 && !suppressLog ) {
+            clog << std::setw(10) << method << " | k " << std::setw(4) << kk << " | " << std::setw(2) << solverSize << " proc x "
+                 << std::setw(2) << solver->getThreads() << " thr | " << std::setw(10) << tm.getTime() << " msec | "
+                 << std::setw(10) << solver->getIter() << " iter | " << std::setw(12) << inertia << " inertia";
+            if ( purityTest ) clog << " | " << std::setw(10) << purity << " purity";
+            if ( kk > k ) clog << " | " << std::setw(10) << splitTime << " msec split";
+            clog << endl;
+         }
+
+         if ( kk < lastK ) {
+            timer splitTm;
+            splitTm.start();
+            start = solver->splitCentroids();
+            splitTm.stop();
+            splitTime = splitTm.getTime();
+         }
+      }
+
+      totalTm.stop();
+      if ( rank == 0 && !suppressLog && verbose )
+         clog << "Sweep of k from " << k << " to " << lastK << ": " << totalTm.getTime() << " msec" << endl;
+
+      // Results of the last solve are printed by process 0, or written to a file
+      // by all the processes
+      if ( !suppressOutput ) {
+         bool written = true;
+         if ( outputPath.empty() ) solver->printOutput ( cout, format );
+         else written = solver->writeOutput ( outputPath, format );
+
+         if ( !written ) {
+            status = 1;
+            if ( rank == 0 ) clog << "Error: couldn't write output file " << outputPath << endl;
+         }
+      }
+
+      delete solver;
+      MPI_Finalize();
+      return status;
+   }
+
+   std::vector<std::string> methods = { "sequential", "kmeans", "elkan", "hamerly", "yinyang", "kdtree", "kmeansSGD", "minibatch" };
 
-      if ( purityTest )
-         solver->setTrueLabels ( trueLabels.begin(), trueLabels.end() );
+   // Methods that skip distance computations, for which the fraction of
+   // skipped computations is reported
+   auto pruning = [] ( const std::string & m ) { return m == "elkan" || m == "hamerly" || m == "yinyang" || m == "kdtree"; };
+
+   for ( auto i : methods ) {
+      MPI_Barrier(MPI_COMM_WORLD);
+
+      if ( method != i && method != "compare" ) continue;
+      if ( i == "sequential" && (rank != 0 || method == "compare") ) continue;
+      if ( !methodApplies ( i, n ) ) continue;
+
+      // Allocate and configurate the solver
+      kMeansSolver * solver = single ? makeSolver ( i, datasetF, batchSize, staleness ) : makeSolver ( i, dataset, batchSize, staleness );
+
+      solver->setK ( k );
+      solver->setInit ( init );
+      solver->setAssignment ( assign );
+      solver->setProfiling ( profiling );
+      if ( i != "sequential" ) {
+         solver->setThreads ( threads );
+         if ( !solver->setPersistentReduction ( persistent ) && rank == 0 && !suppressLog )
+            clog << "Persistent collectives are not supported by this MPI library" << endl;
+         if ( !solver->setRebalance ( rebalance ) && rank == 0 && !suppressLog )
+            clog << "Method " << i << " does not rebalance its points" << endl;
+      }
 
       // We delete the dataset, if it is no longer necessary
       if ( method != "compare" ) {
-         dataset.resize(0, point(n));
-         trueLabels.resize(0);
+         dataset.clear();
+         datasetF.clear();
       }
 
       timer tm;
@@ -165,29 +730,80 @@ int main ( int argc, char * argv[] ) {
       tm.stop();
 
       double purity = purityTest ? solver->purity() : 0;
+      double inertia = verbose ? solver->inertia() : 0;
+
+      // Time per iteration, net of the initialization and of the construction
+      // of the auxiliary structures of the solver
+      double iterTime = ( tm.getTime() - solver->getInitTime() - solver->getBuildTime() ) / std::max ( 1u, solver->getIter() );
 
       if ( rank == 0 && !suppressLog ) {
          if ( verbose ) {
             clog << "Method: " << i << endl;
+            clog << "Processes x threads: " << size << " x " << solver->getThreads() << endl;
             clog << "Elapsed time: " << tm.getTime() << " msec" << endl;
+            clog << "Assignment: " << assignName ( solver->getAssignment() ) << endl;
+            clog << "Initialization: " << initName ( solver->getInit() ) << ", " << solver->getInitTime() << " msec" << endl;
+            if ( solver->getBuildTime() > 0 ) clog << "Build time (process 0): " << solver->getBuildTime() << " msec" << endl;
+            clog << "Iteration time: " << iterTime << " msec/iter" << endl;
+            if ( i != "sequential" )
+               clog << "Communication time (process 0): " << solver->getCommTime() << " msec, "
+                    << solver->getCommTime() / std::max ( 1u, solver->getIter() ) << " msec/iter" << endl;
+            if ( solver->getMigrations() > 0 )
+               clog << "Rebalancing: " << solver->getMigrations() << " migrations, "
+                    << solver->getMigratedPoints() << " points moved" << endl;
+            if ( solver->getOverlapTime() > 0 )
+               clog << "Reductions in flight while computing (process 0): " << solver->getOverlapTime() << " msec" << endl;
+            clog << "Local dataset memory (process 0): " << solver->getDatasetFootprint() / 1048576.0 << " MB" << endl;
             clog << "Converged in " << solver->getIter() << " iterations" << endl;
+            if ( pruning(i) ) clog << "Distances skipped: " << 100 * solver->getSkippedDistances() << "%" << endl;
+            clog << "Inertia: " << inertia << endl;
             if ( purityTest ) clog << "Clustering purity: " << purity << endl;
             clog << "-----------------------------------------" << endl;
          }
 
          else {
-            clog << std::setw(10) << i << " | " << std::setw(2) << size << " proc | "
+            clog << std::setw(10) << i << " | " << std::setw(2) << size << " proc x "
+                 << std::setw(2) << solver->getThreads() << " thr | "
                  << std::setw(10) << tm.getTime() << " msec | " << std::setw(10) << solver->getIter() << " iter";
             if ( purityTest ) clog << " | " << std::setw(10) << purity << " purity";
+            if ( pruning(i) ) clog << " | " << std::setw(6) << std::setprecision(3) << 100 * solver->getSkippedDistances() << std::setprecision(6) << "% skip";
+            if ( solver->getBuildTime() > 0 ) clog << " | " << std::setw(10) << solver->getBuildTime() << " msec build | " << std::setw(10) << iterTime << " msec/iter";
             clog << endl;
          }
       }
 
-      if ( !suppressOutput && method != "compare" ) solver->printOutput( cout );
+      // The profile is aggregated over the processes of the solver, and
+      // reported by process 0
+      if ( profiling ) {
+         profileSummary summary = solver->getProfile();
+
+         if ( rank == 0 ) {
+            if ( profileArg == "json" ) printProfileJson ( clog, i, summary );
+            else printProfileTable ( clog, i, summary );
+         }
+      }
+
+      // Results are printed by process 0, or written to a file by all the
+      // processes
+      if ( !suppressOutput && method != "compare" ) {
+         timer outTm;
+         bool written = true;
+
+         outTm.start();
+         if ( outputPath.empty() ) solver->printOutput ( cout, format );
+         else written = solver->writeOutput ( outputPath, format );
+         outTm.stop();
+         if ( !written ) status = 1;
+
+         if ( rank == 0 && !suppressLog ) {
+            if ( !written ) clog << "Error: couldn't write output file " << outputPath << endl;
+            else if ( verbose ) clog << "Output (" << resultsFormatName ( format ) << "): " << outTm.getTime() << " msec" << endl;
+         }
+      }
 
       delete solver;
    }
 
    MPI_Finalize ();
-   return 0;
+   return status;
 }
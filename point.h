@@ -64,6 +64,11 @@ point operator- ( const point &, const point & );
 point& operator+= ( point &, const point & );
 point operator/ ( const point &, double );
 
+// MPI datatype of the coordinates of type T (double or float)
+template < typename T > MPI_Datatype mpiDatatype ( void );
+template <> inline MPI_Datatype mpiDatatype<double> ( void ) { return MPI_DOUBLE; }
+template <> inline MPI_Datatype mpiDatatype<float> ( void ) { return MPI_FLOAT; }
+
 // Sum points across processes
 // Used for parallel computation of the centroids
 void mpi_point_allreduce ( point* );
@@ -0,0 +1,126 @@
+#include "profiler.h"
+
+#include <algorithm>
+#include <iomanip>
+
+const char * phaseName ( solverPhase p ) {
+   switch ( p ) {
+      case solverPhase::initialization: return "initialization";
+      case solverPhase::assignment: return "assignment";
+      case solverPhase::accumulation: return "accumulation";
+      case solverPhase::reduction: return "reduction";
+      case solverPhase::update: return "update";
+      case solverPhase::stopping: return "stopping";
+   }
+   return "";
+}
+
+const char * counterName ( solverCounter c ) {
+   switch ( c ) {
+      case solverCounter::assigned: return "assigned";
+      case solverCounter::changes: return "changes";
+      case solverCounter::reduced: return "reduced";
+   }
+   return "";
+}
+
+void solverProfile::clear ( void ) {
+   open = false;
+   times.fill ( 0 );
+   calls.fill ( 0 );
+   counters.fill ( 0 );
+   iterations.clear();
+}
+
+profileSummary summarizeProfile ( const solverProfile & profile, MPI_Comm comm ) {
+   profileSummary s;
+   MPI_Comm_size ( comm, &s.processes );
+   int rank; MPI_Comm_rank ( comm, &rank );
+
+   std::array<double, solverPhases> times;
+   for ( unsigned int p = 0; p < solverPhases; ++p ) {
+      times[p] = profile.getTime ( solverPhase(p) );
+      s.calls[p] = profile.getCalls ( solverPhase(p) );
+   }
+
+   MPI_Allreduce ( times.data(), s.minTime.data(), solverPhases, MPI_DOUBLE, MPI_MIN, comm );
+   MPI_Allreduce ( times.data(), s.maxTime.data(), solverPhases, MPI_DOUBLE, MPI_MAX, comm );
+   MPI_Allreduce ( times.data(), s.meanTime.data(), solverPhases, MPI_DOUBLE, MPI_SUM, comm );
+   for ( auto & t : s.meanTime ) t /= s.processes;
+
+   // Calls are those of process 0, as all the processes enter the same phases
+   MPI_Bcast ( s.calls.data(), solverPhases, MPI_UNSIGNED_LONG, 0, comm );
+
+   for ( unsigned int c = 0; c < solverCounters; ++c )
+      s.counters[c] = profile.getCounter ( solverCounter(c) );
+   MPI_Allreduce ( MPI_IN_PLACE, s.counters.data(), solverCounters, MPI_DOUBLE, MPI_SUM, comm );
+
+   // Iterations are synchronized by the reductions, so the time of each one is
+   // that of the slowest process; processes that ran fewer of them count 0
+   unsigned int local = profile.getIterations().size();
+   MPI_Allreduce ( &local, &s.iterations, 1, MPI_UNSIGNED, MPI_MAX, comm );
+
+   std::vector<double> iterations ( profile.getIterations() );
+   iterations.resize ( s.iterations, 0 );
+   MPI_Allreduce ( MPI_IN_PLACE, iterations.data(), s.iterations, MPI_DOUBLE, MPI_MAX, comm );
+
+   if ( s.iterations > 0 ) {
+      for ( double t : iterations ) s.iterTotal += t;
+      s.iterMean = s.iterTotal / s.iterations;
+      s.iterMin = *std::min_element ( iterations.begin(), iterations.end() );
+      s.iterMax = *std::max_element ( iterations.begin(), iterations.end() );
+   }
+
+   return s;
+}
+
+void printProfileTable ( std::ostream & out, const std::string & method, const profileSummary & s ) {
+   std::ios::fmtflags flags = out.flags();
+   std::streamsize precision = out.precision();
+
+   out << "Profile of " << method << " (" << s.processes << " processes, " << s.iterations << " iterations)" << std::endl;
+   out << std::setw(16) << "phase" << std::setw(10) << "calls" << std::setw(12) << "min msec" << std::setw(12) << "mean msec"
+       << std::setw(12) << "max msec" << std::setw(11) << "max/mean" << std::endl;
+
+   out << std::fixed << std::setprecision(3);
+   for ( unsigned int p = 0; p < solverPhases; ++p ) {
+      if ( s.calls[p] == 0 ) continue;
+      out << std::setw(16) << phaseName ( solverPhase(p) ) << std::setw(10) << s.calls[p] << std::setw(12) << s.minTime[p]
+          << std::setw(12) << s.meanTime[p] << std::setw(12) << s.maxTime[p]
+          << std::setw(11) << ( s.meanTime[p] > 0 ? s.maxTime[p] / s.meanTime[p] : 1.0 ) << std::endl;
+   }
+
+   if ( s.iterations > 0 )
+      out << "Iterations: " << s.iterTotal << " msec, " << s.iterMean << " msec/iter (min " << s.iterMin
+          << ", max " << s.iterMax << ")" << std::endl;
+
+   out << std::defaultfloat << std::setprecision(precision);
+   out << "Counters:";
+   for ( unsigned int c = 0; c < solverCounters; ++c )
+      out << " " << counterName ( solverCounter(c) ) << " " << s.counters[c];
+   out << std::endl;
+
+   out.flags ( flags );
+}
+
+void printProfileJson ( std::ostream & out, const std::string & method, const profileSummary & s ) {
+   std::streamsize precision = out.precision();
+   out << std::setprecision(9);
+
+   out << "{\"method\":\"" << method << "\",\"processes\":" << s.processes << ",\"iterations\":" << s.iterations << ",\"phases\":{";
+   bool first = true;
+   for ( unsigned int p = 0; p < solverPhases; ++p ) {
+      if ( s.calls[p] == 0 ) continue;
+      out << ( first ? "" : "," ) << "\"" << phaseName ( solverPhase(p) ) << "\":{\"calls\":" << s.calls[p]
+          << ",\"min_ms\":" << s.minTime[p] << ",\"mean_ms\":" << s.meanTime[p] << ",\"max_ms\":" << s.maxTime[p] << "}";
+      first = false;
+   }
+
+   out << "},\"iteration_ms\":{\"total\":" << s.iterTotal << ",\"mean\":" << s.iterMean << ",\"min\":" << s.iterMin
+       << ",\"max\":" << s.iterMax << "},\"counters\":{";
+   for ( unsigned int c = 0; c < solverCounters; ++c )
+      out << ( c ? "," : "" ) << "\"" << counterName ( solverCounter(c) ) << "\":" << s.counters[c];
+   out << "}}" << std::endl;
+
+   out << std::setprecision(precision);
+}
@@ -0,0 +1,175 @@
+#ifndef _PROFILER_H
+#define _PROFILER_H
+
+#include "timer.h"
+
+#include <mpi.h>
+#include <array>
+#include <vector>
+#include <string>
+#include <ostream>
+
+// Instrumentation of the solvers: time spent in each phase of their iterations,
+// time of each iteration and counters of the work done
+// Solvers mark the phases with PROFILE_PHASE, which times the rest of the
+// enclosing scope, and the iterations with PROFILE_ITERATION; nothing is
+// recorded unless profiling is enabled on the solver, and the macros compile
+// to nothing unless KMEANS_PROFILE is defined (make PROFILE=F)
+// Phases do not nest: a phase opened while another one is open is counted in
+// the latter (e.g. the reduction of the initial centroids is initialization)
+
+// Phases of a solve
+enum class solverPhase {
+   initialization, // Initial labels and centroids
+   assignment,     // Search of the nearest centroids
+   accumulation,   // Sums and counts of the clusters, label changes
+   reduction,      // Collectives across the processes
+   update,         // New centroids from the sums
+   stopping        // Displacement of the centroids and stopping criteria
+};
+
+constexpr unsigned int solverPhases = 6;
+
+// Counters of the work done by a solve
+enum class solverCounter {
+   assigned,  // Points whose nearest centroid was searched
+   changes,   // Label changes
+   reduced    // Values summed across the processes
+};
+
+constexpr unsigned int solverCounters = 3;
+
+const char * phaseName ( solverPhase );
+const char * counterName ( solverCounter );
+
+// True if the instrumentation is compiled in
+#ifdef KMEANS_PROFILE
+constexpr bool profilingCompiled = true;
+#else
+constexpr bool profilingCompiled = false;
+#endif
+
+// Measurements of a process over the last solve
+class solverProfile {
+private:
+   bool enabled = false;
+
+   // A phase is being timed
+   bool open = false;
+
+   // Time of each phase (milliseconds) and number of times it was entered
+   std::array<double, solverPhases> times {};
+   std::array<unsigned long, solverPhases> calls {};
+
+   std::array<double, solverCounters> counters {};
+
+   // Time of each iteration, in milliseconds
+   std::vector<double> iterations;
+
+   friend class profileScope;
+
+public:
+   void setEnabled ( bool e ) { enabled = e; }
+   bool isEnabled ( void ) const { return enabled; }
+
+   // Clears the measurements, at the start of a solve
+   void clear ( void );
+
+   void addIteration ( double t ) { iterations.push_back ( t ); }
+   void count ( solverCounter c, double v ) { if ( enabled ) counters[unsigned(c)] += v; }
+
+   double getTime ( solverPhase p ) const { return times[unsigned(p)]; }
+   unsigned long getCalls ( solverPhase p ) const { return calls[unsigned(p)]; }
+   double getCounter ( solverCounter c ) const { return counters[unsigned(c)]; }
+   const std::vector<double> & getIterations ( void ) const { return iterations; }
+};
+
+// Times the phase from its construction to its destruction, if profiling is
+// enabled and no other phase is open
+class profileScope {
+private:
+   solverProfile * profile = nullptr;
+   solverPhase phase;
+   timer tm;
+
+public:
+   profileScope ( solverProfile & p, solverPhase ph ) : phase(ph) {
+      if ( !p.enabled || p.open ) return;
+      profile = &p;
+      profile->open = true;
+      tm.start();
+   }
+
+   ~profileScope ( void ) {
+      if ( !profile ) return;
+      tm.stop();
+      profile->times[unsigned(phase)] += tm.getTime();
+      profile->calls[unsigned(phase)] += 1;
+      profile->open = false;
+   }
+
+   profileScope ( const profileScope & ) = delete;
+   profileScope & operator= ( const profileScope & ) = delete;
+};
+
+// Times an iteration, from its construction to its destruction
+class iterationScope {
+private:
+   solverProfile * profile = nullptr;
+   timer tm;
+
+public:
+   iterationScope ( solverProfile & p ) {
+      if ( !p.isEnabled() ) return;
+      profile = &p;
+      tm.start();
+   }
+
+   ~iterationScope ( void ) {
+      if ( !profile ) return;
+      tm.stop();
+      profile->addIteration ( tm.getTime() );
+   }
+
+   iterationScope ( const iterationScope & ) = delete;
+   iterationScope & operator= ( const iterationScope & ) = delete;
+};
+
+#ifdef KMEANS_PROFILE
+#define PROFILE_JOIN2(a, b) a##b
+#define PROFILE_JOIN(a, b) PROFILE_JOIN2(a, b)
+#define PROFILE_PHASE(profile, phase) profileScope PROFILE_JOIN(profilePhase, __LINE__) ( profile, solverPhase::phase )
+#define PROFILE_ITERATION(profile) iterationScope PROFILE_JOIN(profileIteration, __LINE__) ( profile )
+#define PROFILE_COUNT(profile, counter, value) (profile).count ( solverCounter::counter, value )
+#else
+#define PROFILE_PHASE(profile, phase) ((void) 0)
+#define PROFILE_ITERATION(profile) ((void) 0)
+#define PROFILE_COUNT(profile, counter, value) ((void) 0)
+#endif
+
+// Measurements of a solve aggregated over the processes that ran it
+// Phase times are summed over the solve on each process, then their minimum,
+// mean and maximum over the processes are taken, exposing load imbalance
+// Iteration times are those of the slowest process at each iteration
+struct profileSummary {
+   int processes = 1;
+   unsigned int iterations = 0;
+
+   std::array<double, solverPhases> minTime {}, meanTime {}, maxTime {};
+   std::array<unsigned long, solverPhases> calls {};
+
+   // Counters summed over the processes
+   std::array<double, solverCounters> counters {};
+
+   // Time of the iterations: total, mean, fastest and slowest
+   double iterTotal = 0, iterMean = 0, iterMin = 0, iterMax = 0;
+};
+
+// Aggregates the profile of each process of comm; collective over comm
+profileSummary summarizeProfile ( const solverProfile &, MPI_Comm );
+
+// Report of the summary of a method, as a table or as a JSON object on a line
+void printProfileTable ( std::ostream &, const std::string &, const profileSummary & );
+void printProfileJson ( std::ostream &, const std::string &, const profileSummary & );
+
+#endif
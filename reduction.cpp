@@ -0,0 +1,101 @@
+#include "reduction.h"
+
+#include <algorithm>
+
+#ifdef OPEN_MPI
+#include <mpi-ext.h>
+#endif
+
+// Persistent allreduce: standard since MPI 4, an extension in Open MPI before
+#if MPI_VERSION >= 4
+#define KMEANS_ALLREDUCE_INIT MPI_Allreduce_init
+#elif defined(OMPI_HAVE_MPI_EXT_PCOLLREQ) && OMPI_HAVE_MPI_EXT_PCOLLREQ
+#define KMEANS_ALLREDUCE_INIT MPIX_Allreduce_init
+#endif
+
+void allreduceBuffer::freeRequest ( void ) {
+   if ( request != MPI_REQUEST_NULL ) MPI_Request_free ( &request );
+   request = MPI_REQUEST_NULL;
+}
+
+void allreduceBuffer::reset ( std::size_t count ) {
+   if ( count != values.size() ) {
+      freeRequest();
+      values.assign ( count, 0 );
+   }
+
+   else std::fill ( values.begin(), values.end(), 0 );
+}
+
+bool allreduceBuffer::setPersistent ( bool p ) {
+   freeRequest();
+
+#ifdef KMEANS_ALLREDUCE_INIT
+   persistent = p;
+   return true;
+#else
+   persistent = false;
+   return !p;
+#endif
+}
+
+void allreduceBuffer::reduce ( void ) {
+   double begin = MPI_Wtime();
+
+#ifdef KMEANS_ALLREDUCE_INIT
+   if ( persistent ) {
+      if ( request == MPI_REQUEST_NULL )
+         KMEANS_ALLREDUCE_INIT ( MPI_IN_PLACE, values.data(), values.size(), MPI_DOUBLE, MPI_SUM, comm, MPI_INFO_NULL, &request );
+
+      MPI_Start ( &request );
+      MPI_Wait ( &request, MPI_STATUS_IGNORE );
+   }
+
+   else
+#endif
+   MPI_Allreduce ( MPI_IN_PLACE, values.data(), values.size(), MPI_DOUBLE, MPI_SUM, comm );
+
+   commTime += ( MPI_Wtime() - begin ) * 1000;
+   ++calls;
+}
+
+void allreduceBuffer::start ( void ) {
+   double begin = MPI_Wtime();
+
+#ifdef KMEANS_ALLREDUCE_INIT
+   if ( persistent ) {
+      if ( request == MPI_REQUEST_NULL )
+         KMEANS_ALLREDUCE_INIT ( MPI_IN_PLACE, values.data(), values.size(), MPI_DOUBLE, MPI_SUM, comm, MPI_INFO_NULL, &request );
+
+      MPI_Start ( &request );
+   }
+
+   else
+#endif
+   MPI_Iallreduce ( MPI_IN_PLACE, values.data(), values.size(), MPI_DOUBLE, MPI_SUM, comm, &pending );
+
+   started = MPI_Wtime();
+   inFlight = true;
+   commTime += ( started - begin ) * 1000;
+}
+
+void allreduceBuffer::wait ( void ) {
+   if ( !inFlight ) return;
+   inFlight = false;
+
+   double begin = MPI_Wtime();
+   overlapTime += ( begin - started ) * 1000;
+
+   MPI_Wait ( persistent ? &request : &pending, MPI_STATUS_IGNORE );
+
+   commTime += ( MPI_Wtime() - begin ) * 1000;
+   ++calls;
+}
+
+bool allreduceBuffer::test ( void ) {
+   if ( !inFlight ) return true;
+
+   int done = 0;
+   MPI_Test ( persistent ? &request : &pending, &done, MPI_STATUS_IGNORE );
+   return done;
+}
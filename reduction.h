@@ -0,0 +1,80 @@
+#ifndef _REDUCTION_H
+#define _REDUCTION_H
+
+#include <mpi.h>
+#include <vector>
+#include <cstddef>
+
+// Contiguous buffer of doubles summed across processes with a single collective
+// The parallel solvers pack in it all the values they need to reduce at each
+// iteration (sums of the points, cluster sizes, label changes...), so that
+// every iteration costs the latency of one allreduce only
+// If persistent mode is enabled and the MPI library supports persistent
+// collectives (MPI 4, or the Open MPI extension), the allreduce is set up once
+// and then only started at each iteration; otherwise MPI_Allreduce is used
+// The reduction can also be started and completed separately, so that the
+// caller computes something else while it is in flight; the values must not be
+// touched in between
+class allreduceBuffer {
+private:
+   std::vector<double> values;
+   MPI_Comm comm;
+
+   // Persistent request, if set up (MPI_REQUEST_NULL otherwise)
+   bool persistent = false;
+   MPI_Request request = MPI_REQUEST_NULL;
+
+   // Request of the non-blocking reduction in flight, if not persistent
+   MPI_Request pending = MPI_REQUEST_NULL;
+
+   void freeRequest ( void );
+
+   // Time spent in the collectives, in milliseconds, and number of them
+   double commTime = 0;
+   unsigned int calls = 0;
+
+   // Time between the start of the reductions and the call completing them,
+   // spent by the caller doing something else (milliseconds), summed over the
+   // reductions even when several are in flight at once, and when the last
+   // one was started
+   double overlapTime = 0;
+   double started = 0;
+   bool inFlight = false;
+
+public:
+   allreduceBuffer ( MPI_Comm cc = MPI_COMM_WORLD ) : comm(cc) { }
+   ~allreduceBuffer ( void ) { freeRequest(); }
+
+   allreduceBuffer ( const allreduceBuffer & ) = delete;
+   allreduceBuffer & operator= ( const allreduceBuffer & ) = delete;
+
+   // Sets the size of the buffer and clears its values
+   // A persistent request is set up again only if the size changes
+   void reset ( std::size_t );
+
+   double * data ( void ) { return values.data(); }
+   double & operator[] ( std::size_t i ) { return values[i]; }
+   std::size_t size ( void ) const { return values.size(); }
+
+   // Sums the values across the processes, in place
+   void reduce ( void );
+
+   // Starts the sum without waiting for it, then completes it (wait does
+   // nothing if no sum was started); test checks whether it has completed,
+   // which also lets MPI progress it
+   void start ( void );
+   void wait ( void );
+   bool test ( void );
+
+   // Persistent mode get and set
+   // Returns false if persistent collectives are not supported
+   bool setPersistent ( bool );
+   bool getPersistent ( void ) const { return persistent; }
+
+   // Communication statistics
+   double getCommTime ( void ) const { return commTime; }
+   unsigned int getCalls ( void ) const { return calls; }
+   double getOverlapTime ( void ) const { return overlapTime; }
+};
+
+#endif
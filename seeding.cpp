@@ -0,0 +1,17 @@
+#include "seeding.h"
+
+bool parseInit ( const std::string & name, kMeansInit & init ) {
+   if ( name == "random" ) init = kMeansInit::random;
+   else if ( name == "kmeans++" ) init = kMeansInit::kmeansPlusPlus;
+   else if ( name == "kmeans-parallel" ) init = kMeansInit::kmeansParallel;
+   else return false;
+   return true;
+}
+
+const char * initName ( kMeansInit init ) {
+   switch ( init ) {
+      case kMeansInit::kmeansPlusPlus: return "kmeans++";
+      case kMeansInit::kmeansParallel: return "kmeans-parallel";
+      default: return "random";
+   }
+}
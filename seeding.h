@@ -0,0 +1,356 @@
+#ifndef _SEEDING_H
+#define _SEEDING_H
+
+#include "point.h"
+#include "dataset.h"
+#include "thread_pool.h"
+
+#include <mpi.h>
+#include <vector>
+#include <string>
+#include <random>
+#include <limits>
+#include <algorithm>
+#include <cmath>
+
+// Initialization methods of the solvers
+// random : each point gets a uniformly random label
+// kmeansPlusPlus : k-means++ seeding, each center being drawn with probability
+//    proportional to the squared distance from the nearest center drawn so far
+//    (greedy variant: a few candidates are drawn at each step, and the one that
+//    reduces the most the sum of the squared distances is kept)
+// kmeansParallel : k-means|| seeding, where a few rounds draw many candidates at
+//    once, which are then reduced to k centers with a weighted k-means++
+enum class kMeansInit { random, kmeansPlusPlus, kmeansParallel };
+
+// Conversion from and to the names used on the command line
+// (random, kmeans++, kmeans-parallel); parsing returns false on unknown names
+bool parseInit ( const std::string &, kMeansInit & );
+const char * initName ( kMeansInit );
+
+// Seeding of the centers of the clusters over a dataset split among the
+// processes of a communicator
+// Each process holds its own portion of the dataset; all of them take part in
+// the sampling and end up with the same centers. Random draws that must agree
+// across processes use an engine with the same seed on all of them
+// The Metric type is a callable returning the metric distance between two
+// points given as pointers to their coordinates, which are of type real, as
+// those of the dataset and of the centers
+template < typename Metric, typename real = double >
+class kMeansSeeder {
+private:
+   const basicDataset<real> & data;
+   Metric metric;
+   MPI_Comm comm;
+   threadPool & pool;
+
+   unsigned int n;
+   int rank = 0, size = 1;
+
+   // Index of the first point of each process in the complete dataset, and
+   // size of the complete dataset
+   std::vector<unsigned long> offsets;
+   unsigned long globalSize = 0;
+
+   // Squared distance of each local point from the nearest center so far, and
+   // index of that center
+   std::vector<double> minDist2;
+   std::vector<unsigned int> nearest;
+
+   // Engine shared by all the processes, and engine of this process only
+   std::mt19937_64 shared;
+   std::mt19937_64 local;
+
+   // Updates the distances of the local points with the given centers
+   void update ( const std::vector<real> &, std::size_t );
+
+   // Sum of the squared distances over the local points
+   double localPotential ( void ) const;
+
+   // Coordinates of the point of global index i, broadcast by its owner
+   std::vector<real> fetch ( unsigned long );
+
+   // Draws points with probability proportional to their squared distance
+   // from the nearest center (uniformly if all the distances are zero)
+   std::vector<real> drawWeighted ( unsigned int );
+
+   // Number of candidates drawn at each step of greedy k-means++
+   static unsigned int trials ( unsigned int k ) { return 2 + unsigned ( std::log ( double(k) ) ); }
+
+   // Weighted greedy k-means++ among a set of candidates, computed by each
+   // process on its own (with the same result on all of them)
+   std::vector<real> reduce ( const std::vector<real> &, const std::vector<double> &, unsigned int );
+
+public:
+   kMeansSeeder ( const basicDataset<real> &, Metric, MPI_Comm, threadPool &, unsigned long = 1 );
+
+   // Centers of the clusters, as k rows of n coordinates
+   std::vector<real> plusPlus ( unsigned int );
+   std::vector<real> parallel ( unsigned int, unsigned int = 5, double = 2 );
+};
+
+template < typename Metric, typename real >
+kMeansSeeder<Metric, real>::kMeansSeeder ( const basicDataset<real> & dd, Metric mm, MPI_Comm cc, threadPool & pp, unsigned long seed )
+   : data(dd), metric(mm), comm(cc), pool(pp), n(dd.getN()), shared(seed) {
+   MPI_Comm_rank ( comm, &rank );
+   MPI_Comm_size ( comm, &size );
+   local.seed ( seed * 7919 + rank + 1 );
+
+   std::vector<unsigned long> sizes ( size );
+   unsigned long localSize = data.size();
+   MPI_Allgather ( &localSize, 1, MPI_UNSIGNED_LONG, sizes.data(), 1, MPI_UNSIGNED_LONG, comm );
+
+   offsets.assign ( size + 1, 0 );
+   for ( int r = 0; r < size; ++r ) offsets[r+1] = offsets[r] + sizes[r];
+   globalSize = offsets[size];
+
+   minDist2.assign ( data.size(), std::numeric_limits<double>::infinity() );
+   nearest.assign ( data.size(), 0 );
+}
+
+template < typename Metric, typename real >
+void kMeansSeeder<Metric, real>::update ( const std::vector<real> & centers, std::size_t first ) {
+   std::size_t count = centers.size() / n;
+   unsigned int threads = pool.size();
+
+   pool.run ( [&] ( unsigned int t ) {
+      unsigned int begin = 0, share = 0;
+      datasetPartition ( data.size(), t, threads, begin, share );
+      std::vector<real> buf ( n );
+
+      for ( unsigned int i = begin; i < begin + share; ++i ) {
+         const real * x = data.getPoint ( i, buf.data() );
+         for ( std::size_t c = first; c < count; ++c ) {
+            double d = metric ( x, centers.data() + c * n );
+            if ( d * d < minDist2[i] ) {
+               minDist2[i] = d * d;
+               nearest[i] = c;
+            }
+         }
+      }
+   } );
+}
+
+template < typename Metric, typename real >
+double kMeansSeeder<Metric, real>::localPotential ( void ) const {
+   double sum = 0;
+   for ( double d : minDist2 ) sum += d;
+   return sum;
+}
+
+template < typename Metric, typename real >
+std::vector<real> kMeansSeeder<Metric, real>::fetch ( unsigned long i ) {
+   int owner = std::upper_bound ( offsets.begin(), offsets.end(), i ) - offsets.begin() - 1;
+   std::vector<real> result ( n );
+
+   if ( owner == rank ) {
+      const real * x = data.getPoint ( i - offsets[rank], result.data() );
+      std::copy ( x, x + n, result.begin() );
+   }
+
+   MPI_Bcast ( result.data(), n, mpiDatatype<real>(), owner, comm );
+   return result;
+}
+
+template < typename Metric, typename real >
+std::vector<real> kMeansSeeder<Metric, real>::drawWeighted ( unsigned int count ) {
+   std::vector<double> potentials ( size );
+   double mine = localPotential();
+   MPI_Allgather ( &mine, 1, MPI_DOUBLE, potentials.data(), 1, MPI_DOUBLE, comm );
+
+   double total = 0;
+   for ( double p : potentials ) total += p;
+
+   // Global indices of the drawn points: the owner of each of them is found
+   // from the potentials of the processes, then it finds the point among its
+   // own and the others contribute zero to the reduction
+   std::vector<unsigned long> indices ( count, 0 );
+
+   for ( unsigned int j = 0; j < count; ++j ) {
+      if ( !( total > 0 ) ) {
+         unsigned long i = std::uniform_int_distribution<unsigned long> ( 0, globalSize - 1 ) ( shared );
+         if ( rank == 0 ) indices[j] = i;
+         continue;
+      }
+
+      double target = std::uniform_real_distribution<double> ( 0, total ) ( shared );
+      int owner = 0;
+      while ( owner < size - 1 && ( target >= potentials[owner] || potentials[owner] == 0 ) ) {
+         target -= potentials[owner];
+         ++owner;
+      }
+
+      if ( owner == rank ) {
+         unsigned long i = 0, last = 0;
+         for ( ; i < minDist2.size(); ++i ) {
+            if ( minDist2[i] > 0 ) last = i;
+            if ( target < minDist2[i] ) break;
+            target -= minDist2[i];
+         }
+         indices[j] = offsets[rank] + ( i < minDist2.size() ? i : last );
+      }
+   }
+
+   MPI_Allreduce ( MPI_IN_PLACE, indices.data(), count, MPI_UNSIGNED_LONG, MPI_SUM, comm );
+
+   std::vector<real> points;
+   for ( unsigned long i : indices ) {
+      std::vector<real> x = fetch ( i );
+      points.insert ( points.end(), x.begin(), x.end() );
+   }
+   return points;
+}
+
+template < typename Metric, typename real >
+std::vector<real> kMeansSeeder<Metric, real>::plusPlus ( unsigned int k ) {
+   std::vector<real> centers = fetch ( std::uniform_int_distribution<unsigned long> ( 0, globalSize - 1 ) ( shared ) );
+   update ( centers, 0 );
+
+   unsigned int ntrials = trials ( k );
+   unsigned int threads = pool.size();
+
+   for ( unsigned int c = 1; c < k; ++c ) {
+      std::vector<real> candidates = drawWeighted ( ntrials );
+
+      // Potential that each candidate would leave, if added to the centers
+      std::vector<std::vector<double>> threadPotentials ( threads, std::vector<double>(ntrials, 0) );
+
+      pool.run ( [&] ( unsigned int t ) {
+         unsigned int begin = 0, share = 0;
+         datasetPartition ( data.size(), t, threads, begin, share );
+         std::vector<real> buf ( n );
+
+         for ( unsigned int i = begin; i < begin + share; ++i ) {
+            const real * x = data.getPoint ( i, buf.data() );
+            for ( unsigned int j = 0; j < ntrials; ++j ) {
+               double d = metric ( x, candidates.data() + std::size_t(j) * n );
+               threadPotentials[t][j] += std::min ( minDist2[i], d * d );
+            }
+         }
+      } );
+
+      std::vector<double> potentials ( ntrials, 0 );
+      for ( unsigned int t = 0; t < threads; ++t )
+         for ( unsigned int j = 0; j < ntrials; ++j )
+            potentials[j] += threadPotentials[t][j];
+
+      MPI_Allreduce ( MPI_IN_PLACE, potentials.data(), ntrials, MPI_DOUBLE, MPI_SUM, comm );
+
+      unsigned int best = std::min_element ( potentials.begin(), potentials.end() ) - potentials.begin();
+      centers.insert ( centers.end(), candidates.begin() + std::size_t(best) * n, candidates.begin() + std::size_t(best+1) * n );
+      update ( centers, c );
+   }
+
+   return centers;
+}
+
+template < typename Metric, typename real >
+std::vector<real> kMeansSeeder<Metric, real>::parallel ( unsigned int k, unsigned int rounds, double oversampling ) {
+   std::vector<real> candidates = fetch ( std::uniform_int_distribution<unsigned long> ( 0, globalSize - 1 ) ( shared ) );
+   update ( candidates, 0 );
+
+   // Each round, every point becomes a candidate independently, with
+   // probability proportional to its squared distance from the candidates so
+   // far; about oversampling * k candidates are drawn per round
+   for ( unsigned int r = 0; r < rounds; ++r ) {
+      double potential = localPotential();
+      MPI_Allreduce ( MPI_IN_PLACE, &potential, 1, MPI_DOUBLE, MPI_SUM, comm );
+      if ( !( potential > 0 ) ) break;
+
+      std::vector<real> drawn, buf ( n );
+      std::uniform_real_distribution<double> unif ( 0, 1 );
+      for ( unsigned int i = 0; i < data.size(); ++i ) {
+         if ( unif(local) < oversampling * k * minDist2[i] / potential ) {
+            const real * x = data.getPoint ( i, buf.data() );
+            drawn.insert ( drawn.end(), x, x + n );
+         }
+      }
+
+      // New candidates are gathered by all the processes
+      int count = drawn.size();
+      std::vector<int> counts ( size ), displs ( size, 0 );
+      MPI_Allgather ( &count, 1, MPI_INT, counts.data(), 1, MPI_INT, comm );
+      for ( int p = 1; p < size; ++p ) displs[p] = displs[p-1] + counts[p-1];
+
+      std::size_t first = candidates.size() / n;
+      candidates.resize ( candidates.size() + displs[size-1] + counts[size-1] );
+      MPI_Allgatherv ( drawn.data(), count, mpiDatatype<real>(), candidates.data() + first * n,
+                       counts.data(), displs.data(), mpiDatatype<real>(), comm );
+
+      update ( candidates, first );
+   }
+
+   // Candidates are weighted by the number of points nearest to them
+   std::size_t ncand = candidates.size() / n;
+   std::vector<double> weights ( ncand, 0 );
+   for ( unsigned int i = 0; i < data.size(); ++i )
+      weights[nearest[i]] += 1;
+   MPI_Allreduce ( MPI_IN_PLACE, weights.data(), ncand, MPI_DOUBLE, MPI_SUM, comm );
+
+   return reduce ( candidates, weights, k );
+}
+
+template < typename Metric, typename real >
+std::vector<real> kMeansSeeder<Metric, real>::reduce ( const std::vector<real> & candidates, const std::vector<double> & weights, unsigned int k ) {
+   std::size_t ncand = candidates.size() / n;
+
+   // With fewer candidates than clusters (tiny datasets), all of them are
+   // kept and the rest are drawn as in k-means++
+   if ( ncand <= k ) {
+      std::vector<real> centers = candidates;
+      update ( centers, 0 );
+      for ( std::size_t c = ncand; c < k; ++c ) {
+         std::vector<real> next = drawWeighted ( 1 );
+         centers.insert ( centers.end(), next.begin(), next.end() );
+         update ( centers, c );
+      }
+      return centers;
+   }
+
+   // Weighted squared distance of each candidate from the nearest center
+   std::vector<double> d2 ( ncand, std::numeric_limits<double>::infinity() );
+   auto add = [&] ( std::size_t c, std::vector<real> & centers ) {
+      const real * center = candidates.data() + c * n;
+      centers.insert ( centers.end(), center, center + n );
+      for ( std::size_t j = 0; j < ncand; ++j ) {
+         double d = metric ( candidates.data() + j * n, center );
+         d2[j] = std::min ( d2[j], d * d );
+      }
+   };
+
+   std::vector<real> centers;
+   add ( std::discrete_distribution<std::size_t> ( weights.begin(), weights.end() ) ( shared ), centers );
+
+   unsigned int ntrials = trials ( k );
+   for ( unsigned int kk = 1; kk < k; ++kk ) {
+      std::vector<double> p ( ncand );
+      for ( std::size_t j = 0; j < ncand; ++j ) p[j] = weights[j] * d2[j];
+
+      std::size_t best = 0;
+      double bestPotential = std::numeric_limits<double>::infinity();
+
+      for ( unsigned int trial = 0; trial < ntrials; ++trial ) {
+         std::size_t c = 0;
+         if ( std::any_of ( p.begin(), p.end(), [] ( double x ) { return x > 0; } ) )
+            c = std::discrete_distribution<std::size_t> ( p.begin(), p.end() ) ( shared );
+         else c = std::uniform_int_distribution<std::size_t> ( 0, ncand - 1 ) ( shared );
+
+         double potential = 0;
+         for ( std::size_t j = 0; j < ncand; ++j ) {
+            double d = metric ( candidates.data() + j * n, candidates.data() + c * n );
+            potential += weights[j] * std::min ( d2[j], d * d );
+         }
+
+         if ( potential < bestPotential ) {
+            bestPotential = potential;
+            best = c;
+         }
+      }
+
+      add ( best, centers );
+   }
+
+   return centers;
+}
+
+#endif
@@ -0,0 +1,138 @@
+#include "synthetic.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <sstream>
+#include <algorithm>
+
+// Finalizer of splitmix64: a bijection of 64 bit integers whose outputs for
+// consecutive inputs look independent
+static uint64_t mix ( uint64_t z ) {
+   z = ( z ^ ( z >> 30 ) ) * 0xbf58476d1ce4e5b9ULL;
+   z = ( z ^ ( z >> 27 ) ) * 0x94d049bb133111ebULL;
+   return z ^ ( z >> 31 );
+}
+
+// Stream of random numbers of one object of the dataset (the centers, or a
+// point), from a key computed from the seed and the index of the object
+class counterRandom {
+private:
+   uint64_t state;
+
+public:
+   counterRandom ( uint64_t seed, uint64_t index ) : state ( mix ( mix ( seed ) + index ) ) { }
+
+   uint64_t next ( void ) { return mix ( state += 0x9e3779b97f4a7c15ULL ); }
+
+   // Uniform in [0, 1), with 53 random bits
+   double uniform ( void ) { return ( next() >> 11 ) * ( 1.0 / 9007199254740992.0 ); }
+
+   // Uniform integer in [0, n)
+   unsigned int below ( unsigned int n ) { return ( ( next() >> 32 ) * n ) >> 32; }
+
+   // Two independent standard normal values (Box-Muller)
+   void normals ( double & a, double & b ) {
+      double r = std::sqrt ( -2 * std::log ( 1 - uniform() ) );
+      double theta = 6.283185307179586 * uniform();
+      a = r * std::cos ( theta );
+      b = r * std::sin ( theta );
+   }
+};
+
+// Index of the stream of the centers, distinct from those of the points
+static const uint64_t centersStream = ~uint64_t(0);
+
+bool isSynthetic ( const std::string & name ) {
+   return name.compare ( 0, 6, "synth:" ) == 0;
+}
+
+bool parseSynthetic ( const std::string & name, syntheticSpec & spec ) {
+   if ( !isSynthetic ( name ) ) return false;
+
+   syntheticSpec parsed;
+   std::istringstream in ( name.substr ( 6 ) );
+
+   for ( std::string item; std::getline ( in, item, ',' ); ) {
+      std::size_t eq = item.find ( '=' );
+      if ( eq == std::string::npos ) return false;
+
+      std::string key = item.substr ( 0, eq ), value = item.substr ( eq + 1 );
+      char * end = nullptr;
+      double v = std::strtod ( value.c_str(), &end );
+      if ( value.empty() || *end != '\0' ) return false;
+
+      // Counts are given as numbers, possibly in exponential notation (1e8)
+      bool count = v >= 1 && v <= 4294967295.0 && v == std::floor ( v );
+
+      if ( key == "N" && count ) parsed.points = v;
+      else if ( key == "d" && count ) parsed.dim = v;
+      else if ( key == "k" && count ) parsed.clusters = v;
+      else if ( key == "sd" && v >= 0 ) parsed.spread = v;
+      else if ( key == "range" && v >= 0 ) parsed.range = v;
+      else if ( key == "seed" && v >= 0 && v == std::floor ( v ) ) parsed.seed = v;
+      else return false;
+   }
+
+   spec = parsed;
+   return true;
+}
+
+std::string syntheticName ( const syntheticSpec & spec ) {
+   std::ostringstream out;
+   out << "synth:N=" << spec.points << ",d=" << spec.dim << ",k=" << spec.clusters << ",sd=" << spec.spread
+       << ",range=" << spec.range << ",seed=" << spec.seed;
+   return out.str();
+}
+
+void generateSynthetic ( const syntheticSpec & spec, unsigned int begin, unsigned int count, kMeansDataset & km,
+                         std::vector<int> & trueLabels, threadPool & pool ) {
+   unsigned int n = spec.dim, k = spec.clusters;
+
+   // Centers and standard deviations of the clusters, the same for all the
+   // portions
+   std::vector<double> centers ( std::size_t(k) * n ), sigmas ( k );
+   counterRandom centersRandom ( spec.seed, centersStream );
+   for ( auto & c : centers ) c = spec.range * ( 2 * centersRandom.uniform() - 1 );
+   for ( auto & s : sigmas ) s = spec.spread * ( 0.5 + centersRandom.uniform() );
+
+   km = kMeansDataset ( n, count );
+   std::size_t labelsBegin = trueLabels.size();
+   trueLabels.resize ( labelsBegin + count );
+
+   unsigned int threads = std::max ( 1u, std::min ( pool.size(), count / 4096 ) );
+
+   auto work = [&] ( unsigned int t ) {
+      unsigned int first = 0, share = 0;
+      datasetPartition ( count, t, threads, first, share );
+
+      for ( unsigned int i = first; i < first + share; ++i ) {
+         counterRandom rnd ( spec.seed, uint64_t(begin) + i );
+         unsigned int c = rnd.below ( k );
+         const double * center = centers.data() + std::size_t(c) * n;
+         double * x = km.data() + std::size_t(i) * n;
+
+         for ( unsigned int j = 0; j < n; j += 2 ) {
+            double a, b;
+            rnd.normals ( a, b );
+            x[j] = center[j] + sigmas[c] * a;
+            if ( j + 1 < n ) x[j+1] = center[j+1] + sigmas[c] * b;
+         }
+
+         trueLabels[labelsBegin + i] = c + 1;
+      }
+   };
+
+   pool.run ( [&] ( unsigned int t ) { if ( t < threads ) work ( t ); } );
+}
+
+void generateSyntheticPartition ( const syntheticSpec & spec, kMeansDataset & km, std::vector<int> & trueLabels,
+                                  MPI_Comm comm, threadPool & pool ) {
+   int size; MPI_Comm_size ( comm, &size );
+   int rank; MPI_Comm_rank ( comm, &rank );
+
+   unsigned int begin = 0, share = 0;
+   datasetPartition ( spec.points, rank, size, begin, share );
+
+   generateSynthetic ( spec, begin, share, km, trueLabels, pool );
+   km.setPartition ( begin, spec.points );
+}
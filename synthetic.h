@@ -0,0 +1,52 @@
+#ifndef _SYNTHETIC_H
+#define _SYNTHETIC_H
+
+#include "dataset.h"
+#include "thread_pool.h"
+
+#include <mpi.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Synthetic datasets
+// Gaussian mixtures as those of benchgenerator.m: k centers drawn uniformly in
+// [-range, range]^d, each with a standard deviation drawn uniformly in
+// [spread/2, 3 spread/2]; each point belongs to a cluster drawn uniformly, and
+// its coordinates are normally distributed around the center of the cluster
+// Every value is computed from the seed and from the index of the point with a
+// counter-based generator, so that the dataset is the same whatever the number
+// of processes and threads generating it, and any portion of it can be
+// generated on its own
+struct syntheticSpec {
+   unsigned int points = 1000000; // N
+   unsigned int dim = 20;         // d
+   unsigned int clusters = 5;     // k
+   double spread = 4;             // sd
+   double range = 10;             // range
+   uint64_t seed = 1;             // seed
+};
+
+// Parses the description of a synthetic dataset given as test name, that is
+// synth: followed by comma separated key=value pairs, with the keys above (e.g.
+// synth:N=1e8,d=20,k=50); omitted keys keep their default values
+// Returns false if the description is not valid
+bool parseSynthetic ( const std::string &, syntheticSpec & );
+
+// True if a test name describes a synthetic dataset
+bool isSynthetic ( const std::string & );
+
+// Description of a synthetic dataset with all its keys, as parsed above
+std::string syntheticName ( const syntheticSpec & );
+
+// Generates the points in [begin, begin + count) of a synthetic dataset, with
+// the threads of the pool, replacing the dataset; their true labels,
+// counted from 1 as in the benchmarks files, are appended to the vector
+void generateSynthetic ( const syntheticSpec &, unsigned int, unsigned int, kMeansDataset &, std::vector<int> &, threadPool & );
+
+// Generates the portion of each process of the communicator, split evenly as
+// by datasetPartition; the resulting dataset is that portion (see
+// kMeansDataset::isPartition), as if read with the partitioned loaders
+void generateSyntheticPartition ( const syntheticSpec &, kMeansDataset &, std::vector<int> &, MPI_Comm, threadPool & );
+
+#endif
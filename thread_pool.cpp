@@ -0,0 +1,54 @@
+#include "thread_pool.h"
+
+threadPool::threadPool ( unsigned int threads ) {
+   for ( unsigned int t = 1; t < threads; ++t )
+      workers.emplace_back ( &threadPool::workerLoop, this, t );
+}
+
+threadPool::~threadPool ( void ) {
+   {
+      std::lock_guard<std::mutex> lock ( mtx );
+      stopping = true;
+   }
+   startCond.notify_all();
+
+   for ( auto & w : workers ) w.join();
+}
+
+void threadPool::workerLoop ( unsigned int t ) {
+   unsigned int seen = 0;
+
+   while ( true ) {
+      {
+         std::unique_lock<std::mutex> lock ( mtx );
+         startCond.wait ( lock, [&] { return stopping || generation != seen; } );
+         if ( stopping ) return;
+         seen = generation;
+      }
+
+      job ( t );
+
+      std::lock_guard<std::mutex> lock ( mtx );
+      if ( --pending == 0 ) doneCond.notify_one();
+   }
+}
+
+void threadPool::run ( const std::function<void(unsigned int)> & f ) {
+   if ( workers.empty() ) {
+      f ( 0 );
+      return;
+   }
+
+   {
+      std::lock_guard<std::mutex> lock ( mtx );
+      job = f;
+      pending = workers.size();
+      ++generation;
+   }
+   startCond.notify_all();
+
+   f ( 0 );
+
+   std::unique_lock<std::mutex> lock ( mtx );
+   doneCond.wait ( lock, [&] { return pending == 0; } );
+}
@@ -0,0 +1,49 @@
+#ifndef _THREAD_POOL_H
+#define _THREAD_POOL_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+// Fixed set of worker threads, used by the solvers to split their loops over
+// the local portion of the dataset among the cores of a node
+// The threads are created once and reused at each iteration, since the loops
+// they run are often too short to pay for thread creation
+class threadPool {
+private:
+   std::vector<std::thread> workers;
+
+   // Job being run, and synchronization state: the generation is increased
+   // each time a new job is started, and pending counts the workers that are
+   // still running it
+   std::function<void(unsigned int)> job;
+   unsigned int generation = 0;
+   unsigned int pending = 0;
+   bool stopping = false;
+
+   std::mutex mtx;
+   std::condition_variable startCond;
+   std::condition_variable doneCond;
+
+   void workerLoop ( unsigned int );
+
+public:
+   // Creates a pool running jobs on the given number of threads, including the
+   // calling one (thus threads - 1 workers are created)
+   threadPool ( unsigned int = 1 );
+   ~threadPool ( void );
+
+   threadPool ( const threadPool & ) = delete;
+   threadPool & operator= ( const threadPool & ) = delete;
+
+   // Number of threads running each job
+   unsigned int size ( void ) const { return workers.size() + 1; }
+
+   // Runs f(t) for each thread index t in [0, size()), the index 0 being run by
+   // the calling thread, and returns when all of them have completed
+   void run ( const std::function<void(unsigned int)> & );
+};
+
+#endif